@@ -0,0 +1,49 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef BITBAND_H_
+#define BITBAND_H_
+
+/* Cortex-M3 bit-band of the SRAM region. Every bit of the first megabyte
+ * from 0x20000000 (on the LPC176x: the AHB SRAM banks, not the local SRAM at
+ * 0x10000000) has its own word in the alias region. Reading the word returns
+ * the bit and writing it sets or clears only that bit in a single bus
+ * transaction, so nothing else in the byte can be lost to a concurrent
+ * read-modify-write. */
+#define BITBAND_SRAM_BASE       (0x20000000ul)
+#define BITBAND_SRAM_SIZE       (0x00100000ul)
+#define BITBAND_SRAM_ALIAS      (0x22000000ul)
+
+/* True if every byte of the object can be accessed through the alias. */
+#define BITBAND_IN_SRAM(ptr, size) \
+    (   ((unsigned long)(ptr) - BITBAND_SRAM_BASE < BITBAND_SRAM_SIZE) \
+    &&  ((unsigned long)(ptr) - BITBAND_SRAM_BASE + (size) <= BITBAND_SRAM_SIZE) \
+    )
+
+/* Returns the alias of a bit array starting at base. Element n of the result
+ * is bit (n % 8) of byte (n / 8). */
+static
+inline
+volatile unsigned long *
+bitband_sram
+    (const volatile void *base
+    )
+{
+    return (volatile unsigned long *)(BITBAND_SRAM_ALIAS + ((unsigned long)base - BITBAND_SRAM_BASE) * 32);
+}
+
+#endif /* BITBAND_H_ */
@@ -0,0 +1,76 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "boot_time.h"
+#include "lpc176x_clock.h"
+#include "cycles.h"
+#include "debughlprs.h"
+
+#define NOT_REACHED             (0xfffffffful)
+
+static unsigned long g_times[BOOT_NB_PHASES];
+static unsigned long g_us;          /* Time of the last mark */
+static unsigned long g_cycles;      /* Cycle counter at the last mark */
+static unsigned long g_remainder;   /* Cycles not yet counted in g_us */
+static unsigned long g_mhz;         /* CPU clock at the last mark */
+
+void
+boot_time_init
+    (void
+    )
+{
+    unsigned i;
+    for (i = 0; i < BOOT_NB_PHASES; i++)
+    {
+        g_times[i] = NOT_REACHED;
+    }
+    cycles_init();
+    g_us        = 0;
+    g_cycles    = 0;
+    g_remainder = 0;
+    g_mhz       = clock_get_cclk() / 1000000ul;
+}
+
+void
+boot_time_mark
+    (unsigned phase
+    )
+{
+    ASSERT(phase < BOOT_NB_PHASES);
+    if (g_times[phase] == NOT_REACHED)
+    {
+        /* The cycles since the last mark are converted with the CPU clock
+         * at the last mark. This is only wrong for the interval containing
+         * clock_setup which runs from the internal oscillator up to the
+         * last few instructions. */
+        const unsigned long now     = cycles_now();
+        const unsigned long cycles  = (now - g_cycles) + g_remainder;
+        g_cycles       = now;
+        g_us          += cycles / g_mhz;
+        g_remainder    = cycles % g_mhz;
+        g_mhz          = clock_get_cclk() / 1000000ul;
+        g_times[phase] = g_us;
+    }
+}
+
+const unsigned long *
+boot_time_get
+    (void
+    )
+{
+    return g_times;
+}
@@ -0,0 +1,45 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef BOOT_TIME_H_
+#define BOOT_TIME_H_
+
+/* Startup phases in the order they normally complete. */
+enum boot_phase_e
+{   BOOT_PHASE_CLOCK            /* PLL0 running, PLL1 started */
+,   BOOT_PHASE_CONFIG_STORE     /* Settings found (and spare sectors erased) */
+,   BOOT_PHASE_USB_CONNECT      /* Soft-connect asserted */
+,   BOOT_PHASE_CONBUS           /* Chains probed and scanning started */
+,   BOOT_PHASE_READY            /* Everything set up, main loop entered */
+,   BOOT_PHASE_FIRST_SCAN       /* First conbus frame debounced */
+,   BOOT_PHASE_CONFIGURED       /* Host selected the USB configuration */
+,   BOOT_NB_PHASES
+};
+
+/* Start timing. Called first thing in main, which is time zero (the start up
+ * code before main is not included). */
+void                    boot_time_init(void);
+
+/* Record the time the given phase completed. Only the first call for each
+ * phase counts so it is cheap to call repeatedly. */
+void                    boot_time_mark(unsigned phase);
+
+/* Returns BOOT_NB_PHASES 32-bit little endian times in microseconds since
+ * boot_time_init, 0xffffffff for phases which have not completed yet. */
+const unsigned long    *boot_time_get(void);
+
+#endif /* BOOT_TIME_H_ */
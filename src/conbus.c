@@ -18,59 +18,342 @@
 #include "conbus.h"
 #include "LPC17xx.h"
 #include "lpc176x_ssp1.h"
+#include "lpc176x_clock.h"
+#include "critical.h"
+#include "debughlprs.h"
+#include "boot_time.h"
+#include "trace.h"
+#include "hotpath.h"
+#include "bitband.h"
+#include "cycles.h"
+#include <string.h>
 
-static unsigned char *input_memory;
-static unsigned char *debounce_mempos;
-static unsigned char *output_memory;
+static unsigned char *input_memory;    /* debounced state, one bit per input */
+static unsigned char *change_memory;   /* change flags, one bit per input */
+static volatile unsigned long *input_bits;     /* bit-band aliases of the */
+static volatile unsigned long *change_bits;    /* two arrays above */
+static unsigned char *debounce_memory;
+static unsigned char *output_memory;  /* CONBUS_OUTPUT_BITS bit planes */
+static volatile unsigned long *output_bits;    /* and their bit-band alias */
+static const unsigned char *tx_plane;   /* plane shifted out by this frame */
+static const unsigned char *next_plane; /* plane to show in the next slot */
+static unsigned char *raw_fill;     /* frame being received by the interrupt */
+static unsigned char *raw_ready;    /* last complete frame */
+static unsigned char *raw_prev;     /* previous frame seen by the bottom half */
+static unsigned char *counting;     /* bit per input with a release pending */
+/* Two copies of input_memory as it was at the end of a debounce pass, for
+ * conbus_copy_inputs. image_seq counts the copies made, the last one is
+ * image_memory[(image_seq & 1) * nb_inputs_div_8]. */
+static unsigned char *image_memory;
+static volatile unsigned image_seq;
+static unsigned       image_stale;  /* input_memory changed since the copy */
 static unsigned       write_pos;
 static unsigned       read_pos;
+static void         (*on_input_changed)(unsigned input, int active);
+static void         (*on_scan)(void);
+
+static unsigned long  baud_rate;
+static unsigned       nb_inputs_div_8;
+static unsigned       nb_outputs_div_8;
+static unsigned char  test_pattern[16];
+static unsigned       flags;
+static unsigned       probe;        /* CONBUS_PROBE_ outcome */
+static unsigned       guard_value;
+static unsigned       debounce_ticks;
+static unsigned       second_pass;  /* reading the frame again to compare */
+static unsigned       mismatch;     /* second read differed from the first */
+static unsigned long  scan_start;   /* cycles_now() when the scan started */
+static unsigned       refresh;      /* frame only carries outputs */
+static unsigned       bam_slot;     /* part of the scan period being shown */
+static unsigned       bam_unit;     /* fifteenth of the scan period in us */
+static struct conbus_stats_s stats;
+
+/* Bus geometry. A build for one console can define CONBUS_FIXED_INPUTS_DIV_8
+ * and CONBUS_FIXED_OUTPUTS_DIV_8, the interrupt is then compiled for those
+ * lengths: the bytes skipped at the start of each direction are known at
+ * compile time and whole FIFO fills of 8 bytes are moved without polling the
+ * status between bytes. The configuration must give the same lengths and
+ * CONBUS_FLAG_PROBE is ignored. The generic kernel works with whatever was
+ * configured or probed at runtime. Positions are compared as pos + 1 against
+ * the start offsets as a start of zero would otherwise make -Wextra warn. */
+#if defined(CONBUS_FIXED_INPUTS_DIV_8) && defined(CONBUS_FIXED_OUTPUTS_DIV_8)
+#define CONBUS_FIXED_GEOMETRY
+#define BUS_LENGTH                  \
+    ((CONBUS_FIXED_INPUTS_DIV_8 > CONBUS_FIXED_OUTPUTS_DIV_8) ? CONBUS_FIXED_INPUTS_DIV_8 : CONBUS_FIXED_OUTPUTS_DIV_8)
+#define START_READING_INPUT         (BUS_LENGTH - CONBUS_FIXED_INPUTS_DIV_8)
+#define START_WRITING_OUTPUT        (BUS_LENGTH - CONBUS_FIXED_OUTPUTS_DIV_8)
+#else
 static unsigned       start_reading_input;
 static unsigned       start_writing_output;
 static unsigned       bus_length;
+#define BUS_LENGTH                  (bus_length)
+#define START_READING_INPUT         (start_reading_input)
+#define START_WRITING_OUTPUT        (start_writing_output)
+#endif
+
+#define SSP_SR_TFE                  (1 << 0) /* transmit FIFO empty */
+#define SSP_SR_RNE                  (1 << 2) /* receive FIFO not empty */
+#define SSP_SR_RFF                  (1 << 3) /* receive FIFO full */
+#define SSP_SR_BSY                  (1 << 4)
+#define SSP_RIS_RX_HALF             (1 << 2) /* receive FIFO at least half full */
+#define SSP_FIFO_DEPTH              (8)
+
+#define SSP_UNROLL_4(STEP)          STEP(0) STEP(1) STEP(2) STEP(3)
+#define SSP_UNROLL_8(STEP)          SSP_UNROLL_4(STEP) STEP(4) STEP(5) STEP(6) STEP(7)
+#define RX_STORE_(i)                frame[i] = LPC_SSP1->DR;
+#define RX_COMPARE_(i)              diff |= frame[i] ^ (LPC_SSP1->DR & 0xff);
+#define TX_WRITE_(i)                LPC_SSP1->DR = frame[i];
 
 #define DEBOUNCE_TICKS (10)
 
+#define TIMER_IR_MR0            (1 << 0)
+#define TIMER_IR_MR1            (1 << 1)
+#define TIMER_MCR_MR0I          (1 << 0)
+#define TIMER_MCR_MR0R          (1 << 1)
+#define TIMER_MCR_MR1I          (1 << 3)
+
+/* Bit angle modulation. A scan period has slots of 8, 4, 2 and 1 units
+ * (BAM_UNITS in all) starting with the scan. The frame starting each slot
+ * shifts out the plane for the next one, which is latched when that slot
+ * starts: the plane of weight 2^n is on the bus during the slot before the
+ * one of 2^n units. */
+#define BAM_UNITS               (15)
+#define BAM_NB_SLOTS            (CONBUS_OUTPUT_BITS)
+static const unsigned char bam_plane[BAM_NB_SLOTS]      = {2, 1, 0, 3};
+/* Unit of the next MR1 match once a slot has started. Slot 0 starts on MR0,
+ * which also restarts the timer. */
+static const unsigned char bam_next_match[BAM_NB_SLOTS] = {8, 12, 14, 8};
+
+#define DEFAULT_BAUD_RATE       (60000)
+
+/* Calibration: every candidate clock must pass CALIBRATION_ROUNDS round
+ * trips of the test pattern. Candidates go up by at least 25% each step and
+ * the rate which is finally used is CALIBRATION_MARGIN_PERCENT of the fastest
+ * one which passed. */
+#define CALIBRATION_ROUNDS          (8)
+#define CALIBRATION_MARGIN_PERCENT  (70)
+
+/* Byte walked around the chain to measure its length */
+#define PROBE_MARKER                (0xa5)
+
+#define TEST_PATTERN(i)             (test_pattern[(i) % sizeof(test_pattern)])
+
+/* Write one byte to the bus and return the byte which was shifted out in
+ * exchange. Only used while the interrupts are not running. */
+static unsigned conbus_exchange(unsigned data)
+{
+    LPC_SSP1->DR = data;
+    while (!(LPC_SSP1->SR & (1 << 2)))
+    {
+    }
+    return LPC_SSP1->DR & 0xff;
+}
+
+/* Shift the first nb_bytes of the test pattern around a looped back chain of
+ * chain_length bytes followed by zeros. Returns zero if all of it came
+ * back. */
+static unsigned conbus_round_trip(unsigned chain_length, unsigned nb_bytes)
+{
+    unsigned errors = 0;
+    unsigned i;
+    for (i = 0; i < chain_length + nb_bytes; i++)
+    {
+        unsigned data = conbus_exchange((i < nb_bytes) ? TEST_PATTERN(i) : 0);
+        if ((i >= chain_length) && (data != TEST_PATTERN(i - chain_length)))
+        {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/* Measure the length of a looped back chain by walking a marker through it.
+ * Returns zero if the marker does not come back within max_length bytes.
+ * Nothing is loaded or latched and the chain is left full of zeros, so the
+ * outputs never show the marker. */
+static unsigned conbus_probe_length(unsigned max_length)
+{
+    unsigned length = 0;
+    unsigned i;
+    for (i = 0; i < max_length; i++)
+    {
+        (void)conbus_exchange(0);
+    }
+    for (i = 0; i <= max_length; i++)
+    {
+        unsigned data = conbus_exchange((i == 0) ? PROBE_MARKER : 0);
+        if (data == PROBE_MARKER)
+        {
+            length = i;
+            break;
+        }
+        if (data)
+        {
+            break;
+        }
+    }
+    if (!length)
+    {
+        /* The marker may still be in the chain */
+        (void)conbus_round_trip(max_length, 0);
+    }
+    return length;
+}
+
+/* Search upwards from the default clock for the fastest one at which a
+ * pseudo random pattern survives a trip around the whole chain and apply it
+ * with some margin. The chain is left full of zeros. */
+static void conbus_calibrate(unsigned chain_length)
+{
+    unsigned long best   = 0;
+    unsigned long target = DEFAULT_BAUD_RATE;
+    unsigned long limit  = clock_get_cclk() / 2;
+
+    while (target <= limit)
+    {
+        const unsigned long actual = ssp1_set_baud_rate(target);
+        unsigned round;
+        for (round = 0; round < CALIBRATION_ROUNDS; round++)
+        {
+            if (conbus_round_trip(chain_length, sizeof(test_pattern)))
+            {
+                break;
+            }
+        }
+        if (round < CALIBRATION_ROUNDS)
+        {
+            break;
+        }
+        best   = actual;
+        target = actual + actual / 4;
+    }
+
+    baud_rate = ssp1_set_baud_rate
+        ((best)
+        ? (best / 100) * CALIBRATION_MARGIN_PERCENT
+        : DEFAULT_BAUD_RATE
+        );
+    (void)conbus_round_trip(chain_length, 0);
+}
+
 void conbus_init(const struct conbus_config_s *config, unsigned char *memory)
 {
     /* Setup SPI */
     {
+        const unsigned long rate = (config->baud_rate) ? config->baud_rate : DEFAULT_BAUD_RATE;
         struct ssp_config_s ssp_cfg;
-        ssp_cfg.baud_rate      = 60000;
+        ssp_cfg.baud_rate      = rate;
         ssp_cfg.bits_per_frame = 8;
         ssp_cfg.flags          = 0;
         ssp_cfg.mode           = SSP_MODE_MASTER;
         ssp_cfg.protocol       = SSP_PROTOCOL_SPI;
-        ssp1_setup(100000000UL, &ssp_cfg);
+        ssp1_setup(&ssp_cfg);
+        baud_rate              = ssp1_set_baud_rate(rate);
+    }
+
+    /* Setup parallel load / output latch pin */
+    LPC_GPIO2->FIODIR = 1 << 13;
+
+    /* Temp indicator */
+    LPC_GPIO0->FIODIR |= 1 << 2;
+
+    nb_inputs_div_8  = config->nb_inputs_div_8;
+    nb_outputs_div_8 = config->nb_outputs_div_8;
+    flags            = config->flags;
+#if defined(CONBUS_FIXED_GEOMETRY)
+    ASSERT((nb_inputs_div_8 == CONBUS_FIXED_INPUTS_DIV_8) && (nb_outputs_div_8 == CONBUS_FIXED_OUTPUTS_DIV_8));
+    flags           &= ~CONBUS_FLAG_PROBE;
+#endif
+    guard_value      = config->guard_value & 0xff;
+    debounce_ticks   = (config->debounce_ticks) ? config->debounce_ticks : DEBOUNCE_TICKS;
+    ASSERT(debounce_ticks <= 0x7f);
+    if (flags & (CONBUS_FLAG_CALIBRATE | CONBUS_FLAG_PROBE))
+    {
+        unsigned lfsr = 0xace1u;
+        unsigned i;
+        for (i = 0; i < sizeof(test_pattern); i++)
+        {
+            unsigned j;
+            for (j = 0; j < 8; j++)
+            {
+                lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0xb400u : 0);
+            }
+            test_pattern[i] = lfsr & 0xff;
+        }
+
+        /* Shift mode with the output latch held - nothing reaches the
+         * outputs until the first scan, by when the chain is all zeros */
+        LPC_GPIO2->FIOSET = 1 << 13;
+        if (flags & CONBUS_FLAG_PROBE)
+        {
+            /* The outputs are as configured. Telling them from the inputs
+             * would take a load, which latches the outputs as well. */
+            const unsigned chain_length = conbus_probe_length(nb_inputs_div_8 + nb_outputs_div_8);
+            probe = CONBUS_PROBE_FALLBACK;
+            if  (   (chain_length > nb_outputs_div_8)
+                &&  (chain_length - nb_outputs_div_8 <= nb_inputs_div_8)
+                )
+            {
+                nb_inputs_div_8 = chain_length - nb_outputs_div_8;
+                probe           = CONBUS_PROBE_MEASURED;
+            }
+        }
+        if (flags & CONBUS_FLAG_CALIBRATE)
+        {
+            conbus_calibrate(nb_inputs_div_8 + nb_outputs_div_8);
+        }
+        LPC_GPIO2->FIOCLR = 1 << 13;
     }
 
     /* Setup conbus */
-    output_memory  = memory;
-    input_memory   = memory + config->nb_outputs_div_8;
-    if (config->nb_inputs_div_8 > config->nb_outputs_div_8)
+    on_input_changed = config->on_input_changed;
+    on_scan          = config->on_scan;
+    ASSERT(BITBAND_IN_SRAM(memory, CONBUS_MEMORY_SIZE(nb_inputs_div_8, nb_outputs_div_8)));
+    output_memory    = memory;
+    output_bits      = bitband_sram(output_memory);
+    tx_plane         = output_memory + (CONBUS_OUTPUT_BITS - 1) * nb_outputs_div_8;
+    next_plane       = tx_plane;
+    input_memory     = output_memory + CONBUS_OUTPUT_BITS * nb_outputs_div_8;
+    change_memory    = input_memory + nb_inputs_div_8;
+    input_bits       = bitband_sram(input_memory);
+    change_bits      = bitband_sram(change_memory);
+    debounce_memory  = change_memory + nb_inputs_div_8;
+    raw_fill         = debounce_memory + 8 * nb_inputs_div_8;
+    raw_ready        = raw_fill + nb_inputs_div_8;
+    raw_prev         = raw_ready + nb_inputs_div_8;
+    counting         = raw_prev + nb_inputs_div_8;
+    image_memory     = counting + nb_inputs_div_8;
+#if !defined(CONBUS_FIXED_GEOMETRY)
+    if (nb_inputs_div_8 > nb_outputs_div_8)
     {
-        bus_length           = config->nb_inputs_div_8;
-        start_writing_output = config->nb_inputs_div_8 - config->nb_outputs_div_8;
+        bus_length           = nb_inputs_div_8;
+        start_writing_output = nb_inputs_div_8 - nb_outputs_div_8;
         start_reading_input  = 0;
     }
     else
     {
-        bus_length           = config->nb_outputs_div_8;
+        bus_length           = nb_outputs_div_8;
         start_writing_output = 0;
-        start_reading_input  = config->nb_outputs_div_8 - config->nb_inputs_div_8;
+        start_reading_input  = nb_outputs_div_8 - nb_inputs_div_8;
     }
-
-    /* Setup parallel load / output latch pin */
-    LPC_GPIO2->FIODIR = 1 << 13;
-
-    /* Temp indicator */
-    LPC_GPIO0->FIODIR |= 1 << 2;
+#endif
+    /* A whole frame has to fit in the shortest slot with some margin for
+     * the interrupt latency */
+    bam_unit = CONBUS_SCAN_PERIOD_US / BAM_UNITS;
+    if (2 * ((BUS_LENGTH * 8000000ul + baud_rate - 1) / baud_rate) > bam_unit)
+    {
+        flags &= ~CONBUS_FLAG_DIMMING;
+    }
+    /* The debounce bottom half runs below every interrupt */
+    NVIC_SetPriority(PendSV_IRQn, 31);
 
 
     /* setup timer for bus reads */
     LPC_TIM0->CTCR  = 0;
-    LPC_TIM0->MCR   = 0x3;
-    LPC_TIM0->PR    = 24999;
-    LPC_TIM0->MR0   = 5; /* Milliseconds */
+    LPC_TIM0->MCR   = TIMER_MCR_MR0I | TIMER_MCR_MR0R | ((flags & CONBUS_FLAG_DIMMING) ? TIMER_MCR_MR1I : 0);
+    LPC_TIM0->PR    = clock_set_pclk(CLOCK_PCLK_TIMER0, 4) / 1000000 - 1;
+    LPC_TIM0->MR0   = CONBUS_SCAN_PERIOD_US; /* Microseconds */
+    LPC_TIM0->MR1   = bam_unit * bam_next_match[0];
     LPC_TIM0->TCR   = 1;
 
 
@@ -81,92 +364,317 @@ void conbus_init(const struct conbus_config_s *config, unsigned char *memory)
 
 }
 
-void SSP1_IRQHandler(void)
+/* Publish a change of the debounced state of an input. Single stores to the
+ * bit-band aliases, so readers never see a half updated byte. */
+static void conbus_report(unsigned input, unsigned active)
 {
-    LPC_SSP1->ICR = (1 << 1);
+    input_bits[input]  = active;
+    change_bits[input] = 1;
+    image_stale        = 1;
+    if (on_input_changed)
+    {
+        on_input_changed(input, active);
+    }
+}
 
-    while ((LPC_SSP1->SR & (1 << 2)) && (read_pos < bus_length))
+/* Debounce the 8 inputs of one frame byte and report the changes. Returns
+ * the inputs which are still counting down to a release.
+ *
+ * Debouncer byte of every input: bit 7 is set while the raw input is active
+ * and the low bits count down the scans left before a release is reported.
+ * The debounced state is active exactly when bit 7 is set or the count has
+ * not run out, so it never has to be read back to find the changes. */
+static inline unsigned conbus_debounce_byte(unsigned byte, unsigned new_ip_state)
+{
+    unsigned char *debounce_mempos = &debounce_memory[8 * byte];
+    unsigned       input           = 8 * byte;
+    unsigned       pending         = 0;
+    unsigned       i;
+    for (i = 0; i < 8; i++, input++, new_ip_state >>= 1)
     {
-        if (read_pos < start_reading_input)
+        unsigned       debouncer = *debounce_mempos;
+        const unsigned count     = debouncer & 0x7f;
+        if (count)
         {
-            (void)LPC_SSP1->DR;
+            debouncer--;
         }
-        else
+        if (new_ip_state & 1)
         {
-            unsigned new_ip_state = LPC_SSP1->DR;
-            unsigned old_ip_state = input_memory[read_pos - start_reading_input];
-            unsigned i;
-            unsigned mask = 1;
-            for (i = 0; i < 8; i++, mask <<= 1)
+            if (!(debouncer & 0x80))
             {
-                unsigned debouncer = *debounce_mempos;
-                if (debouncer & 0x7f)
-                {
-                    debouncer--;
-                }
-                if (new_ip_state & mask)
-                {
-                    if (!(debouncer & 0x80))
-                    {
-                        debouncer       = 0x80 | DEBOUNCE_TICKS;
-                        old_ip_state   |= mask;
-                    }
-                }
-                else
+                debouncer = 0x80 | debounce_ticks;
+                if (!count)
                 {
-                    if (debouncer & 0x80)
-                    {
-                        debouncer       = DEBOUNCE_TICKS;
-                    }
-                    else if (debouncer == 0)
-                    {
-                        old_ip_state   &= ~mask;
-                    }
+                    conbus_report(input, 1);
                 }
-                *debounce_mempos++ = debouncer;
             }
-            output_memory[0]                                = old_ip_state;
-            input_memory[read_pos - start_reading_input]    = old_ip_state;
+        }
+        else
+        {
+            if (debouncer & 0x80)
+            {
+                debouncer = debounce_ticks;
+            }
+            else if (count == 1)
+            {
+                conbus_report(input, 0);
+            }
+        }
+        if (debouncer & 0x7f)
+        {
+            pending |= 1u << i;
+        }
+        *debounce_mempos++ = debouncer;
+    }
+    return pending;
+}
+
+static inline unsigned long conbus_load_word(const unsigned char *p)
+{
+    unsigned long word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* Bottom half of the scan, pended by SSP1_IRQHandler once a frame has been
+ * received. PendSV has the lowest priority so the debouncing, change
+ * detection and event generation for the whole frame run below every
+ * interrupt. conbus owns PendSV.
+ *
+ * Four bytes of the frame are looked at at once: when none of them changed
+ * since the previous frame and none of their inputs are counting down there
+ * is nothing to do, which is most of the console on every scan. */
+HOTPATH_RAMFUNC void PendSV_Handler(void)
+{
+    /* The guard register is not an input */
+    const unsigned       nb_inputs = BUS_LENGTH - START_READING_INPUT - ((flags & CONBUS_FLAG_GUARD_BYTE) ? 1 : 0);
+    const unsigned char *raw       = raw_ready;
+    unsigned             byte;
+    HOTPATH_BEGIN(HOTPATH_DEBOUNCE);
+    boot_time_mark(BOOT_PHASE_FIRST_SCAN);
+    for (byte = 0; byte < nb_inputs; byte += 4)
+    {
+        const unsigned nb_bytes = (nb_inputs - byte < 4) ? (nb_inputs - byte) : 4;
+        unsigned       i;
+        if  (   (nb_bytes == 4)
+            &&  (   (conbus_load_word(&raw[byte]) ^ conbus_load_word(&raw_prev[byte]))
+                |   conbus_load_word(&counting[byte])
+                ) == 0
+            )
+        {
+            continue;
+        }
+        for (i = byte; i < byte + nb_bytes; i++)
+        {
+            counting[i] = conbus_debounce_byte(i, raw[i]);
+            raw_prev[i] = raw[i];
+        }
+    }
+    if (image_stale)
+    {
+        /* Fill the copy readers are not using and only then switch them
+         * over to it */
+        image_stale = 0;
+        memcpy(&image_memory[((image_seq + 1) & 1) * nb_inputs_div_8], input_memory, nb_inputs_div_8);
+        __DMB();
+        image_seq++;
+    }
+    HOTPATH_END(HOTPATH_DEBOUNCE);
+}
+
+HOTPATH_RAMFUNC void SSP1_IRQHandler(void)
+{
+    HOTPATH_BEGIN(HOTPATH_SSP1_IRQ);
+    LPC_SSP1->ICR = (1 << 1);
+
+    /* Top half: only move the data out of the FIFO, the debouncing is done
+     * by PendSV_Handler. */
+#if defined(CONBUS_FIXED_GEOMETRY)
+    /* One block of inputs without polling between bytes: eight when the
+     * receive FIFO is full, four when it is at least half full, which is
+     * what the receive interrupt fires at. The loop below takes whatever
+     * came in after that: checking for another block costs more status
+     * reads than it saves. */
+    if ((read_pos + 1 > START_READING_INPUT) && (read_pos + SSP_FIFO_DEPTH / 2 <= BUS_LENGTH))
+    {
+        unsigned char *frame = &raw_fill[read_pos - START_READING_INPUT];
+        unsigned       diff  = 0;
+        if ((read_pos + SSP_FIFO_DEPTH <= BUS_LENGTH) && (LPC_SSP1->SR & SSP_SR_RFF))
+        {
+            if (second_pass)
+            {
+                SSP_UNROLL_8(RX_COMPARE_)
+            }
+            else
+            {
+                SSP_UNROLL_8(RX_STORE_)
+            }
+            read_pos += SSP_FIFO_DEPTH;
+        }
+        else if (LPC_SSP1->RIS & SSP_RIS_RX_HALF)
+        {
+            if (second_pass)
+            {
+                SSP_UNROLL_4(RX_COMPARE_)
+            }
+            else
+            {
+                SSP_UNROLL_4(RX_STORE_)
+            }
+            read_pos += SSP_FIFO_DEPTH / 2;
+        }
+        if (diff)
+        {
+            mismatch = 1;
+        }
+    }
+#endif
+    while ((LPC_SSP1->SR & (1 << 2)) && (read_pos < BUS_LENGTH))
+    {
+        if (read_pos + 1 <= START_READING_INPUT)
+        {
+            (void)LPC_SSP1->DR;
+        }
+        else if (second_pass)
+        {
+            if (raw_fill[read_pos - START_READING_INPUT] != (LPC_SSP1->DR & 0xff))
+            {
+                mismatch = 1;
+            }
+        }
+        else
+        {
+            raw_fill[read_pos - START_READING_INPUT] = LPC_SSP1->DR;
         }
         read_pos++;
     }
-    if (read_pos >= bus_length)
+    if ((read_pos >= BUS_LENGTH) && (LPC_SSP1->IMSC & (1 << 2)))
     {
-        /* Disable all read interrupts if all data read */
-        LPC_SSP1->IMSC &= ~((1 << 1) | (1 << 2));
         LPC_GPIO2->FIOCLR = 1 << 13;
+        if (refresh)
+        {
+            /* Only there for the outputs, what was read is overwritten by
+             * the next scan */
+            LPC_SSP1->IMSC &= ~((1 << 1) | (1 << 2));
+        }
+        else if ((flags & CONBUS_FLAG_DOUBLE_READ) && (!second_pass))
+        {
+            /* Load the inputs again and read the same frame a second time.
+             * The outputs are latched again with the same data. */
+            (void)LPC_GPIO2->FIOPIN;
+            LPC_GPIO2->FIOSET = 1 << 13;
+            tx_plane        = next_plane;
+            second_pass     = 1;
+            write_pos       = 0;
+            read_pos        = 0;
+            LPC_SSP1->IMSC  = (1 << 3) | (1 << 2) | (1 << 1);
+        }
+        else
+        {
+            const unsigned nb_inputs = BUS_LENGTH - START_READING_INPUT;
+            const unsigned long scan_cycles = cycles_now() - scan_start;
+            /* Disable all read interrupts if all data read */
+            LPC_SSP1->IMSC &= ~((1 << 1) | (1 << 2));
+            stats.frames++;
+            if (scan_cycles > stats.worst_cycles)
+            {
+                stats.worst_cycles = scan_cycles;
+            }
+            if (mismatch)
+            {
+                stats.mismatched++;
+                TRACE(TRACE_EVENT_CONBUS_MISMATCH, stats.frames, 0);
+            }
+            else if ((flags & CONBUS_FLAG_GUARD_BYTE) && (raw_fill[nb_inputs - 1] != guard_value))
+            {
+                stats.bad_guard++;
+                TRACE(TRACE_EVENT_CONBUS_BAD_GUARD, stats.frames, raw_fill[nb_inputs - 1]);
+            }
+            else
+            {
+                /* Only frames which passed the checks get debounced */
+                unsigned char *frame = raw_fill;
+                raw_fill  = raw_ready;
+                raw_ready = frame;
+                SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+            }
+            second_pass     = 0;
+            mismatch        = 0;
+        }
     }
 
-    while ((LPC_SSP1->SR & (1 << 1)) && (write_pos < bus_length))
+#if defined(CONBUS_FIXED_GEOMETRY)
+    /* A whole FIFO fill of outputs at once while the bus is idle, which also
+     * means the receive FIFO has room for everything that comes back. */
+    if  (   (write_pos + 1 > START_WRITING_OUTPUT)
+        &&  (write_pos + SSP_FIFO_DEPTH <= BUS_LENGTH)
+        &&  ((LPC_SSP1->SR & (SSP_SR_TFE | SSP_SR_RNE | SSP_SR_BSY)) == SSP_SR_TFE)
+        )
+    {
+        const unsigned char *frame = &tx_plane[write_pos - START_WRITING_OUTPUT];
+        SSP_UNROLL_8(TX_WRITE_)
+        write_pos += SSP_FIFO_DEPTH;
+    }
+#endif
+    while ((LPC_SSP1->SR & (1 << 1)) && (write_pos < BUS_LENGTH))
     {
-        if (write_pos < start_writing_output)
+        if (write_pos + 1 <= START_WRITING_OUTPUT)
         {
             LPC_SSP1->DR = 0;
         }
         else
         {
-            LPC_SSP1->DR = output_memory[write_pos - start_writing_output];
+            LPC_SSP1->DR = tx_plane[write_pos - START_WRITING_OUTPUT];
         }
         write_pos++;
     }
-    if (write_pos >= bus_length)
+    if (write_pos >= BUS_LENGTH)
     {
         /* Disable transmit interrupt if all data written */
         LPC_SSP1->IMSC &= ~(1 << 3);
     }
+    HOTPATH_END(HOTPATH_SSP1_IRQ);
 }
 
 void TIMER0_IRQHandler(void)
 {
-    LPC_TIM0->IR = 1;
+    const unsigned ir = LPC_TIM0->IR;
+    LPC_TIM0->IR = ir;
+    /* MR0 starts a scan, MR1 the output only frames of the other slots */
+    bam_slot = (ir & TIMER_IR_MR0) ? 0 : ((bam_slot + 1) % BAM_NB_SLOTS);
+    if (flags & CONBUS_FLAG_DIMMING)
+    {
+        next_plane      = output_memory + bam_plane[bam_slot] * nb_outputs_div_8;
+        LPC_TIM0->MR1   = bam_unit * bam_next_match[bam_slot];
+    }
     if (!LPC_SSP1->IMSC)
     {
         LPC_GPIO2->FIOSET = 1 << 13;
+        scan_start      = cycles_now();
+        refresh         = (bam_slot != 0);
+        /* The first pass of a double read is latched again by the second,
+         * so it shifts what the outputs show now */
+        if ((refresh) || (!(flags & CONBUS_FLAG_DOUBLE_READ)))
+        {
+            tx_plane    = next_plane;
+        }
         write_pos       = 0;
         read_pos        = 0;
-        debounce_mempos = input_memory + (bus_length - start_reading_input);
         LPC_SSP1->IMSC  = (1 << 3) | (1 << 2) | (1 << 1);
     }
+    else if (bam_slot == 0)
+    {
+        stats.overruns++;
+        TRACE(TRACE_EVENT_CONBUS_OVERRUN, stats.frames, 0);
+    }
+    else
+    {
+        stats.skipped_refreshes++;
+    }
+    if ((bam_slot == 0) && (on_scan))
+    {
+        on_scan();
+    }
 #if 1
     if (LPC_GPIO0->FIOPIN & (1 << 2))
         LPC_GPIO0->FIOCLR = 1 << 2;
@@ -175,5 +683,93 @@ void TIMER0_IRQHandler(void)
 #endif
 }
 
+unsigned long conbus_get_baud_rate(void)
+{
+    return baud_rate;
+}
+
+unsigned conbus_get_nb_inputs_div_8(void)
+{
+    return nb_inputs_div_8;
+}
+
+unsigned conbus_get_nb_outputs_div_8(void)
+{
+    return nb_outputs_div_8;
+}
+
+unsigned conbus_get_probe(void)
+{
+    return probe;
+}
+
+void conbus_get_stats(struct conbus_stats_s *s)
+{
+    const unsigned long state = critical_enter();
+    *s = stats;
+    critical_exit(state);
+}
+
+int conbus_get_dimming(void)
+{
+    return (flags & CONBUS_FLAG_DIMMING) != 0;
+}
+
+void conbus_set_output_level(unsigned output, unsigned level)
+{
+    unsigned plane;
+    ASSERT((output < 8 * nb_outputs_div_8) && (level < CONBUS_OUTPUT_LEVELS));
+    for (plane = 0; plane < CONBUS_OUTPUT_BITS; plane++)
+    {
+        output_bits[plane * 8 * nb_outputs_div_8 + output] = (level >> plane) & 1;
+    }
+}
 
+int conbus_get_input(unsigned input)
+{
+    ASSERT(input < 8 * nb_inputs_div_8);
+    return input_bits[input];
+}
 
+unsigned conbus_copy_inputs(unsigned char *dst, unsigned max_bytes)
+{
+    /* The guard register is not an input */
+    unsigned nb_bytes = nb_inputs_div_8 - ((flags & CONBUS_FLAG_GUARD_BYTE) ? 1 : 0);
+    unsigned seq;
+    unsigned i;
+    if ((!input_memory) || (nb_bytes > nb_inputs_div_8))
+    {
+        nb_bytes = 0;
+    }
+    if (nb_bytes > max_bytes)
+    {
+        nb_bytes = max_bytes;
+    }
+    /* The debounce bottom half may be preempted half way through its pass,
+     * so copy the image of the last complete pass instead of input_memory.
+     * Start again if a pass ended during the copy, which can only happen to
+     * callers PendSV can preempt. */
+    do
+    {
+        seq = image_seq;
+        __DMB();
+        for (i = 0; i < nb_bytes; i++)
+        {
+            dst[i] = image_memory[(seq & 1) * nb_inputs_div_8 + i];
+        }
+        __DMB();
+    }
+    while (seq != image_seq);
+    return nb_bytes;
+}
+
+int conbus_test_and_clear_change(unsigned input)
+{
+    ASSERT(input < 8 * nb_inputs_div_8);
+    if (!change_bits[input])
+    {
+        return 0;
+    }
+    change_bits[input] = 0;
+    return 1;
+}
@@ -18,14 +18,133 @@
 #ifndef CONBUS_H_
 #define CONBUS_H_
 
+/* Number of bytes of memory conbus_init requires. It must be in the
+ * bit-banded SRAM (the AHB SRAM banks) as the debounced inputs, their change
+ * flags and the output bit planes are kept there as bit arrays. */
+#define CONBUS_MEMORY_SIZE(nb_inputs_div_8, nb_outputs_div_8) \
+    (CONBUS_OUTPUT_BITS * (nb_outputs_div_8) + 16 * (nb_inputs_div_8))
+
+/* Time between the starts of two scans */
+#define CONBUS_SCAN_PERIOD_US   (5000)
+
+/* Outputs have CONBUS_OUTPUT_LEVELS brightness levels, zero being off. */
+#define CONBUS_OUTPUT_BITS      (4)
+#define CONBUS_OUTPUT_LEVELS    (1 << CONBUS_OUTPUT_BITS)
+
+/* Search for the fastest reliable serial clock during conbus_init. This
+ * requires the serial output of the last output register to be wired to the
+ * serial input of the first input register so that data written to the bus
+ * comes back after nb_inputs_div_8 + nb_outputs_div_8 bytes. */
+#define CONBUS_FLAG_CALIBRATE   (0x0001)
+
+/* Measure the length of the chain during conbus_init instead of trusting
+ * the configuration: the output chain is nb_outputs_div_8 long and the rest
+ * are inputs, up to nb_inputs_div_8 which the memory has been sized for.
+ * This needs the same wiring as CONBUS_FLAG_CALIBRATE. Only zeros are ever
+ * latched onto the outputs while it runs. If the chain does not look right
+ * the configured lengths are used, see conbus_get_probe(). */
+#define CONBUS_FLAG_PROBE       (0x0002)
+
+/* Outcome of CONBUS_FLAG_PROBE */
+#define CONBUS_PROBE_OFF        (0) /* not asked for */
+#define CONBUS_PROBE_MEASURED   (1) /* the lengths are the measured ones */
+#define CONBUS_PROBE_FALLBACK   (2) /* no sensible length, configured used */
+
+/* The last input register (the one furthest from the controller) has its
+ * parallel inputs tied to guard_value. Frames where it reads anything else
+ * were corrupted on the way and are discarded. It is counted in
+ * nb_inputs_div_8 but does not report inputs. */
+#define CONBUS_FLAG_GUARD_BYTE  (0x0004)
+
+/* Every scan loads and reads the inputs twice and frames where the two reads
+ * differ are discarded. Doubles the bus traffic. */
+#define CONBUS_FLAG_DOUBLE_READ (0x0008)
+
+/* Bit angle modulate the outputs so they show all CONBUS_OUTPUT_LEVELS
+ * levels. Every scan period is split into slots of 8, 4, 2 and 1 fifteenths
+ * and the outputs show one bit plane of the levels during each, which takes
+ * three extra frames on the bus per scan (their inputs are not used). The
+ * flag is dropped by conbus_init if the bus is too slow to fit a frame in half
+ * the shortest slot: the serial clock has to be at least
+ * 16 * bytes / (CONBUS_SCAN_PERIOD_US / 15) MHz, with bytes the longer of
+ * the two chains, so about 3.1 MHz for 64 bytes. The default clock only
+ * carries one byte. Without the flag an output is on at levels of 8 and
+ * up. */
+#define CONBUS_FLAG_DIMMING     (0x0010)
+
 struct conbus_config_s
 {
     unsigned    nb_inputs_div_8;  /* Every input requires 1 byte */
     unsigned    nb_outputs_div_8; /* Every output requires 1 bit */
+    /* Called from the debounce bottom half (the PendSV exception, which
+     * conbus takes over) whenever the debounced state of an input
+     * changes. */
+    void      (*on_input_changed)(unsigned input, int active);
+    unsigned    flags;            /* Combination of CONBUS_FLAG_ values */
+    unsigned    guard_value;      /* Used with CONBUS_FLAG_GUARD_BYTE */
+    /* Scans an input must be stable for before a release is reported, at
+     * most 127. Zero selects the default. */
+    unsigned    debounce_ticks;
+    /* Called from the scan timer interrupt at the start of every scan
+     * period, whether the scan could start or not. May be null. */
+    void      (*on_scan)(void);
+    /* Serial clock in Hz. Zero selects the default of 60 kHz. With
+     * CONBUS_FLAG_CALIBRATE it is replaced by the calibrated one. */
+    unsigned long baud_rate;
+};
+
+struct conbus_stats_s
+{
+    unsigned long   frames;         /* Scans completed */
+    unsigned long   mismatched;     /* Discarded by CONBUS_FLAG_DOUBLE_READ */
+    unsigned long   bad_guard;      /* Discarded by CONBUS_FLAG_GUARD_BYTE */
+    unsigned long   overruns;       /* Scans skipped as the previous one had
+                                     * not finished by the next tick */
+    unsigned long   worst_cycles;   /* Longest scan in CPU clock cycles, from
+                                     * the tick to the last byte read */
+    unsigned long   skipped_refreshes; /* CONBUS_FLAG_DIMMING frames skipped
+                                     * as the previous frame had not finished,
+                                     * the outputs kept the last plane */
 };
 
 void conbus_init(const struct conbus_config_s *config, unsigned char *memory);
 
+/* Returns the serial clock rate the bus is running at. */
+unsigned long conbus_get_baud_rate(void);
+
+/* Return the chain lengths the bus is scanning. */
+unsigned conbus_get_nb_inputs_div_8(void);
+unsigned conbus_get_nb_outputs_div_8(void);
+
+/* Returns the CONBUS_PROBE_ outcome of the chain length probe. */
+unsigned conbus_get_probe(void);
+
+/* Copy the frame integrity counters. */
+void conbus_get_stats(struct conbus_stats_s *stats);
+
+/* Returns non-zero if the outputs are dimmed (CONBUS_FLAG_DIMMING). */
+int conbus_get_dimming(void);
+
+/* Set the brightness of an output, from 0 (off) to CONBUS_OUTPUT_LEVELS - 1
+ * (fully on). Safe from any context. The level is shown from the next
+ * scan. */
+void conbus_set_output_level(unsigned output, unsigned level);
+
+/* Debounced state of an input. */
+int conbus_get_input(unsigned input);
+
+/* Every time the debounced state of an input changes its change flag is set.
+ * Returns the flag and clears it, which can be done from any context without
+ * a critical section. Read the state with conbus_get_input afterwards: a
+ * change which races with the clear is then either already visible or flags
+ * the input again. */
+int conbus_test_and_clear_change(unsigned input);
 
+/* Copy the debounced state of every input, packed eight to a byte with input
+ * 0 in bit 0 of the first byte, to dst. Returns the number of bytes copied
+ * (at most max_bytes). The image is the one left by the last complete
+ * debounce pass, so it is consistent from any context even when the caller
+ * preempted the bottom half half way through a pass. */
+unsigned conbus_copy_inputs(unsigned char *dst, unsigned max_bytes);
 
 #endif /* CONBUS_H_ */
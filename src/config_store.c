@@ -0,0 +1,516 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "config_store.h"
+#include "lpc176x_iap.h"
+#include "conbus.h"
+#include "sched.h"
+#include "crc.h"
+#include "critical.h"
+
+/* Sectors 26 - 29. The linker script must keep code out of this area. */
+#define STORE_BASE              (0x00060000ul)
+#define STORE_NB_SECTORS        (4)
+#define SECTOR_SIZE             (0x8000ul)
+#define PAGE_SIZE               (256)
+
+#define SECTOR_MAGIC            (0x53474643ul)
+#define RECORD_MAGIC            (0xc5a5)
+#define BLANK_WORD              (0xfffffffful)
+
+#define SECTOR_BASE(s)          (STORE_BASE + (s) * SECTOR_SIZE)
+#define SECTOR_END(s)           (SECTOR_BASE(s) + SECTOR_SIZE)
+
+/* First page of a sector. Programmed last when a sector is filled by a
+ * compaction so a sector is only used once everything has been copied. */
+struct config_sector_s
+{
+    unsigned long   magic;
+    unsigned long   sequence;   /* Highest valid sequence is the active sector */
+};
+
+/* Start of a record, always at the start of a page. The payload follows
+ * directly. */
+struct config_record_s
+{
+    unsigned short  magic;
+    unsigned char   tag;
+    unsigned char   reserved;
+    unsigned short  length;     /* Payload bytes */
+    unsigned short  crc;        /* Over tag, length and payload */
+};
+
+#define RECORD_PAGES(length)    ((sizeof(struct config_record_s) + (length) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+#define JOB_IDLE                (0)
+#define JOB_START               (1) /* Decide where the record goes */
+#define JOB_COPY                (2) /* Copy the latest records to the new sector */
+#define JOB_RECORD              (3) /* Program the new record */
+#define JOB_SECTOR              (4) /* Mark the new sector as valid */
+
+static struct
+{
+    volatile unsigned       state;
+    unsigned                tag;
+    const unsigned char    *data;
+    unsigned                length;
+    unsigned                crc;
+    unsigned                target;     /* Sector being programmed */
+    unsigned long           dst;        /* Next page to program */
+    unsigned                copy_tag;   /* JOB_COPY: tag being copied */
+    unsigned long           src;        /* JOB_COPY: next page to copy */
+    unsigned long           src_end;
+    unsigned                page;       /* JOB_RECORD: page of the record */
+    unsigned long           last_frame;
+} g_job;
+
+static unsigned                     g_active;
+static unsigned long                g_write_ptr;
+static unsigned long                g_page[PAGE_SIZE / 4];
+static struct config_store_stats_s  g_stats;
+static void                       (*g_on_moved)(void);
+
+static void config_store_task(void);
+
+static
+int
+config_store_blank
+    (unsigned long address
+    ,unsigned long end
+    )
+{
+    for (; address < end; address += 4)
+    {
+        if (*(const unsigned long *)address != BLANK_WORD)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static
+unsigned
+config_store_record_crc
+    (const struct config_record_s  *record
+    ,const unsigned char           *payload
+    )
+{
+    unsigned crc = crc16_update(CRC16_INIT, record->tag);
+    crc = crc16_update(crc, record->length & 0xff);
+    crc = crc16_update(crc, record->length >> 8);
+    return crc16(crc, payload, record->length);
+}
+
+/* Walk the log of a sector. Stores the latest valid record with the given tag
+ * in *found (zero if there is none) and returns the address the next record
+ * can be written at. A record which did not get programmed completely makes
+ * the rest of the sector unusable. */
+static
+unsigned long
+config_store_walk
+    (unsigned                       sector
+    ,unsigned                       tag
+    ,const struct config_record_s **found
+    )
+{
+    const unsigned long end     = SECTOR_END(sector);
+    unsigned long       address = SECTOR_BASE(sector) + PAGE_SIZE;
+    *found = 0;
+    while (address < end)
+    {
+        const struct config_record_s *record = (const struct config_record_s *)address;
+        unsigned long next;
+        if (record->magic == 0xffff)
+        {
+            return (config_store_blank(address, end)) ? address : end;
+        }
+        next = address + RECORD_PAGES(record->length) * PAGE_SIZE;
+        if  (   (record->magic != RECORD_MAGIC)
+            ||  (next > end)
+            ||  (record->crc != config_store_record_crc(record, (const unsigned char *)(record + 1)))
+            )
+        {
+            return end;
+        }
+        if (record->tag == tag)
+        {
+            *found = record;
+        }
+        address = next;
+    }
+    return end;
+}
+
+static
+int
+config_store_program_page
+    (unsigned long address
+    )
+{
+    if (iap_program(address, g_page, PAGE_SIZE) != IAP_CMD_SUCCESS)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+static
+void
+config_store_fill_page
+    (const unsigned char   *src
+    ,unsigned               offset
+    ,unsigned               length
+    )
+{
+    unsigned char *page = (unsigned char *)g_page;
+    unsigned i;
+    for (i = 0; i < PAGE_SIZE; i++)
+    {
+        page[i] = (i >= offset && i - offset < length) ? src[i - offset] : 0xff;
+    }
+}
+
+static
+int
+config_store_write_sector_header
+    (unsigned sector
+    ,unsigned long sequence
+    )
+{
+    struct config_sector_s header;
+    header.magic    = SECTOR_MAGIC;
+    header.sequence = sequence;
+    config_store_fill_page((const unsigned char *)&header, 0, sizeof(header));
+    return config_store_program_page(SECTOR_BASE(sector));
+}
+
+void
+config_store_init
+    (void (*on_moved)(void)
+    )
+{
+    unsigned long sequence = 0;
+    unsigned s;
+    const struct config_record_s *unused;
+
+    g_active = STORE_NB_SECTORS;
+    for (s = 0; s < STORE_NB_SECTORS; s++)
+    {
+        const struct config_sector_s *header = (const struct config_sector_s *)SECTOR_BASE(s);
+        if  (   (header->magic == SECTOR_MAGIC)
+            &&  ((g_active == STORE_NB_SECTORS) || (header->sequence > sequence))
+            )
+        {
+            g_active = s;
+            sequence = header->sequence;
+        }
+    }
+
+    /* Give every other sector a fresh start so compactions never have to
+     * erase while the console is running. */
+    for (s = 0; s < STORE_NB_SECTORS; s++)
+    {
+        if ((s != g_active) && (!config_store_blank(SECTOR_BASE(s), SECTOR_END(s))))
+        {
+            const unsigned first = iap_get_sector(SECTOR_BASE(s));
+            (void)iap_erase(first, first);
+        }
+    }
+
+    if (g_active == STORE_NB_SECTORS)
+    {
+        g_active = 0;
+        if (!config_store_write_sector_header(0, 1))
+        {
+            g_stats.failures++;
+        }
+    }
+    g_write_ptr = config_store_walk(g_active, 0, &unused);
+    g_on_moved  = on_moved;
+    sched_register(SCHED_TASK_CONFIG_STORE, config_store_task);
+}
+
+const void *
+config_store_find
+    (unsigned   tag
+    ,unsigned  *length
+    )
+{
+    const struct config_record_s *record;
+    (void)config_store_walk(g_active, tag, &record);
+    if (!record)
+    {
+        return 0;
+    }
+    *length = record->length;
+    return record + 1;
+}
+
+int
+config_store_write
+    (unsigned       tag
+    ,const void    *data
+    ,unsigned       length
+    )
+{
+    const unsigned long state = critical_enter();
+    int ret = -1;
+    if  (   (g_job.state == JOB_IDLE)
+        &&  (tag) && (tag < CONFIG_NB_TAGS)
+        &&  (RECORD_PAGES(length) < SECTOR_SIZE / PAGE_SIZE)
+        )
+    {
+        g_job.tag       = tag;
+        g_job.data      = data;
+        g_job.length    = length;
+        g_job.state     = JOB_START;
+        ret             = 0;
+        sched_post(SCHED_TASK_CONFIG_STORE);
+    }
+    critical_exit(state);
+    return ret;
+}
+
+int
+config_store_busy
+    (void
+    )
+{
+    return g_job.state != JOB_IDLE;
+}
+
+void
+config_store_get_stats
+    (struct config_store_stats_s *stats
+    )
+{
+    const unsigned long state = critical_enter();
+    *stats = g_stats;
+    critical_exit(state);
+}
+
+/* Decide whether the record can be appended to the active sector or the
+ * latest records need to be moved to a new one first. */
+static
+int
+config_store_start
+    (void
+    )
+{
+    const unsigned nb_pages = RECORD_PAGES(g_job.length);
+    unsigned used = 1 + nb_pages;
+    unsigned tag;
+    unsigned i;
+
+    g_job.page = 0;
+    if (g_write_ptr + nb_pages * PAGE_SIZE <= SECTOR_END(g_active))
+    {
+        g_job.target    = g_active;
+        g_job.dst       = g_write_ptr;
+        g_job.state     = JOB_RECORD;
+        return 1;
+    }
+
+    for (tag = 1; tag < CONFIG_NB_TAGS; tag++)
+    {
+        const struct config_record_s *record;
+        (void)config_store_walk(g_active, tag, &record);
+        if ((record) && (tag != g_job.tag))
+        {
+            used += RECORD_PAGES(record->length);
+        }
+    }
+    if (used > SECTOR_SIZE / PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    /* Next blank sector after the active one. Retired sectors are only
+     * erased by config_store_init as an erase stops the whole part for
+     * about 100ms, so once they have all been used the write fails until
+     * the next reset. */
+    for (i = 1; i < STORE_NB_SECTORS; i++)
+    {
+        const unsigned s = (g_active + i) % STORE_NB_SECTORS;
+        if (config_store_blank(SECTOR_BASE(s), SECTOR_END(s)))
+        {
+            break;
+        }
+    }
+    if (i == STORE_NB_SECTORS)
+    {
+        return 0;
+    }
+    g_job.target    = (g_active + i) % STORE_NB_SECTORS;
+    g_job.state     = JOB_COPY;
+    g_job.dst       = SECTOR_BASE(g_job.target) + PAGE_SIZE;
+    g_job.copy_tag  = 0;
+    g_job.src       = 0;
+    g_job.src_end   = 0;
+    return 1;
+}
+
+/* Program the next page of the job. Returns zero on failure. */
+static
+int
+config_store_step
+    (void
+    )
+{
+    switch (g_job.state)
+    {
+    case JOB_COPY:
+        while (g_job.src == g_job.src_end)
+        {
+            const struct config_record_s *record;
+            if (++g_job.copy_tag >= CONFIG_NB_TAGS)
+            {
+                g_job.state = JOB_RECORD;
+                return config_store_step();
+            }
+            if (g_job.copy_tag != g_job.tag)
+            {
+                (void)config_store_walk(g_active, g_job.copy_tag, &record);
+                if (record)
+                {
+                    g_job.src       = (unsigned long)record;
+                    g_job.src_end   = g_job.src + RECORD_PAGES(record->length) * PAGE_SIZE;
+                }
+            }
+        }
+        config_store_fill_page((const unsigned char *)g_job.src, 0, PAGE_SIZE);
+        if (!config_store_program_page(g_job.dst))
+        {
+            return 0;
+        }
+        g_job.src += PAGE_SIZE;
+        g_job.dst += PAGE_SIZE;
+        return 1;
+
+    case JOB_RECORD:
+        if (g_job.page == 0)
+        {
+            struct config_record_s header;
+            header.magic    = RECORD_MAGIC;
+            header.tag      = g_job.tag;
+            header.reserved = 0xff;
+            header.length   = g_job.length;
+            header.crc      = config_store_record_crc(&header, g_job.data);
+            config_store_fill_page((const unsigned char *)&header, 0, sizeof(header));
+            {
+                /* Payload after the header in the same page */
+                unsigned char *page = (unsigned char *)g_page;
+                unsigned i;
+                for (i = 0; (i < g_job.length) && (sizeof(header) + i < PAGE_SIZE); i++)
+                {
+                    page[sizeof(header) + i] = g_job.data[i];
+                }
+            }
+        }
+        else
+        {
+            const unsigned offset = g_job.page * PAGE_SIZE - sizeof(struct config_record_s);
+            const unsigned left   = g_job.length - offset;
+            config_store_fill_page(g_job.data + offset, 0, (left < PAGE_SIZE) ? left : PAGE_SIZE);
+        }
+        if (!config_store_program_page(g_job.dst))
+        {
+            return 0;
+        }
+        g_job.dst += PAGE_SIZE;
+        if (++g_job.page == RECORD_PAGES(g_job.length))
+        {
+            if (g_job.target == g_active)
+            {
+                g_write_ptr = g_job.dst;
+                g_stats.writes++;
+                g_job.state = JOB_IDLE;
+            }
+            else
+            {
+                g_job.state = JOB_SECTOR;
+            }
+        }
+        return 1;
+
+    case JOB_SECTOR:
+        {
+            const struct config_sector_s *active = (const struct config_sector_s *)SECTOR_BASE(g_active);
+            if (!config_store_write_sector_header(g_job.target, active->sequence + 1))
+            {
+                return 0;
+            }
+        }
+        g_active    = g_job.target;
+        g_write_ptr = g_job.dst;
+        g_stats.writes++;
+        g_stats.compactions++;
+        g_job.state = JOB_IDLE;
+        if (g_on_moved)
+        {
+            g_on_moved();
+        }
+        return 1;
+
+    default:
+        return 1;
+    }
+}
+
+/* Programs at most one page per conbus scan. The task keeps itself posted
+ * while a write is in progress and waits for the frame counter to move so
+ * the programming (during which interrupts are off) starts straight after a
+ * scan, leaving the rest of the scan period for it. */
+static
+void
+config_store_task
+    (void
+    )
+{
+    struct conbus_stats_s conbus;
+    if (g_job.state == JOB_START)
+    {
+        if (!config_store_start())
+        {
+            g_stats.failures++;
+            g_job.state = JOB_IDLE;
+        }
+    }
+    else
+    {
+        conbus_get_stats(&conbus);
+        if (conbus.frames != g_job.last_frame)
+        {
+            g_job.last_frame = conbus.frames;
+            if (!config_store_step())
+            {
+                /* Whatever was partially programmed can not be appended to */
+                if (g_job.target == g_active)
+                {
+                    g_write_ptr = SECTOR_END(g_active);
+                }
+                g_stats.failures++;
+                g_job.state = JOB_IDLE;
+            }
+        }
+    }
+    if (g_job.state != JOB_IDLE)
+    {
+        sched_post(SCHED_TASK_CONFIG_STORE);
+    }
+}
@@ -0,0 +1,72 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+/* Settings kept in the top 128kB of flash. Every setting is a record
+ * identified by a tag and only the most recent record with a given tag is
+ * used. Records are appended to a log in one 32kB sector at a time. When the
+ * sector is full the latest record of every tag is copied to the next blank
+ * sector, so erases rotate around all of them. Erasing stops the whole part
+ * for about 100ms, so the sectors given up are only erased at the next reset
+ * by config_store_init: after every sector has been used once in a power
+ * cycle further sector changes fail. */
+enum config_tag_e
+{   CONFIG_TAG_MIDI_MAP = 1     /* midi_map table */
+,   CONFIG_TAG_DEBOUNCE         /* conbus debounce ticks (one byte) */
+,   CONFIG_TAG_COMBINATIONS     /* stop combination memories */
+,   CONFIG_TAG_ROUTES           /* midi_router routes (one byte per source) */
+,   CONFIG_TAG_RESYNC           /* midi_resync enabled (one byte) */
+,   CONFIG_NB_TAGS
+};
+
+struct config_store_stats_s
+{
+    unsigned long   writes;         /* Records written */
+    unsigned long   compactions;    /* Sector changes */
+    unsigned long   failures;       /* Writes which failed */
+};
+
+/* Find the active sector and erase the unused ones. Erasing stalls for a few
+ * hundred milliseconds so this must be called before anything time critical
+ * is running (but after clock_setup). on_moved (which may be null) is called
+ * from the store task after a sector change: the records are then at new
+ * addresses and everything using a pointer from config_store_find should
+ * look it up again. */
+void                    config_store_init(void (*on_moved)(void));
+
+/* Returns the payload of the latest record with the given tag and stores its
+ * length in *length, or returns zero if there is none. The pointer is into
+ * flash. After a sector change it points into the retired sector, which
+ * keeps its contents until the next reset. */
+const void             *config_store_find(unsigned tag, unsigned *length);
+
+/* Start writing a record. Flash is programmed 256 bytes at a time from a
+ * scheduler task once per conbus scan so the bus is never stalled for more
+ * than a millisecond. data must not change until config_store_busy()
+ * returns zero. Returns zero if the write was started. The write fails if
+ * it needs a sector change and no blank sector is left. May be called from
+ * an interrupt. */
+int                     config_store_write(unsigned tag, const void *data, unsigned length);
+
+/* Returns non-zero while a write is in progress. */
+int                     config_store_busy(void);
+
+void                    config_store_get_stats(struct config_store_stats_s *stats);
+
+#endif /* CONFIG_STORE_H_ */
@@ -0,0 +1,45 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "crc.h"
+
+unsigned
+crc16_update
+    (unsigned       crc
+    ,unsigned char  byte
+    )
+{
+    /* Table-less byte-wise form. Fast enough to keep up with a full speed
+     * bulk endpoint. */
+    unsigned x = ((crc >> 8) ^ byte) & 0xff;
+    x ^= x >> 4;
+    return ((crc << 8) ^ (x << 12) ^ (x << 5) ^ x) & 0xffff;
+}
+
+unsigned
+crc16
+    (unsigned               crc
+    ,const unsigned char   *data
+    ,unsigned               length
+    )
+{
+    while (length--)
+    {
+        crc = crc16_update(crc, *data++);
+    }
+    return crc;
+}
@@ -15,9 +15,16 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
-#ifndef PLL1_H_
-#define PLL1_H_
+#ifndef CRC_H_
+#define CRC_H_
 
-void pll1_setup(unsigned long fosc);
+#define CRC16_INIT (0xffffu)
 
-#endif /* LPC176X_PLL1_H_ */
+/* CRC-16/CCITT (polynomial 0x1021) updated with one byte. Start with
+ * CRC16_INIT. */
+unsigned crc16_update(unsigned crc, unsigned char byte);
+
+/* CRC-16/CCITT over a buffer. */
+unsigned crc16(unsigned crc, const unsigned char *data, unsigned length);
+
+#endif /* CRC_H_ */
@@ -15,32 +15,39 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
+#ifndef CRITICAL_H_
+#define CRITICAL_H_
+
 #include <LPC17xx.h>
-#include "lpc176x_pll1.h"
-#include "debughlprs.h"
 
-#define PLL1_PLOCK      (1ul << 10)
-#define PLL1_PLLC1_STAT (1ul << 9)
-#define PLL1_PLLE1_STAT (1ul << 8)
+/* Short critical sections which may be nested and used from any interrupt
+ * priority. Usage:
+ *
+ *   unsigned long state = critical_enter();
+ *   ...
+ *   critical_exit(state);
+ */
 
-/* FIXME: maybe this should be more flexible and take the desired output
- * frequency. Currently, this is always 48MHz for the USB controller. */
-void pll1_setup(unsigned long fosc)
+static
+inline
+unsigned long
+critical_enter
+    (void
+    )
 {
-	unsigned long m = 48000000 / fosc;
-	ASSERT((m > 1) && (m * fosc == 48000000));
-
-	LPC_SC->PLL1CFG   = 0x20 | (m - 1);
-	LPC_SC->PLL1FEED  = 0xaa;
-	LPC_SC->PLL1FEED  = 0x55;
-
-	LPC_SC->PLL1CON   = 0x01;
-	LPC_SC->PLL1FEED  = 0xaa;
-	LPC_SC->PLL1FEED  = 0x55;
-	while (!(LPC_SC->PLL1STAT & PLL1_PLOCK));
+    unsigned long state = __get_PRIMASK();
+    __disable_irq();
+    return state;
+}
 
-	LPC_SC->PLL1CON   = 0x03;
-	LPC_SC->PLL1FEED  = 0xaa;
-	LPC_SC->PLL1FEED  = 0x55;
-	while (!(LPC_SC->PLL1STAT & (PLL1_PLLC1_STAT | PLL1_PLLE1_STAT)));
+static
+inline
+void
+critical_exit
+    (unsigned long state
+    )
+{
+    __set_PRIMASK(state);
 }
+
+#endif /* CRITICAL_H_ */
@@ -0,0 +1,53 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef CYCLES_H_
+#define CYCLES_H_
+
+/* Cortex-M3 DWT cycle counter. The CMSIS headers in use do not describe the
+ * DWT. */
+#define CYCLES_DEMCR            (*(volatile unsigned long *)0xe000edfcul)
+#define CYCLES_DEMCR_TRCENA     (1ul << 24)
+#define CYCLES_DWT_CTRL         (*(volatile unsigned long *)0xe0001000ul)
+#define CYCLES_DWT_CYCCNTENA    (1ul << 0)
+#define CYCLES_DWT_CYCCNT       (*(volatile unsigned long *)0xe0001004ul)
+
+/* Reset the counter to zero and start it. */
+static
+inline
+void
+cycles_init
+    (void
+    )
+{
+    CYCLES_DEMCR       |= CYCLES_DEMCR_TRCENA;
+    CYCLES_DWT_CYCCNT   = 0;
+    CYCLES_DWT_CTRL    |= CYCLES_DWT_CYCCNTENA;
+}
+
+/* CPU clock cycles since cycles_init (wraps every 35s at 120MHz). */
+static
+inline
+unsigned long
+cycles_now
+    (void
+    )
+{
+    return CYCLES_DWT_CYCCNT;
+}
+
+#endif /* CYCLES_H_ */
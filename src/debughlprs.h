@@ -18,7 +18,49 @@
 #ifndef DEBUG_H_
 #define DEBUG_H_
 
-#if defined(NDEBUG) || 1
+#include "trace.h"
+
+#if defined(DEBUG_ITM)
+
+/* Development builds: a module which defines DEBUG_ITM before including this
+ * header (or anything which includes it) sends DEBUG_PRINT text and dumped
+ * buffers to the ITM. Records are dropped rather than waited for. */
+#include "itm.h"
+
+#define DEBUG_PRINT(x) itm_print(x)
+#define ASSERT(x) do { if (!(x)) { TRACE(TRACE_EVENT_ASSERT, __LINE__, __FILE__); } } while (0)
+
+static
+inline
+void
+dump_buffer(const unsigned char *data, unsigned length)
+{
+    (void)itm_write_record(ITM_RECORD_DUMP, data, length);
+}
+
+#elif !defined(TRACE_DISABLE)
+
+/* Production builds: text output is not available but failed assertions and
+ * dumped buffers (the first 8 bytes - enough for a setup packet) are recorded
+ * in the trace. */
+#define DEBUG_PRINT(x) (void)
+#define ASSERT(x) do { if (!(x)) { TRACE(TRACE_EVENT_ASSERT, __LINE__, __FILE__); } } while (0)
+
+static
+inline
+void
+dump_buffer(const unsigned char *data, unsigned length)
+{
+    unsigned long words[2] = {0, 0};
+    unsigned i;
+    for (i = 0; (i < length) && (i < 8); i++)
+    {
+        words[i >> 2] |= (unsigned long)data[i] << (8 * (i & 3));
+    }
+    TRACE(TRACE_EVENT_USB_UNHANDLED, words[0], words[1]);
+}
+
+#elif defined(NDEBUG) || 1
 
 #define DEBUG_PRINT(x) (void)
 #define ASSERT(x)
@@ -0,0 +1,146 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "expression.h"
+#include "lpc176x_adc.h"
+#include "midi_router.h"
+#include "usb_midi.h"
+#include "sched.h"
+#include "debughlprs.h"
+#include <cr_section_macros.h>
+
+#define MAX_PEDALS                  (8)
+
+/* 32 samples per half buffer; with the ADC running at its slowest rate the
+ * pedals are processed roughly 50 times per second (at 100 - 120MHz). */
+#define NB_SAMPLES                  (64)
+
+/* Written by GPDMA, which cannot reach the local SRAM */
+__BSS(RAM2) static unsigned long        g_samples[NB_SAMPLES];
+static const struct expression_pedal_s *g_pedals;
+static unsigned                         g_nb_pedals;
+static const unsigned long * volatile   g_block;
+static struct
+{
+    unsigned    reference;  /* 14-bit value the hysteresis band is centred on */
+    unsigned    sent;       /* last value queued (7 or 14 bits), ~0 = none */
+} g_state[MAX_PEDALS];
+
+static
+void
+expression_send
+    (const struct expression_pedal_s   *pedal
+    ,unsigned                           value
+    )
+{
+    const unsigned status = 0xb0 | (pedal->midi_channel & 0xf);
+    if (pedal->flags & EXPRESSION_FLAG_14BIT)
+    {
+        (void)midi_router_post(MIDI_ROUTER_SRC_CONSOLE, USB_MIDI_PACKET(pedal->cable, status, pedal->controller, value >> 7));
+        (void)midi_router_post(MIDI_ROUTER_SRC_CONSOLE, USB_MIDI_PACKET(pedal->cable, status, pedal->controller + 32, value & 0x7f));
+    }
+    else
+    {
+        (void)midi_router_post(MIDI_ROUTER_SRC_CONSOLE, USB_MIDI_PACKET(pedal->cable, status, pedal->controller, value));
+    }
+}
+
+static
+void
+expression_task
+    (void
+    )
+{
+    const unsigned long    *samples     = g_block;
+    const unsigned          nb_samples  = NB_SAMPLES / 2;
+    unsigned long           sum[8]      = {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned                count[8]    = {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned                i;
+
+    /* Decimate: average every channel over the block */
+    for (i = 0; i < nb_samples; i++)
+    {
+        const unsigned long s = samples[i];
+        if (ADC_SAMPLE_DONE(s))
+        {
+            sum[ADC_SAMPLE_CHANNEL(s)]   += ADC_SAMPLE_VALUE(s);
+            count[ADC_SAMPLE_CHANNEL(s)] += 1;
+        }
+    }
+
+    for (i = 0; i < g_nb_pedals; i++)
+    {
+        const struct expression_pedal_s *pedal = &(g_pedals[i]);
+        const unsigned ch = pedal->adc_channel & 7;
+        if (count[ch])
+        {
+            /* 12-bit average scaled to 14 bits */
+            const unsigned value = (unsigned)((sum[ch] << 2) / count[ch]);
+            const unsigned delta =
+                (value > g_state[i].reference)
+                ? (value - g_state[i].reference)
+                : (g_state[i].reference - value);
+            if ((delta > pedal->hysteresis) || (g_state[i].sent == ~0u))
+            {
+                const unsigned out = (pedal->flags & EXPRESSION_FLAG_14BIT) ? value : (value >> 7);
+                g_state[i].reference = value;
+                if (out != g_state[i].sent)
+                {
+                    g_state[i].sent = out;
+                    expression_send(pedal, out);
+                }
+            }
+        }
+    }
+}
+
+/* DMA interrupt - leave the work for the main loop */
+static
+void
+expression_block
+    (const unsigned long   *samples
+    ,unsigned               nb_samples
+    )
+{
+    (void)nb_samples;
+    g_block = samples;
+    sched_post(SCHED_TASK_EXPRESSION);
+}
+
+void
+expression_init
+    (const struct expression_pedal_s   *pedals
+    ,unsigned                           nb_pedals
+    )
+{
+    unsigned channel_mask = 0;
+    unsigned i;
+    ASSERT(nb_pedals <= MAX_PEDALS);
+    g_pedals    = pedals;
+    g_nb_pedals = nb_pedals;
+    for (i = 0; i < nb_pedals; i++)
+    {
+        g_state[i].reference    = 0;
+        g_state[i].sent         = ~0u;
+        channel_mask           |= 1u << (pedals[i].adc_channel & 7);
+    }
+    if (channel_mask)
+    {
+        sched_register(SCHED_TASK_EXPRESSION, expression_task);
+        adc_setup(channel_mask, g_samples, NB_SAMPLES, expression_block);
+    }
+}
@@ -0,0 +1,44 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef EXPRESSION_H_
+#define EXPRESSION_H_
+
+/* Send a 14-bit controller (MSB on controller, LSB on controller + 32)
+ * instead of a 7-bit one. */
+#define EXPRESSION_FLAG_14BIT       (0x0001)
+
+/* Swell shoes, crescendo pedals and other analog inputs. */
+struct expression_pedal_s
+{
+    unsigned        adc_channel;    /* AD0.n input */
+    unsigned        cable;          /* USB-MIDI cable */
+    unsigned        midi_channel;   /* 0-15 */
+    unsigned        controller;     /* 0-119 (0-31 for 14-bit controllers) */
+    unsigned        hysteresis;     /* Dead band around the last sent value in
+                                     * 14-bit units (0 - 16383). Should be at
+                                     * least 64 for 7-bit controllers. */
+    unsigned        flags;
+};
+
+/* Start sampling the pedals. The pedal table must remain valid. Every pedal
+ * is oversampled and averaged over one DMA block and a controller change is
+ * only queued when the averaged value moves outside the hysteresis band and
+ * changes the value which would be sent. */
+void expression_init(const struct expression_pedal_s *pedals, unsigned nb_pedals);
+
+#endif /* EXPRESSION_H_ */
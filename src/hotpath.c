@@ -0,0 +1,65 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "hotpath.h"
+
+#if defined(HOTPATH_PROFILE)
+
+#include "critical.h"
+#include "lpc176x_clock.h"
+
+struct hotpath_report_s
+{
+    unsigned long           cclk;
+    struct hotpath_stats_s  points[HOTPATH_NB_POINTS];
+};
+
+static struct hotpath_report_s g_stats;
+static struct hotpath_report_s g_snapshot;
+
+HOTPATH_RAMFUNC
+void
+hotpath_record
+    (unsigned       point
+    ,unsigned long  cycles
+    )
+{
+    const unsigned long state = critical_enter();
+    struct hotpath_stats_s *s = &(g_stats.points[point]);
+    s->calls++;
+    s->total_cycles += cycles;
+    if (cycles > s->max_cycles)
+    {
+        s->max_cycles = cycles;
+    }
+    critical_exit(state);
+}
+
+const void *
+hotpath_get_stats
+    (unsigned *length
+    )
+{
+    const unsigned long state = critical_enter();
+    g_snapshot = g_stats;
+    critical_exit(state);
+    g_snapshot.cclk = clock_get_cclk();
+    *length = sizeof(g_snapshot);
+    return &g_snapshot;
+}
+
+#endif
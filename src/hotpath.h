@@ -0,0 +1,87 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef HOTPATH_H_
+#define HOTPATH_H_
+
+#include "cycles.h"
+
+/* Build options for the functions which run on every scan or USB transfer:
+ *
+ * HOTPATH_IN_RAM   place them in the AHB SRAM bank 1 (RAM3, 0x20080000)
+ *                  where they run without flash wait states. Bank 0
+ *                  holds the conbus memory and the DMA buffers, which
+ *                  are then fetched from another AHB slave than the
+ *                  code.
+ * HOTPATH_PROFILE  count the cycles spent in them (DWT cycle counter, which
+ *                  includes any higher priority interrupt which preempted
+ *                  them) for the USB_MIDI_REQ_PROFILE vendor request and
+ *                  tools/hotpath_report.c. */
+
+#if defined(HOTPATH_IN_RAM)
+#include <cr_section_macros.h>
+#define HOTPATH_RAMFUNC         __RAMFUNC(RAM3)
+#else
+#define HOTPATH_RAMFUNC
+#endif
+
+/* Measured functions and the symbols they are reported against. */
+#define HOTPATH_POINTS(POINT)                       \
+    POINT(SSP1_IRQ,         SSP1_IRQHandler)        \
+    POINT(USB_IRQ,          USB_IRQHandler)         \
+    POINT(USB_WRITE,        usb_write)              \
+    POINT(USB_READ,         usb_read)               \
+    POINT(USB_READ_WORDS,   usb_read_words)         \
+    POINT(USB_WRITE_WORDS,  usb_write_words)        \
+    POINT(DEBOUNCE,         PendSV_Handler)
+
+#define HOTPATH_POINT_ENUM_(name, symbol) HOTPATH_##name,
+enum hotpath_point_e
+{
+    HOTPATH_POINTS(HOTPATH_POINT_ENUM_)
+    HOTPATH_NB_POINTS
+};
+
+/* What USB_MIDI_REQ_PROFILE returns after a 32-bit CPU clock in Hz, one per
+ * point. All fields are 32-bit little endian. */
+struct hotpath_stats_s
+{
+    unsigned long   calls;
+    unsigned long   total_cycles;
+    unsigned long   max_cycles;
+};
+
+#if defined(HOTPATH_PROFILE)
+
+/* HOTPATH_BEGIN goes after the declarations of the measured function and
+ * HOTPATH_END before every return. */
+#define HOTPATH_BEGIN(point)    const unsigned long hotpath_start_ = cycles_now()
+#define HOTPATH_END(point)      hotpath_record((point), cycles_now() - hotpath_start_)
+
+void            hotpath_record(unsigned point, unsigned long cycles);
+
+/* Returns the response to USB_MIDI_REQ_PROFILE and its length. */
+const void     *hotpath_get_stats(unsigned *length);
+
+#else
+
+#define HOTPATH_BEGIN(point)    ((void)0)
+#define HOTPATH_END(point)      ((void)0)
+
+#endif
+
+#endif /* HOTPATH_H_ */
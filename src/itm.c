@@ -0,0 +1,112 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "itm.h"
+#include "critical.h"
+
+/* The CMSIS headers in use do not describe the ITM consistently across
+ * versions so the registers are used directly. */
+#define ITM_STIM(port)          (*(volatile unsigned long *)(0xe0000000ul + 4 * (port)))
+#define ITM_TER                 (*(volatile unsigned long *)0xe0000e00ul)
+#define ITM_TCR                 (*(volatile unsigned long *)0xe0000e80ul)
+#define ITM_TCR_ITMENA          (1ul << 0)
+
+static unsigned long g_dropped;
+
+/* Returns non-zero if the word was written. Reading a stimulus port returns
+ * one while its FIFO can take another write. */
+static
+int
+itm_put
+    (unsigned       port
+    ,unsigned long  word
+    )
+{
+    if (!(ITM_STIM(port) & 1))
+    {
+        return 0;
+    }
+    ITM_STIM(port) = word;
+    return 1;
+}
+
+int
+itm_write_record
+    (unsigned       type
+    ,const void    *data
+    ,unsigned       length
+    )
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned long state;
+    unsigned i;
+    int ok;
+
+    /* Nobody is listening - not a drop */
+    if  (   (!(ITM_TCR & ITM_TCR_ITMENA))
+        ||  ((ITM_TER & ((1ul << ITM_PORT_HEADER) | (1ul << ITM_PORT_PAYLOAD))) != ((1ul << ITM_PORT_HEADER) | (1ul << ITM_PORT_PAYLOAD)))
+        )
+    {
+        return 1;
+    }
+
+    if (length > 0xffff)
+    {
+        length = 0xffff;
+    }
+
+    /* Records from different interrupts must not be interleaved */
+    state = critical_enter();
+    ok = itm_put(ITM_PORT_HEADER, ITM_RECORD_SYNC | ((unsigned long)(type & 0xff) << 8) | ((unsigned long)length << 16));
+    for (i = 0; (ok) && (i < length); i += 4)
+    {
+        unsigned long word = 0;
+        unsigned j;
+        for (j = 0; (j < 4) && (i + j < length); j++)
+        {
+            word |= (unsigned long)bytes[i + j] << (8 * j);
+        }
+        ok = itm_put(ITM_PORT_PAYLOAD, word);
+    }
+    if (!ok)
+    {
+        g_dropped++;
+    }
+    critical_exit(state);
+    return ok;
+}
+
+void
+itm_print
+    (const char *str
+    )
+{
+    unsigned length = 0;
+    while (str[length])
+    {
+        length++;
+    }
+    (void)itm_write_record(ITM_RECORD_TEXT, str, length);
+}
+
+unsigned long
+itm_get_dropped
+    (void
+    )
+{
+    return g_dropped;
+}
@@ -0,0 +1,52 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef ITM_H_
+#define ITM_H_
+
+/* Live logging through the ITM stimulus ports to the SWO pin for development
+ * builds. Nothing ever waits for the ITM: a record is only written while the
+ * stimulus FIFO has room and the rest of it is dropped (and counted)
+ * otherwise.
+ *
+ * A record is a header word on ITM_PORT_HEADER:
+ *
+ *   bits 0 - 7    ITM_RECORD_SYNC
+ *   bits 8 - 15   record type (ITM_RECORD_)
+ *   bits 16 - 31  payload length in bytes
+ *
+ * followed by the payload as 32-bit words (the last one zero padded) on
+ * ITM_PORT_PAYLOAD. Using a separate port for the header lets the decoder
+ * (tools/itm_decode.c) see where a record which lost words ends. */
+
+#define ITM_PORT_HEADER         (1)
+#define ITM_PORT_PAYLOAD        (2)
+
+#define ITM_RECORD_SYNC         (0xa5)
+#define ITM_RECORD_TEXT         (1) /* DEBUG_PRINT string without the nul */
+#define ITM_RECORD_DUMP         (2) /* dump_buffer bytes */
+
+/* Write a record. Returns zero if any of it was dropped. */
+int             itm_write_record(unsigned type, const void *data, unsigned length);
+
+/* Write a nul terminated string as an ITM_RECORD_TEXT record. */
+void            itm_print(const char *str);
+
+/* Returns the number of records which were cut short. */
+unsigned long   itm_get_dropped(void);
+
+#endif /* ITM_H_ */
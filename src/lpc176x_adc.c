@@ -0,0 +1,151 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lpc176x_adc.h"
+#include "lpc176x_gpdma.h"
+#include "lpc176x_clock.h"
+#include <LPC17xx.h>
+#include "debughlprs.h"
+#include <cr_section_macros.h>
+
+#define PCONP_PCADC             (1ul << 12)
+
+#define ADCR_CLKDIV(n)          (((n) & 0xff) << 8)
+#define ADCR_BURST              (1ul << 16)
+#define ADCR_PDN                (1ul << 21)
+
+#define SET_PIN_FIELD(reg, shift, value) \
+    ((reg) = ((reg) & ~(3ul << (shift))) | ((unsigned long)(value) << (shift)))
+
+/* Lowest priority DMA channel - nothing is lost if it is held off */
+#define ADC_DMA_CHANNEL         (7)
+
+/* Fetched by the GPDMA controller, which cannot reach the local SRAM */
+__BSS(RAM2) static struct gpdma_lli_s g_lli[2];
+static unsigned long           *g_buffer;
+static unsigned                 g_half_samples;
+static adc_block_handler_t      g_on_block;
+
+static
+void
+adc_dma_event
+    (unsigned   channel
+    ,int        error
+    )
+{
+    /* The half which is not currently being written is complete. */
+    const unsigned long dst = gpdma_get_dst(channel);
+    (void)error;
+    if (dst < (unsigned long)(g_buffer + g_half_samples))
+    {
+        g_on_block(g_buffer + g_half_samples, g_half_samples);
+    }
+    else
+    {
+        g_on_block(g_buffer, g_half_samples);
+    }
+}
+
+void
+adc_setup
+    (unsigned               channel_mask
+    ,unsigned long         *buffer
+    ,unsigned               nb_samples
+    ,adc_block_handler_t    on_block
+    )
+{
+    /* AD0.n pin function select bits for PINSEL0, 1 and 3. Channels 4 and 5
+     * share pins with VBUS (P1.30) and are not available when USB is used. */
+    static const struct
+    {
+        unsigned char   pinsel;
+        unsigned char   shift;
+        unsigned char   function;
+    } ADC_PINS[8] =
+        {   {1, 14, 1} /* P0.23 */
+        ,   {1, 16, 1} /* P0.24 */
+        ,   {1, 18, 1} /* P0.25 */
+        ,   {1, 20, 1} /* P0.26 */
+        ,   {3, 28, 3} /* P1.30 */
+        ,   {3, 30, 3} /* P1.31 */
+        ,   {0,  6, 2} /* P0.3 */
+        ,   {0,  4, 2} /* P0.2 */
+        };
+    unsigned i;
+    ASSERT((nb_samples >= 2) && (nb_samples <= 8190) && !(nb_samples & 1));
+    g_buffer        = buffer;
+    g_half_samples  = nb_samples / 2;
+    g_on_block      = on_block;
+
+    for (i = 0; i < 8; i++)
+    {
+        if (channel_mask & (1u << i))
+        {
+            /* Select the AD0 function and disable the pull up/down */
+            const unsigned shift = ADC_PINS[i].shift;
+            switch (ADC_PINS[i].pinsel)
+            {
+            case 0:
+                SET_PIN_FIELD(LPC_PINCON->PINSEL0, shift, ADC_PINS[i].function);
+                SET_PIN_FIELD(LPC_PINCON->PINMODE0, shift, 2);
+                break;
+            case 1:
+                SET_PIN_FIELD(LPC_PINCON->PINSEL1, shift, ADC_PINS[i].function);
+                SET_PIN_FIELD(LPC_PINCON->PINMODE1, shift, 2);
+                break;
+            default:
+                SET_PIN_FIELD(LPC_PINCON->PINSEL3, shift, ADC_PINS[i].function);
+                SET_PIN_FIELD(LPC_PINCON->PINMODE3, shift, 2);
+                break;
+            }
+        }
+    }
+
+    LPC_SC->PCONP      |= PCONP_PCADC;
+    /* The slowest conversion rate possible (ADC clock is PCLK / 256) is
+     * plenty - we only need a few hundred samples per second per pedal. */
+    (void)clock_set_pclk(CLOCK_PCLK_ADC, 4);
+    LPC_ADC->ADCR       = ADCR_PDN;
+    /* Every channel raises a DMA request when its conversion is done. The
+     * global done flag must not be used in burst mode. */
+    LPC_ADC->ADINTEN    = channel_mask & 0xff;
+
+    /* Two linked list items pointing at each other make the buffer circular
+     * with a terminal count interrupt at the end of each half. */
+    for (i = 0; i < 2; i++)
+    {
+        g_lli[i].src        = (unsigned long)&(LPC_ADC->ADGDR);
+        g_lli[i].dst        = (unsigned long)(buffer + i * g_half_samples);
+        g_lli[i].next       = (unsigned long)&(g_lli[i ^ 1]);
+        g_lli[i].control    =   GPDMA_CTRL_SIZE(g_half_samples)
+                            |   GPDMA_CTRL_SBSIZE_1
+                            |   GPDMA_CTRL_DBSIZE_1
+                            |   GPDMA_CTRL_SWIDTH_32
+                            |   GPDMA_CTRL_DWIDTH_32
+                            |   GPDMA_CTRL_DI
+                            |   GPDMA_CTRL_I;
+    }
+    gpdma_setup();
+    gpdma_start
+        (ADC_DMA_CHANNEL
+        ,&(g_lli[0])
+        ,GPDMA_CFG_SRC_PERIPH(GPDMA_PERIPH_ADC) | GPDMA_CFG_P2M | GPDMA_CFG_IE | GPDMA_CFG_ITC
+        ,adc_dma_event
+        );
+
+    LPC_ADC->ADCR       = (channel_mask & 0xff) | ADCR_CLKDIV(255) | ADCR_BURST | ADCR_PDN;
+}
@@ -0,0 +1,43 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LPC176X_ADC_H_
+#define LPC176X_ADC_H_
+
+/* Samples are stored as the contents of the ADGDR register */
+#define ADC_SAMPLE_DONE(s)          (((s) >> 31) & 1)
+#define ADC_SAMPLE_CHANNEL(s)       (((s) >> 24) & 0x7)
+#define ADC_SAMPLE_VALUE(s)         (((s) >> 4) & 0xfff)
+
+/* Called from the DMA interrupt each time one half of the sample buffer has
+ * been filled. The other half is being written while this runs. */
+typedef void (*adc_block_handler_t)(const unsigned long *samples, unsigned nb_samples);
+
+/* Continuously convert the channels (AD0.0 to AD0.7) given in channel_mask
+ * using burst mode at the lowest conversion rate the peripheral clock allows.
+ * The results are moved by GPDMA into buffer which is used as a circular
+ * buffer of nb_samples entries (must be even and at most 8190). The buffer
+ * must be in the AHB SRAM as GPDMA cannot reach the local SRAM. The CPU is
+ * only involved once for every half buffer. */
+void adc_setup
+    (unsigned               channel_mask
+    ,unsigned long         *buffer
+    ,unsigned               nb_samples
+    ,adc_block_handler_t    on_block
+    );
+
+#endif /* LPC176X_ADC_H_ */
@@ -0,0 +1,222 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <LPC17xx.h>
+#include "lpc176x_clock.h"
+#include "debughlprs.h"
+
+#define SCS_OSCRANGE            (1ul << 4)
+#define SCS_OSCEN               (1ul << 5)
+#define SCS_OSCSTAT             (1ul << 6)
+
+#define PLL0_PLOCK              (1ul << 26)
+#define PLL0_PLLC0_STAT         (1ul << 25)
+#define PLL0_PLLE0_STAT         (1ul << 24)
+
+#define PLL1_PLOCK              (1ul << 10)
+#define PLL1_PLLC1_STAT         (1ul << 9)
+#define PLL1_PLLE1_STAT         (1ul << 8)
+
+#define PLL0_FCCO_MIN           (275000000ul)
+#define PLL0_FCCO_MAX           (550000000ul)
+
+static unsigned long g_fosc;
+static unsigned long g_cclk = 4000000ul; /* Internal RC oscillator after reset */
+
+static
+void
+pll0_feed
+    (void
+    )
+{
+    LPC_SC->PLL0FEED = 0xaa;
+    LPC_SC->PLL0FEED = 0x55;
+}
+
+static
+void
+pll1_feed
+    (void
+    )
+{
+    LPC_SC->PLL1FEED = 0xaa;
+    LPC_SC->PLL1FEED = 0x55;
+}
+
+/* Find M, N and the CPU clock divider. FCCO = 2 * M * FIN / N must be within
+ * 275 - 550MHz. Returns zero if the frequency cannot be made exactly. */
+static
+int
+pll0_find_settings
+    (unsigned long  fosc
+    ,unsigned long  cclk
+    ,unsigned      *m
+    ,unsigned      *n
+    ,unsigned      *cclk_div
+    )
+{
+    unsigned div;
+    for (div = 1; div <= 256; div++)
+    {
+        const unsigned long fcco = cclk * div;
+        if ((fcco >= PLL0_FCCO_MIN) && (fcco <= PLL0_FCCO_MAX))
+        {
+            unsigned pre;
+            for (pre = 1; pre <= 32; pre++)
+            {
+                /* Each term of fcco * pre fits in 32 bits when divided
+                 * first. */
+                const unsigned long fin = fosc / pre;
+                const unsigned long mul = fcco / (2 * fin);
+                if  (   (fin * pre == fosc)
+                    &&  (mul * 2 * fin == fcco)
+                    &&  (mul >= 6)
+                    &&  (mul <= 512)
+                    )
+                {
+                    *m          = mul;
+                    *n          = pre;
+                    *cclk_div   = div;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void
+clock_setup
+    (unsigned long fosc
+    ,unsigned long cclk
+    )
+{
+    unsigned m, n, cclk_div;
+    int found = pll0_find_settings(fosc, cclk, &m, &n, &cclk_div);
+    ASSERT(found && (cclk <= 120000000ul));
+    (void)found;
+
+    /* Worst case flash access time while the clock changes */
+    LPC_SC->FLASHCFG = (LPC_SC->FLASHCFG & 0x0ffful) | (4ul << 12);
+
+    /* Disconnect and disable PLL0 */
+    if (LPC_SC->PLL0STAT & PLL0_PLLC0_STAT)
+    {
+        LPC_SC->PLL0CON = 0x01;
+        pll0_feed();
+    }
+    LPC_SC->PLL0CON = 0x00;
+    pll0_feed();
+
+    /* Start the main oscillator */
+    LPC_SC->SCS = (fosc > 20000000ul) ? (SCS_OSCEN | SCS_OSCRANGE) : SCS_OSCEN;
+    while (!(LPC_SC->SCS & SCS_OSCSTAT));
+    LPC_SC->CLKSRCSEL = 1;
+    g_fosc = fosc;
+
+    LPC_SC->PLL0CFG = (m - 1) | ((unsigned long)(n - 1) << 16);
+    pll0_feed();
+    LPC_SC->PLL0CON = 0x01;
+    pll0_feed();
+    LPC_SC->CCLKCFG = cclk_div - 1;
+    while (!(LPC_SC->PLL0STAT & PLL0_PLOCK));
+
+    LPC_SC->PLL0CON = 0x03;
+    pll0_feed();
+    while ((LPC_SC->PLL0STAT & (PLL0_PLLC0_STAT | PLL0_PLLE0_STAT)) != (PLL0_PLLC0_STAT | PLL0_PLLE0_STAT));
+
+    /* One flash wait state for every 20MHz (up to 5 clocks) */
+    LPC_SC->FLASHCFG = (LPC_SC->FLASHCFG & 0x0ffful) | ((unsigned long)((cclk <= 80000000ul) ? ((cclk - 1) / 20000000ul) : 4) << 12);
+
+    g_cclk = cclk;
+}
+
+unsigned long
+clock_get_cclk
+    (void
+    )
+{
+    return g_cclk;
+}
+
+unsigned long
+clock_set_pclk
+    (unsigned peripheral
+    ,unsigned divider
+    )
+{
+    /* PCLKSEL field values for dividers of 1, 2, 4 and 8 */
+    static const unsigned char PCLKSEL_VALUES[4] = {1, 2, 0, 3};
+    const unsigned shift = 2 * (peripheral & 15);
+    unsigned value;
+    ASSERT((divider == 1) || (divider == 2) || (divider == 4) || (divider == 8));
+    value = PCLKSEL_VALUES[(divider >= 8) ? 3 : (divider >> 1)];
+    if (peripheral < 16)
+    {
+        LPC_SC->PCLKSEL0 = (LPC_SC->PCLKSEL0 & ~(3ul << shift)) | ((unsigned long)value << shift);
+    }
+    else
+    {
+        LPC_SC->PCLKSEL1 = (LPC_SC->PCLKSEL1 & ~(3ul << shift)) | ((unsigned long)value << shift);
+    }
+    return clock_get_pclk(peripheral);
+}
+
+unsigned long
+clock_get_pclk
+    (unsigned peripheral
+    )
+{
+    /* Dividers for the PCLKSEL field values. CAN and ACF use 6 instead of 8
+     * but are not used here. */
+    static const unsigned char DIVIDERS[4] = {4, 1, 2, 8};
+    const unsigned long sel = (peripheral < 16) ? LPC_SC->PCLKSEL0 : LPC_SC->PCLKSEL1;
+    return g_cclk / DIVIDERS[(sel >> (2 * (peripheral & 15))) & 3];
+}
+
+void
+clock_usb_start
+    (void
+    )
+{
+    const unsigned long m = 48000000ul / g_fosc;
+    ASSERT((m > 1) && (m * g_fosc == 48000000ul));
+    if (LPC_SC->PLL1STAT & PLL1_PLLE1_STAT)
+    {
+        return;
+    }
+
+    /* P = 2 gives FCCO = 192MHz which is within the 156 - 320MHz range */
+    LPC_SC->PLL1CFG = 0x20 | (m - 1);
+    pll1_feed();
+
+    LPC_SC->PLL1CON = 0x01;
+    pll1_feed();
+}
+
+void
+clock_usb_setup
+    (void
+    )
+{
+    clock_usb_start();
+    while (!(LPC_SC->PLL1STAT & PLL1_PLOCK));
+
+    LPC_SC->PLL1CON = 0x03;
+    pll1_feed();
+    while (!(LPC_SC->PLL1STAT & (PLL1_PLLC1_STAT | PLL1_PLLE1_STAT)));
+}
@@ -0,0 +1,76 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LPC176X_CLOCK_H_
+#define LPC176X_CLOCK_H_
+
+/* Peripheral clock selectors. The value is the position of the two bit field
+ * in PCLKSEL0 (0 - 15) or PCLKSEL1 (16 - 31). */
+#define CLOCK_PCLK_WDT          (0)
+#define CLOCK_PCLK_TIMER0       (1)
+#define CLOCK_PCLK_TIMER1       (2)
+#define CLOCK_PCLK_UART0        (3)
+#define CLOCK_PCLK_UART1        (4)
+#define CLOCK_PCLK_PWM1         (6)
+#define CLOCK_PCLK_I2C0         (7)
+#define CLOCK_PCLK_SPI          (8)
+#define CLOCK_PCLK_SSP1         (10)
+#define CLOCK_PCLK_DAC          (11)
+#define CLOCK_PCLK_ADC          (12)
+#define CLOCK_PCLK_CAN1         (13)
+#define CLOCK_PCLK_CAN2         (14)
+#define CLOCK_PCLK_ACF          (15)
+#define CLOCK_PCLK_QEI          (16)
+#define CLOCK_PCLK_GPIOINT      (17)
+#define CLOCK_PCLK_PCB          (18)
+#define CLOCK_PCLK_I2C1         (19)
+#define CLOCK_PCLK_SSP0         (21)
+#define CLOCK_PCLK_TIMER2       (22)
+#define CLOCK_PCLK_TIMER3       (23)
+#define CLOCK_PCLK_UART2        (24)
+#define CLOCK_PCLK_UART3        (25)
+#define CLOCK_PCLK_I2C2         (26)
+#define CLOCK_PCLK_I2S          (27)
+#define CLOCK_PCLK_RIT          (29)
+#define CLOCK_PCLK_SYSCON       (30)
+#define CLOCK_PCLK_MC           (31)
+
+/* Run the core from PLL0 fed by the main oscillator (fosc, 1 - 25MHz). The
+ * PLL settings and CPU clock divider are chosen so that CCLK is exactly cclk
+ * (at most 120MHz) and flash wait states are adjusted to suit. Must be called
+ * before any peripheral is set up. */
+void            clock_setup(unsigned long fosc, unsigned long cclk);
+
+/* Returns the CPU clock in Hz. */
+unsigned long   clock_get_cclk(void);
+
+/* Set the divider (1, 2, 4 or 8) between CCLK and the clock of the given
+ * peripheral. Returns the resulting peripheral clock in Hz. */
+unsigned long   clock_set_pclk(unsigned peripheral, unsigned divider);
+
+/* Returns the current clock of the given peripheral in Hz. */
+unsigned long   clock_get_pclk(unsigned peripheral);
+
+/* Start PLL1 to provide the 48MHz USB clock from the main oscillator without
+ * waiting for it to lock, so other setup can be done in the meantime. Does
+ * nothing if PLL1 has already been started. */
+void            clock_usb_start(void);
+
+/* Start PLL1 if needed and wait for it to lock and connect. */
+void            clock_usb_setup(void);
+
+#endif /* LPC176X_CLOCK_H_ */
@@ -0,0 +1,102 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lpc176x_gpdma.h"
+#include <LPC17xx.h>
+#include "debughlprs.h"
+
+#define PCONP_PCGPDMA           (1ul << 29)
+
+#define GPDMA_CHANNEL_STRIDE    (0x20)
+#define GPDMA_CHANNEL(n)        ((LPC_GPDMACH_TypeDef *)((unsigned long)LPC_GPDMACH0 + GPDMA_CHANNEL_STRIDE * (n)))
+
+#define GPDMA_CFG_E             (1ul << 0)
+
+static gpdma_handler_t g_handlers[8];
+
+void
+gpdma_setup
+    (void
+    )
+{
+    if (!(LPC_SC->PCONP & PCONP_PCGPDMA))
+    {
+        LPC_SC->PCONP              |= PCONP_PCGPDMA;
+        LPC_GPDMA->DMACIntTCClear   = 0xff;
+        LPC_GPDMA->DMACIntErrClr    = 0xff;
+        LPC_GPDMA->DMACConfig       = 1; /* enabled, little endian */
+        NVIC_SetPriority(DMA_IRQn, 10);
+        NVIC_EnableIRQ(DMA_IRQn);
+    }
+}
+
+void
+gpdma_start
+    (unsigned                   channel
+    ,const struct gpdma_lli_s  *first
+    ,unsigned long              config
+    ,gpdma_handler_t            handler
+    )
+{
+    LPC_GPDMACH_TypeDef *ch = GPDMA_CHANNEL(channel);
+    ASSERT(channel < 8);
+    gpdma_stop(channel);
+    g_handlers[channel]         = handler;
+    LPC_GPDMA->DMACIntTCClear   = 1ul << channel;
+    LPC_GPDMA->DMACIntErrClr    = 1ul << channel;
+    ch->DMACCSrcAddr            = first->src;
+    ch->DMACCDestAddr           = first->dst;
+    ch->DMACCLLI                = first->next;
+    ch->DMACCControl            = first->control;
+    ch->DMACCConfig             = config | GPDMA_CFG_E;
+}
+
+void
+gpdma_stop
+    (unsigned channel
+    )
+{
+    GPDMA_CHANNEL(channel)->DMACCConfig &= ~GPDMA_CFG_E;
+}
+
+unsigned long
+gpdma_get_dst
+    (unsigned channel
+    )
+{
+    return GPDMA_CHANNEL(channel)->DMACCDestAddr;
+}
+
+void
+DMA_IRQHandler
+    (void
+    )
+{
+    const unsigned long tc_flags    = LPC_GPDMA->DMACIntTCStat;
+    const unsigned long err_flags   = LPC_GPDMA->DMACIntErrStat;
+    unsigned            channel;
+    LPC_GPDMA->DMACIntTCClear       = tc_flags;
+    LPC_GPDMA->DMACIntErrClr        = err_flags;
+    for (channel = 0; channel < 8; channel++)
+    {
+        const unsigned long mask = 1ul << channel;
+        if (((tc_flags | err_flags) & mask) && (g_handlers[channel]))
+        {
+            g_handlers[channel](channel, (err_flags & mask) != 0);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LPC176X_GPDMA_H_
+#define LPC176X_GPDMA_H_
+
+/* GPDMA peripheral request numbers (DMAREQSEL left at its reset value) */
+#define GPDMA_PERIPH_SSP0_TX        (0)
+#define GPDMA_PERIPH_SSP0_RX        (1)
+#define GPDMA_PERIPH_SSP1_TX        (2)
+#define GPDMA_PERIPH_SSP1_RX        (3)
+#define GPDMA_PERIPH_ADC            (4)
+#define GPDMA_PERIPH_UART0_TX       (8)
+#define GPDMA_PERIPH_UART0_RX       (9)
+#define GPDMA_PERIPH_UART1_TX       (10)
+#define GPDMA_PERIPH_UART1_RX       (11)
+
+/* Channel control word fields */
+#define GPDMA_CTRL_SIZE(n)          ((n) & 0xfff)
+#define GPDMA_CTRL_SBSIZE_1         (0ul << 12)
+#define GPDMA_CTRL_DBSIZE_1         (0ul << 15)
+#define GPDMA_CTRL_SWIDTH_8         (0ul << 18)
+#define GPDMA_CTRL_SWIDTH_32        (2ul << 18)
+#define GPDMA_CTRL_DWIDTH_8         (0ul << 21)
+#define GPDMA_CTRL_DWIDTH_32        (2ul << 21)
+#define GPDMA_CTRL_SI               (1ul << 26)
+#define GPDMA_CTRL_DI               (1ul << 27)
+#define GPDMA_CTRL_I                (1ul << 31)
+
+/* Channel configuration word fields */
+#define GPDMA_CFG_SRC_PERIPH(n)     (((n) & 0x1f) << 1)
+#define GPDMA_CFG_DST_PERIPH(n)     (((n) & 0x1f) << 6)
+#define GPDMA_CFG_M2M               (0ul << 11)
+#define GPDMA_CFG_M2P               (1ul << 11)
+#define GPDMA_CFG_P2M               (2ul << 11)
+#define GPDMA_CFG_IE                (1ul << 14)
+#define GPDMA_CFG_ITC               (1ul << 15)
+
+/* Linked list item as used by the controller. Must be word aligned. */
+struct gpdma_lli_s
+{
+    unsigned long   src;
+    unsigned long   dst;
+    unsigned long   next; /* address of the next item or zero */
+    unsigned long   control;
+};
+
+/* Called from the DMA interrupt when a transfer with GPDMA_CTRL_I set has
+ * completed or when the channel has stopped with an error. */
+typedef void (*gpdma_handler_t)(unsigned channel, int error);
+
+/* Power up the controller. May be called more than once. */
+void            gpdma_setup(void);
+
+/* Start the given channel (0 has highest priority, 7 lowest) with the first
+ * transfer of a list. config is a combination of the GPDMA_CFG_ flags. */
+void            gpdma_start(unsigned channel, const struct gpdma_lli_s *first, unsigned long config, gpdma_handler_t handler);
+
+/* Disable the channel. */
+void            gpdma_stop(unsigned channel);
+
+/* Returns the current destination address of the channel. */
+unsigned long   gpdma_get_dst(unsigned channel);
+
+#endif /* LPC176X_GPDMA_H_ */
@@ -0,0 +1,113 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lpc176x_iap.h"
+#include "lpc176x_clock.h"
+#include "critical.h"
+#include "debughlprs.h"
+
+#define IAP_LOCATION                (0x1fff1ff1ul)
+
+#define IAP_CMD_PREPARE_SECTORS     (50)
+#define IAP_CMD_COPY_RAM_TO_FLASH   (51)
+#define IAP_CMD_ERASE_SECTORS       (52)
+
+typedef void (*iap_entry_t)(unsigned long command[5], unsigned long result[5]);
+
+static
+unsigned
+iap_call
+    (unsigned long command[5]
+    )
+{
+    unsigned long result[5];
+    ((iap_entry_t)IAP_LOCATION)(command, result);
+    return result[0];
+}
+
+static
+unsigned
+iap_prepare
+    (unsigned first_sector
+    ,unsigned last_sector
+    )
+{
+    unsigned long command[5];
+    command[0] = IAP_CMD_PREPARE_SECTORS;
+    command[1] = first_sector;
+    command[2] = last_sector;
+    return iap_call(command);
+}
+
+unsigned
+iap_get_sector
+    (unsigned long address
+    )
+{
+    return (address < 0x10000ul)
+        ? address >> 12
+        : 16 + ((address - 0x10000ul) >> 15);
+}
+
+unsigned
+iap_erase
+    (unsigned first_sector
+    ,unsigned last_sector
+    )
+{
+    unsigned long command[5];
+    const unsigned long state = critical_enter();
+    unsigned status = iap_prepare(first_sector, last_sector);
+    if (status == IAP_CMD_SUCCESS)
+    {
+        command[0] = IAP_CMD_ERASE_SECTORS;
+        command[1] = first_sector;
+        command[2] = last_sector;
+        command[3] = clock_get_cclk() / 1000;
+        status = iap_call(command);
+    }
+    critical_exit(state);
+    return status;
+}
+
+unsigned
+iap_program
+    (unsigned long  address
+    ,const void    *data
+    ,unsigned       length
+    )
+{
+    unsigned long command[5];
+    const unsigned sector = iap_get_sector(address);
+    unsigned long state;
+    unsigned status;
+    ASSERT(!((unsigned long)data & 3));
+    ASSERT(!(address & (length - 1)));
+    state  = critical_enter();
+    status = iap_prepare(sector, sector);
+    if (status == IAP_CMD_SUCCESS)
+    {
+        command[0] = IAP_CMD_COPY_RAM_TO_FLASH;
+        command[1] = address;
+        command[2] = (unsigned long)data;
+        command[3] = length;
+        command[4] = clock_get_cclk() / 1000;
+        status = iap_call(command);
+    }
+    critical_exit(state);
+    return status;
+}
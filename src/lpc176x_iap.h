@@ -0,0 +1,49 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LPC176X_IAP_H_
+#define LPC176X_IAP_H_
+
+/* Status codes returned by the IAP routines in the boot ROM. */
+#define IAP_CMD_SUCCESS         (0)
+#define IAP_DST_ADDR_ERROR      (2)
+#define IAP_SRC_ADDR_ERROR      (3)
+#define IAP_COUNT_ERROR         (6)
+#define IAP_INVALID_SECTOR      (7)
+#define IAP_SECTOR_NOT_BLANK    (8)
+#define IAP_SECTOR_NOT_PREPARED (9)
+#define IAP_COMPARE_ERROR       (10)
+#define IAP_BUSY                (11)
+
+/* Returns the flash sector number containing the given address. Sectors 0 -
+ * 15 are 4kB and sectors 16 - 29 are 32kB. */
+unsigned    iap_get_sector(unsigned long address);
+
+/* Erase a range of sectors. Takes in the order of 100ms per sector. */
+unsigned    iap_erase(unsigned first_sector, unsigned last_sector);
+
+/* Program length bytes (256, 512, 1024 or 4096) at a flash address aligned to
+ * length. data must be word aligned and in RAM. Takes in the order of 1ms per
+ * 256 bytes. */
+unsigned    iap_program(unsigned long address, const void *data, unsigned length);
+
+/* The flash can not be read while it is being erased or programmed so all of
+ * the above run with interrupts disabled for their full duration. The IAP
+ * routines also use the top 32 bytes of the local SRAM which must not hold
+ * the stack. */
+
+#endif /* LPC176X_IAP_H_ */
@@ -16,6 +16,7 @@
  */
 
 #include "lpc176x_ssp1.h"
+#include "lpc176x_clock.h"
 #include <LPC17xx.h>
 #include "debughlprs.h"
 
@@ -48,7 +49,7 @@ ssp1_set_control_registers
         cr0 |= 0x20;
         break;
     default:
-        ASSERT(config->protocol == SSP_PROTOCOL_SPI);
+        ASSERT(protocol == SSP_PROTOCOL_SPI);
         if (idle_high_clk)
         {
             cr0 |= 0x40;
@@ -100,7 +101,7 @@ ssp_find_best_divisors
     unsigned long best_scr          = (scr > 256) ? 256 : scr;
     unsigned long best_cpsdvsr_2    = cpsdvsr_2;
 
-    ASSERT(tgt_div <= 256 * 127);
+    ASSERT(target_2 <= 256 * 127);
 
     while ((best_error > 0) && (cpsdvsr_2 < 127))
     {
@@ -174,19 +175,11 @@ ssp_get_clock_config
     return cfg;
 }
 
-void ssp1_setup(unsigned long cclk, const struct ssp_config_s *config)
+void ssp1_setup(const struct ssp_config_s *config)
 {
-    static const unsigned long PRESCALER_MASK = 0xffcffffful;
-    static const unsigned long PRESCALER_FLAGS[4] =
-        {0x00100000ul /* PCLK = CCLK */
-        ,0x00200000ul /* PCLK = CCLK / 2 */
-        ,0x00000000ul /* PCLK = CCLK / 4 */
-        ,0x00300000ul /* PCLK = CCLK / 8 */
-        };
-
     struct ssp_clock_config_s clock_config =
         ssp_get_clock_config
-            (cclk
+            (clock_get_cclk()
             ,config->baud_rate
             ,config->mode == SSP_MODE_MASTER
             );
@@ -194,7 +187,7 @@ void ssp1_setup(unsigned long cclk, const struct ssp_config_s *config)
 
     LPC_SC->PCONP          |= PCONP_SSP1;
     LPC_PINCON->PINSEL0     = (LPC_PINCON->PINSEL0 & 0xfff00ffful) | 0x000aa000ul;
-    LPC_SC->PCLKSEL0        = (LPC_SC->PCLKSEL0 & PRESCALER_MASK) | PRESCALER_FLAGS[clock_config.prescale];
+    (void)clock_set_pclk(CLOCK_PCLK_SSP1, 1u << clock_config.prescale);
     LPC_SSP1->CPSR          = clock_config.clock_prescale_divisor;
     ssp1_set_control_registers
         (config->protocol
@@ -210,5 +203,20 @@ void ssp1_setup(unsigned long cclk, const struct ssp_config_s *config)
 
 }
 
-
-
+unsigned long ssp1_set_baud_rate(unsigned long baud_rate)
+{
+    struct ssp_clock_config_s clock_config =
+        ssp_get_clock_config
+            (clock_get_cclk()
+            ,baud_rate
+            ,1
+            );
+    unsigned long pclk;
+
+    LPC_SSP1->CR1  &= ~0x02ul;
+    pclk            = clock_set_pclk(CLOCK_PCLK_SSP1, 1u << clock_config.prescale);
+    LPC_SSP1->CPSR  = clock_config.clock_prescale_divisor;
+    LPC_SSP1->CR0   = (LPC_SSP1->CR0 & 0xfful) | ((clock_config.serial_clock_rate & 0xff) << 8);
+    LPC_SSP1->CR1  |= 0x02ul;
+    return pclk / (clock_config.clock_prescale_divisor * (clock_config.serial_clock_rate + 1));
+}
@@ -45,7 +45,13 @@ struct ssp_config_s
 };
 
 
-void ssp1_setup(unsigned long cclk, const struct ssp_config_s *config);
+/* Setup SSP1. The clock is derived from the current CPU clock (see
+ * lpc176x_clock.h). */
+void ssp1_setup(const struct ssp_config_s *config);
+
+/* Change the serial clock of SSP1 (master mode only). Returns the actual rate
+ * which is the closest the divisors can produce. */
+unsigned long ssp1_set_baud_rate(unsigned long baud_rate);
 
 
 #endif /* LPC176X_SSP1_H_ */
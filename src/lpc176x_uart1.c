@@ -0,0 +1,98 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "lpc176x_uart1.h"
+#include "lpc176x_clock.h"
+#include <LPC17xx.h>
+#include "debughlprs.h"
+
+#define PCONP_PCUART1           (1ul << 4)
+
+#define UART_LCR_8N1            (0x03)
+#define UART_LCR_DLAB           (0x80)
+#define UART_FCR_FIFO_EN        (0x01)
+#define UART_FCR_RX_RESET       (0x02)
+#define UART_FCR_TX_RESET       (0x04)
+#define UART_FCR_DMA_MODE       (0x08)
+#define UART_FCR_RX_TRIGGER_1   (0x00)
+#define UART_IER_RBR            (0x01)
+#define UART_IER_RLS            (0x04)
+#define UART_LSR_RDR            (0x01)
+#define UART_LSR_ERRORS         (0x0e) /* overrun, parity, framing */
+
+static uart1_rx_handler_t g_on_rx;
+
+unsigned long
+uart1_setup
+    (unsigned long      baud_rate
+    ,uart1_rx_handler_t on_rx
+    )
+{
+    unsigned long pclk;
+    unsigned long divisor;
+    ASSERT(baud_rate);
+    g_on_rx = on_rx;
+
+    LPC_SC->PCONP      |= PCONP_PCUART1;
+    /* TXD1 on P0.15 and RXD1 on P0.16 */
+    LPC_PINCON->PINSEL0 = (LPC_PINCON->PINSEL0 & ~0xc0000000ul) | 0x40000000ul;
+    LPC_PINCON->PINSEL1 = (LPC_PINCON->PINSEL1 & ~0x00000003ul) | 0x00000001ul;
+
+    /* No fractional divider - 31250 baud divides exactly from the usual
+     * clocks. */
+    pclk    = clock_set_pclk(CLOCK_PCLK_UART1, 4);
+    divisor = (pclk + 8 * baud_rate) / (16 * baud_rate);
+    ASSERT((divisor >= 1) && (divisor <= 0xffff));
+    LPC_UART1->LCR  = UART_LCR_8N1 | UART_LCR_DLAB;
+    LPC_UART1->DLL  = divisor & 0xff;
+    LPC_UART1->DLM  = divisor >> 8;
+    LPC_UART1->FDR  = 0x10;
+    LPC_UART1->LCR  = UART_LCR_8N1;
+    LPC_UART1->FCR  = UART_FCR_FIFO_EN | UART_FCR_RX_RESET | UART_FCR_TX_RESET | UART_FCR_DMA_MODE | UART_FCR_RX_TRIGGER_1;
+    LPC_UART1->IER  = UART_IER_RBR | UART_IER_RLS;
+    LPC_UART1->TER  = 0x80;
+
+    NVIC_SetPriority(UART1_IRQn, 7);
+    NVIC_EnableIRQ(UART1_IRQn);
+    return pclk / (16 * divisor);
+}
+
+unsigned long
+uart1_get_tx_register
+    (void
+    )
+{
+    return (unsigned long)&(LPC_UART1->THR);
+}
+
+void
+UART1_IRQHandler
+    (void
+    )
+{
+    unsigned long lsr;
+    /* Reading LSR clears the line status interrupt and reading RBR the
+     * receive data interrupt */
+    while ((lsr = LPC_UART1->LSR) & UART_LSR_RDR)
+    {
+        const unsigned byte = LPC_UART1->RBR;
+        if (g_on_rx)
+        {
+            g_on_rx(byte, (lsr & UART_LSR_ERRORS) != 0);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef LPC176X_UART1_H_
+#define LPC176X_UART1_H_
+
+/* Called from the UART1 interrupt for every received byte. error is non-zero
+ * if the byte had a framing or parity error or bytes were lost before it. */
+typedef void (*uart1_rx_handler_t)(unsigned byte, int error);
+
+/* Setup UART1 for 8 data bits, no parity and one stop bit on TXD1 (P0.15)
+ * and RXD1 (P0.16). The FIFOs are enabled with transmit DMA requests (see
+ * uart1_get_tx_register) and the receive interrupt fires for every byte.
+ * The clock is derived from the current CPU clock (see lpc176x_clock.h).
+ * Returns the actual baud rate. */
+unsigned long   uart1_setup(unsigned long baud_rate, uart1_rx_handler_t on_rx);
+
+/* Address of the transmit holding register, the destination for DMA. */
+unsigned long   uart1_get_tx_register(void);
+
+#endif /* LPC176X_UART1_H_ */
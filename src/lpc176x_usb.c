@@ -16,14 +16,13 @@
  */
 
 #include "lpc176x_usb.h"
-#include "lpc176x_pll1.h"
+#include "lpc176x_clock.h"
 #include "lpc176x_usb_pvt.h"
 #include "lpc176x_usb_sie.h"
 #include "LPC17xx.h"
 #include "debughlprs.h"
-
-/* FIXME: this module does not perform resets properly... g_device_state always
- * remains configured after a configuration. */
+#include "trace.h"
+#include "hotpath.h"
 
 /* USB 2.0 Spec table 9-5 */
 
@@ -53,12 +52,16 @@
 #define USB_PKTST_PO            (1 << 3)
 #define USB_PKTST_EPN           (1 << 4)
 
+/* SIE Set Mode: interrupt on NAKed bulk OUT transactions */
+#define USB_MODE_INAK_BO        (1 << 6)
+
 #define USB_DEV_DESC_NB_CFG(desc)   (desc[17])
 #define USB_CFG_DESC_ID(desc)       (desc[5])
 
 /* From USB2.0 chapter 9.1 (these are the important states) */
 static enum { USB_STATE_DEFAULT, USB_STATE_ADDRESS, USB_STATE_CONFIGURED }     g_device_state;
 static const struct usb_configuration_s                                       *g_config_descriptor;
+static struct usb_stats_s                                                      g_stats;
 
 /* Information about the endpoints. This is populated automatically from the
  * g_config_descriptor data structure on load. */
@@ -76,6 +79,15 @@ usb_is_configured
     return (g_device_state == USB_STATE_CONFIGURED);
 }
 
+void
+usb_get_stats
+    (struct usb_stats_s    *stats
+    )
+{
+    *stats = g_stats;
+}
+
+HOTPATH_RAMFUNC
 unsigned
 usb_write
     (unsigned               physical_endpoint
@@ -86,6 +98,7 @@ usb_write
     unsigned to_write = g_endpoint_descriptors[physical_endpoint].max_buffer_size;
     unsigned i;
     unsigned long val = 0;
+    HOTPATH_BEGIN(HOTPATH_USB_WRITE);
     ASSERT(physical_endpoint & 1);
     if (to_write > size)
     {
@@ -113,9 +126,40 @@ usb_write
     LPC_USB->USBCtrl = 0;
     usb_sie_select_endpoint(physical_endpoint);
     usb_sie_validate_buffer();
+    HOTPATH_END(HOTPATH_USB_WRITE);
     return to_write;
 }
 
+HOTPATH_RAMFUNC
+unsigned
+usb_write_words
+    (unsigned               physical_endpoint
+    ,const unsigned long   *words
+    ,unsigned               nb_words
+    )
+{
+    unsigned to_write = g_endpoint_descriptors[physical_endpoint].max_buffer_size / 4;
+    unsigned i;
+    HOTPATH_BEGIN(HOTPATH_USB_WRITE_WORDS);
+    ASSERT(physical_endpoint & 1);
+    if (to_write > nb_words)
+    {
+        to_write = nb_words;
+    }
+    LPC_USB->USBCtrl = USB_CTRL_WR_EN | ((physical_endpoint << 1) & 0x3c);
+    LPC_USB->USBTxPLen = 4 * to_write;
+    for (i = 0; i < to_write; i++)
+    {
+        LPC_USB->USBTxData = words[i];
+    }
+    LPC_USB->USBCtrl = 0;
+    usb_sie_select_endpoint(physical_endpoint);
+    usb_sie_validate_buffer();
+    HOTPATH_END(HOTPATH_USB_WRITE_WORDS);
+    return to_write;
+}
+
+HOTPATH_RAMFUNC
 int /* Returns negative on error, otherwise returns the number of characters
      * supplied by the endpoint. */
 usb_read
@@ -126,6 +170,7 @@ usb_read
 {
     unsigned long rx_plen;
     int status = -1;
+    HOTPATH_BEGIN(HOTPATH_USB_READ);
     ASSERT((physical_endpoint & 1) == 0);
     LPC_USB->USBCtrl = USB_CTRL_RD_EN | ((physical_endpoint << 1) & 0x3c);
     do
@@ -136,27 +181,66 @@ usb_read
     {
         const unsigned packet_len = (rx_plen & 0x3ff);
         unsigned i;
-        unsigned long data = LPC_USB->USBRxData;
+        unsigned long data = 0;
         for (i = 0; i < packet_len; i++)
         {
-            if ((i < buffer_size) && (buffer))
-            {
-                buffer[i] = data & 0xff;
-            }
-            if ((i & 0x3) == 3)
+            /* One word per four bytes and none past the end of the packet
+             * (nothing at all for a zero length one) */
+            if ((i & 0x3) == 0)
             {
                 data = LPC_USB->USBRxData;
             }
-            else
+            if ((i < buffer_size) && (buffer))
             {
-                data >>= 8;
+                buffer[i] = data & 0xff;
             }
+            data >>= 8;
         }
         status = (buffer_size < packet_len) ? buffer_size : packet_len;
     }
     LPC_USB->USBCtrl = 0;
     usb_sie_select_endpoint(physical_endpoint);
     usb_sie_clear_buffer();
+    HOTPATH_END(HOTPATH_USB_READ);
+    return status;
+}
+
+HOTPATH_RAMFUNC
+int /* Returns negative on error, otherwise returns the number of characters
+     * supplied by the endpoint. */
+usb_read_words
+    (unsigned       physical_endpoint
+    ,void         (*on_word)(unsigned long word)
+    )
+{
+    unsigned long rx_plen;
+    int status = -1;
+    HOTPATH_BEGIN(HOTPATH_USB_READ_WORDS);
+    ASSERT((physical_endpoint & 1) == 0);
+    LPC_USB->USBCtrl = USB_CTRL_RD_EN | ((physical_endpoint << 1) & 0x3c);
+    do
+    {
+        rx_plen = LPC_USB->USBRxPLen;
+    } while ((rx_plen & USB_RX_PKT_RDY) == 0);
+    if (rx_plen & USB_RX_PKT_VALID)
+    {
+        const unsigned packet_len = (rx_plen & 0x3ff);
+        unsigned i;
+        for (i = 0; i < packet_len; i += 4)
+        {
+            unsigned long data = LPC_USB->USBRxData;
+            if (packet_len - i < 4)
+            {
+                data &= 0xfffffffful >> (8 * (4 - (packet_len - i)));
+            }
+            on_word(data);
+        }
+        status = packet_len;
+    }
+    LPC_USB->USBCtrl = 0;
+    usb_sie_select_endpoint(physical_endpoint);
+    usb_sie_clear_buffer();
+    HOTPATH_END(HOTPATH_USB_READ_WORDS);
     return status;
 }
 
@@ -164,6 +248,10 @@ struct ctl_data_stream_s
 {
     const unsigned char    *data;
     unsigned                data_left;
+    int                     active;     /* IN packets still to be sent */
+    int                     zlp;        /* Less than wLength is being sent so
+                                         * the transfer must end with a short
+                                         * packet */
 };
 
 static
@@ -172,9 +260,20 @@ usb_send_control_stream
     (struct ctl_data_stream_s *stream
     )
 {
-    const unsigned written  = usb_write(1, stream->data, stream->data_left);
-    stream->data           += written;
-    stream->data_left      -= written;
+    if (stream->active)
+    {
+        const unsigned written  = usb_write(1, stream->data, stream->data_left);
+        stream->data           += written;
+        stream->data_left      -= written;
+        /* The data stage (or the zero length status stage) is complete once
+         * a short packet has gone or everything that was asked for has. */
+        if  (   (written < g_endpoint_descriptors[1].max_buffer_size)
+            ||  ((!stream->data_left) && (!stream->zlp))
+            )
+        {
+            stream->active = 0;
+        }
+    }
 }
 
 #define GET_REQ_IS_H2D(request_type) ((request_type) >> 7)
@@ -223,6 +322,7 @@ usb_control_get_descriptor
     }
     if (data)
     {
+        /* Never trust wlength - only the descriptor says how much there is */
         const unsigned desc_size =
             (desc_type == USB_DESC_TYPE_CONFIGURATION)
             ? ((((unsigned)data[3]) << 8) | data[2])
@@ -279,6 +379,25 @@ realize_and_enable_endpoint
     g_endpoint_descriptors[endpoint].max_buffer_size = max_packet_size;
 }
 
+/* Return to having only the control endpoints. Used on bus reset and when the
+ * configuration is changed or cleared so endpoints of an old configuration
+ * do not stay enabled. */
+static
+void
+release_endpoints
+    (void
+    )
+{
+    unsigned i;
+    LPC_USB->USBEpIntEn = 0x3;
+    LPC_USB->USBReEp    = 0x3;
+    for (i = 2; i < 32; i++)
+    {
+        g_endpoint_descriptors[i].enabled           = 0;
+        g_endpoint_descriptors[i].max_buffer_size   = 0;
+    }
+}
+
 static
 int
 usb_control_set_config_helper
@@ -288,17 +407,30 @@ usb_control_set_config_helper
     const unsigned cfg_len = (((unsigned)config[3]) << 8) | config[2];
     unsigned desc_idx;
     unsigned long ep_int_flags = 0x3;
-    /* Enumerate over the USB configuration looking for endpoints */
-    for (desc_idx = config[0]; desc_idx < cfg_len; desc_idx += config[desc_idx])
+    release_endpoints();
+    /* Enumerate over the USB configuration looking for endpoints. Every
+     * descriptor must have room for its length and type and fit in the
+     * total length, anything else ends the walk (a zero length would never
+     * advance). */
+    for (desc_idx = config[0]
+        ;   (desc_idx + 2 <= cfg_len)
+        &&  (config[desc_idx] >= 2)
+        &&  (desc_idx + config[desc_idx] <= cfg_len)
+        ;desc_idx += config[desc_idx]
+        )
     {
         const unsigned char *descriptor = &(config[desc_idx]);
-        if (descriptor[1] == USB_DESC_TYPE_ENDPOINT)
+        if ((descriptor[1] == USB_DESC_TYPE_ENDPOINT) && (descriptor[0] >= 7))
         {
             unsigned physical_endpoint = ((descriptor[2] & 0x0f) << 1) | (descriptor[2] >> 7);
-            unsigned max_packet_size   = descriptor[4];
+            unsigned max_packet_size   = descriptor[4] | (((unsigned)descriptor[5] & 0x03) << 8);
             ASSERT((physical_endpoint != 0) && (physical_endpoint != 1));
-            realize_and_enable_endpoint(physical_endpoint, max_packet_size);
-            ep_int_flags |= (1 << physical_endpoint);
+            /* Full speed packets are at most 1023 bytes (isochronous) */
+            if ((physical_endpoint > 1) && (max_packet_size))
+            {
+                realize_and_enable_endpoint(physical_endpoint, max_packet_size);
+                ep_int_flags |= (1ul << physical_endpoint);
+            }
         }
     }
     LPC_USB->USBEpIntEn = ep_int_flags;
@@ -321,6 +453,7 @@ usb_control_set_configuration
         if (wvalue == 0)
         {
             usb_sie_configure_device(0);
+            release_endpoints();
             g_device_state = USB_STATE_ADDRESS;
             return 1;
         }
@@ -330,7 +463,7 @@ usb_control_set_configuration
             while (idx)
             {
                 const unsigned char* cfg = g_config_descriptor->get_cfg_desc(--idx);
-                if (USB_CFG_DESC_ID(cfg) == wvalue)
+                if ((cfg) && (USB_CFG_DESC_ID(cfg) == wvalue))
                 {
                     return usb_control_set_config_helper(cfg);
                 }
@@ -376,6 +509,17 @@ usb_handle_control_read
                 }
             }
         }
+        else if (g_config_descriptor->on_control_request)
+        {
+            const unsigned char *data   = 0;
+            unsigned             length = 0;
+            handled = g_config_descriptor->on_control_request(packet_buf, &data, &length);
+            if (handled)
+            {
+                stream->data        = data;
+                stream->data_left   = (wlength > length) ? length : wlength;
+            }
+        }
     }
     return handled;
 }
@@ -408,6 +552,13 @@ usb_handle_ep_int
                 if (plen >= 0)
                 {
                     unsigned wlen = pdata[6] | (((unsigned)pdata[7]) << 8);
+                    TRACE
+                        (TRACE_EVENT_USB_SETUP
+                        ,pdata[0] | ((unsigned long)pdata[1] << 8) | ((unsigned long)pdata[2] << 16) | ((unsigned long)pdata[3] << 24)
+                        ,pdata[4] | ((unsigned long)pdata[5] << 8) | ((unsigned long)wlen << 16)
+                        );
+                    ctl_stream.data_left    = 0;
+                    ctl_stream.active       = 0;
                     if ((wlen == 0) || (pdata[0] & 0x80)) /* USB2.0 - section 9.3.1 */
                     {
                         int handled =
@@ -416,17 +567,27 @@ usb_handle_ep_int
                                 ,pdata
                                 ,plen
                                 );
-                        if (!handled)
+                        if (handled)
                         {
-                            dump_buffer(pdata, plen);
+                            ctl_stream.active   = 1;
+                            ctl_stream.zlp      = (ctl_stream.data_left < wlen);
+                            usb_send_control_stream
+                                (&ctl_stream
+                                );
+                            return;
                         }
                     }
-                    usb_send_control_stream
-                        (&ctl_stream
-                        );
+                    /* Request errors are reported with a stall on both
+                     * directions (USB2.0 - section 8.5.3.4), cleared by the
+                     * next setup packet. */
+                    dump_buffer(pdata, plen);
+                    g_stats.control_stalls++;
+                    usb_sie_stall_endpoint(0);
+                    usb_sie_stall_endpoint(1);
                 }
                 else
                 {
+                    g_stats.control_stalls++;
                     usb_sie_stall_endpoint(0);
                 }
             }
@@ -438,13 +599,23 @@ usb_handle_ep_int
     }
     else
     {
+        if (flags & USB_PKTST_EPN)
+        {
+            /* The host found the OUT buffers full and will retry. Nothing to
+             * read unless a packet arrived since. */
+            g_stats.out_naks++;
+            if ((!(physical_endpoint & 1)) && (!(flags & USB_PKTST_FE)))
+            {
+                return;
+            }
+        }
         if (g_config_descriptor->on_usb_endpoint)
         {
             g_config_descriptor->on_usb_endpoint(physical_endpoint);
         }
         else
         {
-            usb_sie_stall_endpoint(0);
+            usb_sie_stall_endpoint(physical_endpoint);
         }
     }
 }
@@ -455,9 +626,11 @@ usb_reset
     (void
     )
 {
+    TRACE(TRACE_EVENT_USB_RESET, 0, 0);
     g_device_state                              = USB_STATE_DEFAULT;
     LPC_USB->USBDevIntClr                       = 0xfffffffful;
     LPC_USB->USBEpIntClr                        = 0xfffffffful;
+    release_endpoints();
     realize_and_enable_endpoint(0, g_config_descriptor->dev_desc[7]);
     realize_and_enable_endpoint(1, g_config_descriptor->dev_desc[7]);
     LPC_USB->USBDevIntEn                        = USB_DI_FRAME | USB_DI_EP_SLOW | USB_DI_DEV_STAT;
@@ -465,6 +638,7 @@ usb_reset
     usb_sie_set_address(0);
 }
 
+HOTPATH_RAMFUNC
 void
 USB_IRQHandler
     (void
@@ -472,6 +646,7 @@ USB_IRQHandler
 {
     const unsigned long interrupt_flags = LPC_USB->USBDevIntSt;
     const unsigned long endpoint_flags = (interrupt_flags & USB_DI_EP_FAST) | (interrupt_flags & USB_DI_EP_SLOW);
+    HOTPATH_BEGIN(HOTPATH_USB_IRQ);
     LPC_USB->USBDevIntClr = interrupt_flags;
     if ((interrupt_flags & USB_DI_FRAME) && (g_config_descriptor->on_usb_frame))
     {
@@ -502,12 +677,12 @@ USB_IRQHandler
             }
         }
     }
+    HOTPATH_END(HOTPATH_USB_IRQ);
 }
 
 void
 usb_setup
-    (unsigned long                      fosc
-    ,const struct usb_configuration_s  *usb_config
+    (const struct usb_configuration_s  *usb_config
     )
 {
     /* Store the global USB hardware descriptor */
@@ -535,7 +710,7 @@ usb_setup
 
     /* 2) Setup PLL1 to be the clock source for USB and wait for the clock to
      * be available. */
-    pll1_setup(fosc);
+    clock_usb_setup();
     LPC_USB->USBClkCtrl = (USBCLKCTRL_DEV_CLK_EN | USBCLKCTRL_AHB_CLK_EN);
     while (!(LPC_USB->USBClkSt & (USBCLKST_DEV_CLK_ON | USBCLKST_AHB_CLK_EN)));
 
@@ -551,7 +726,7 @@ usb_setup
     *   EP_SLOW, and possibly EP_FAST)
     */
     usb_reset();
-    usb_sie_set_mode(0);
+    usb_sie_set_mode(USB_MODE_INAK_BO);
     NVIC_SetPriority(USB_IRQn, 5);
     NVIC_EnableIRQ(USB_IRQn);
 
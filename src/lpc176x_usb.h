@@ -48,10 +48,27 @@ struct usb_configuration_s
      * the configuration descriptor. physical_endpoints correspond to the
      * enpoints as listed in the device documentation. */
     void                    (*on_usb_endpoint)(unsigned physical_endpoint);
+    /* Function which is called for class and vendor requests on the control
+     * endpoint. setup is the 8 byte setup packet. Requests with a data stage
+     * from the device store the data (which must stay valid until it has
+     * been sent) in *data and *length. Only requests without a data stage
+     * from the host are passed on. Returns non-zero if the request was
+     * handled. May be null. */
+    int                     (*on_control_request)(const unsigned char *setup, const unsigned char **data, unsigned *length);
+};
+
+struct usb_stats_s
+{
+    unsigned long   out_naks;       /* Bulk OUT NAK interrupts (INAK_BO) as
+                                     * the endpoint buffers were full. One
+                                     * per NAK the device reports, not per
+                                     * burst of host retries, which may NAK
+                                     * many times before it is taken. */
+    unsigned long   control_stalls; /* Setup requests answered with a stall */
 };
 
 /* Setup and enable the USB device with the given descriptor */
-void        usb_setup(unsigned long fosc, const struct usb_configuration_s *usb_config);
+void        usb_setup(const struct usb_configuration_s *usb_config);
 /* Returns non-zero if the device is configured */
 int         usb_is_configured(void);
 /* Write to the given physical endpoint. The return value is how much data was
@@ -59,8 +76,19 @@ int         usb_is_configured(void);
  * as set in the configuration descriptor and will always be less than 64
  * characters). */
 unsigned    usb_write(unsigned physical_endpoint, const unsigned char *buffer, unsigned size);
+/* Write whole 32-bit words (in FIFO byte order) to the given physical
+ * endpoint. Returns how many were written, at most a packet's worth. */
+unsigned    usb_write_words(unsigned physical_endpoint, const unsigned long *words, unsigned nb_words);
 /* Read from the given physical endpoint. Returns negative on error otherwise
  * the return value is the number of chars read into the buffer. */
 int         usb_read(unsigned physical_endpoint, unsigned char *buffer, unsigned buffer_size);
+/* Read from the given physical endpoint one 32-bit word at a time straight
+ * out of the receive FIFO, calling on_word for every word (the last word is
+ * zero padded if the packet length is not a multiple of four). Returns
+ * negative on error otherwise the packet length. */
+int         usb_read_words(unsigned physical_endpoint, void (*on_word)(unsigned long word));
+/* Copies the counters. Only consistent if called from the USB interrupt (or
+ * with it masked). */
+void        usb_get_stats(struct usb_stats_s *stats);
 
 #endif /* LPC176X_USB_H_ */
@@ -94,8 +94,10 @@ usb_sie_stall_endpoint
     (unsigned       phyiscal_endpoint
     )
 {
-    usb_sie_write_cmd(phyiscal_endpoint);
-    usb_sie_write_data(phyiscal_endpoint, USB_EPST_ST);
+    /* Set Endpoint Status */
+    const unsigned cmd = 0x40 | (0x1f & phyiscal_endpoint);
+    usb_sie_write_cmd(cmd);
+    usb_sie_write_data(cmd, USB_EPST_ST);
 }
 
 void
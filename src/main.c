@@ -20,24 +20,133 @@
 #endif
 
 #include "usb_midi.h"
+#include "midi_map.h"
+#include "midi_din.h"
+#include "midi_router.h"
+#include "midi_resync.h"
+#include "stop_action.h"
+#include "expression.h"
 #include <cr_section_macros.h>
 #include <NXP/crp.h>
 #include "conbus.h"
+#include "lpc176x_clock.h"
+#include "sched.h"
+#include "config_store.h"
+#include "critical.h"
+#include "boot_time.h"
 
 __CRP const unsigned int CRP_WORD = CRP_NO_CRP ;
 
-static unsigned char conbus_data[1024];
+/* Largest console the firmware supports - the actual chain lengths are
+ * probed at startup. */
+#define CONSOLE_MAX_INPUTS_DIV_8    (MIDI_MAP_MAX_INPUTS / 8)
+#define CONSOLE_MAX_OUTPUTS_DIV_8   (8)
+/* Serial clock of the console bus, zero for the conbus default of 60 kHz.
+ * CONBUS_FLAG_DIMMING is only kept with at least about 3.1 MHz for the 64
+ * input bytes (see conbus.h), which the cabling has to be known to carry;
+ * USB_MIDI_HEALTH_DIMMING tells whether it was. */
+#define CONSOLE_BUS_CLOCK           (0)
 
+/* Stop action magnets the supply can drive at once */
+#define CONSOLE_MAX_MAGNETS         (4)
+
+/* In the AHB SRAM for the bit-band access conbus needs */
+__BSS(RAM2) static unsigned char conbus_data[CONBUS_MEMORY_SIZE(CONSOLE_MAX_INPUTS_DIV_8, CONSOLE_MAX_OUTPUTS_DIV_8)];
+
+static const struct expression_pedal_s pedals[] =
+    {   {0, USB_MIDI_CABLE_SWELL, 0, 11, 64, 0}                     /* Swell shoe */
+    ,   {1, USB_MIDI_CABLE_CHOIR, 0, 11, 64, 0}                     /* Choir shoe */
+    ,   {2, USB_MIDI_CABLE_STOPS, 0, 1,  16, EXPRESSION_FLAG_14BIT} /* Crescendo */
+    };
+
+static void console_input_changed(unsigned input, int active)
+{
+    const unsigned long packet = midi_map_input_event(input, active);
+    if (packet)
+    {
+        (void)midi_router_post(MIDI_ROUTER_SRC_CONSOLE, packet);
+    }
+}
+
+/* The MIDI map in use is the copy in the store unless one was uploaded since
+ * the reset. Follow the copy when the store moves it. */
+static const void *stored_map;
+
+static const void *console_find_map(void)
+{
+    unsigned length;
+    const void *map = config_store_find(CONFIG_TAG_MIDI_MAP, &length);
+    return ((map) && (length == MIDI_MAP_TABLE_SIZE)) ? map : 0;
+}
+
+static void console_store_moved(void)
+{
+    const void *map = console_find_map();
+    unsigned long state = critical_enter();
+    if ((stored_map) && (midi_map_get_table() == stored_map) && (map))
+    {
+        midi_map_use_table(map);
+    }
+    stored_map = map;
+    critical_exit(state);
+}
 
 int main(void)
 {
     struct conbus_config_s cfg;
-    cfg.nb_inputs_div_8 = 1;
-    cfg.nb_outputs_div_8 = 1;
-    conbus_init(&cfg, conbus_data);
-    usb_midi_setup(12000000UL);
-    for (;;)
+    cfg.nb_inputs_div_8 = CONSOLE_MAX_INPUTS_DIV_8;
+    cfg.nb_outputs_div_8 = CONSOLE_MAX_OUTPUTS_DIV_8;
+    cfg.on_input_changed = console_input_changed;
+    cfg.flags = CONBUS_FLAG_DIMMING; /* CONBUS_FLAG_PROBE and CONBUS_FLAG_CALIBRATE need the chain tail looped back */
+    cfg.guard_value = 0;
+    cfg.debounce_ticks = 0;
+    cfg.on_scan = stop_action_scan;
+    cfg.baud_rate = CONSOLE_BUS_CLOCK;
+    boot_time_init();
+
+    /* PLL1 locks while the settings are read so the USB device can connect
+     * as early as possible. The bus probe and calibration run after that,
+     * while the host is enumerating. */
+    clock_setup(12000000UL, 120000000UL);
+    clock_usb_start();
+    boot_time_mark(BOOT_PHASE_CLOCK);
+    config_store_init(console_store_moved);
+    boot_time_mark(BOOT_PHASE_CONFIG_STORE);
+    midi_map_init();
+    midi_router_init();
     {
+        unsigned length;
+        const unsigned char *setting;
+        stored_map = console_find_map();
+        if (stored_map)
+        {
+            midi_map_use_table(stored_map);
+        }
+        setting = config_store_find(CONFIG_TAG_DEBOUNCE, &length);
+        if ((setting) && (length == 1))
+        {
+            cfg.debounce_ticks = setting[0];
+        }
+        setting = config_store_find(CONFIG_TAG_ROUTES, &length);
+        if ((setting) && (length == MIDI_ROUTER_NB_SOURCES))
+        {
+            unsigned source;
+            for (source = 0; source < MIDI_ROUTER_NB_SOURCES; source++)
+            {
+                midi_router_set_routes(source, setting[source]);
+            }
+        }
+        setting = config_store_find(CONFIG_TAG_RESYNC, &length);
+        midi_resync_init((setting) && (length == 1) && (setting[0]));
     }
+    midi_din_init();
+    stop_action_init(CONSOLE_MAX_MAGNETS);
+    usb_midi_setup();
+    boot_time_mark(BOOT_PHASE_USB_CONNECT);
+    conbus_init(&cfg, conbus_data);
+    boot_time_mark(BOOT_PHASE_CONBUS);
+    expression_init(pedals, sizeof(pedals) / sizeof(pedals[0]));
+    boot_time_mark(BOOT_PHASE_READY);
+    sched_run();
 	return 0;
 }
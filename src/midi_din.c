@@ -0,0 +1,329 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_din.h"
+#include "lpc176x_uart1.h"
+#include "lpc176x_gpdma.h"
+#include "usb_midi.h"
+#include "midi_router.h"
+#include "sched.h"
+#include "critical.h"
+#include <cr_section_macros.h>
+
+#define MIDI_DIN_BAUD_RATE      (31250)
+
+/* Ring lengths in bytes. Must be powers of two. */
+#define TX_RING_LEN             (256)
+#define RX_RING_LEN             (256)
+
+/* Low priority DMA channel - a late byte only delays the DIN stream */
+#define MIDI_DIN_DMA_CHANNEL    (6)
+
+/* Number of MIDI bytes carried by a packet of each code index number */
+static const unsigned char CIN_LENGTH[16] =
+    {   0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+    };
+
+/* The transmit ring is read by GPDMA, which cannot reach the local SRAM */
+__BSS(RAM2) static unsigned char    g_tx_ring[TX_RING_LEN];
+static unsigned                     g_tx_head;      /* free running */
+static unsigned                     g_tx_tail;      /* free running */
+static unsigned                     g_tx_in_flight; /* bytes being moved by DMA */
+static unsigned                     g_tx_running_status;
+static struct gpdma_lli_s           g_tx_lli;
+
+static unsigned char                g_rx_ring[RX_RING_LEN];
+static volatile unsigned            g_rx_head;      /* free running */
+static unsigned                     g_rx_tail;      /* free running */
+
+/* Receive parser state, only used by the task */
+static struct
+{
+    unsigned        status;         /* running status or system common */
+    unsigned        nb_data;        /* data bytes the status takes */
+    unsigned        pos;            /* data bytes received */
+    unsigned char   data[3];
+    int             in_sysex;
+} g_rx;
+
+static struct midi_din_stats_s      g_stats;
+
+static void midi_din_tx_done(unsigned channel, int error);
+
+/* Start moving the longest contiguous part of the ring. Called with
+ * interrupts disabled when no transfer is running. */
+static
+void
+midi_din_tx_start
+    (void
+    )
+{
+    const unsigned pos      = g_tx_tail & (TX_RING_LEN - 1);
+    unsigned       length   = g_tx_head - g_tx_tail;
+    if (length > TX_RING_LEN - pos)
+    {
+        length = TX_RING_LEN - pos;
+    }
+    g_tx_in_flight = length;
+    if (length)
+    {
+        g_tx_lli.src        = (unsigned long)&(g_tx_ring[pos]);
+        g_tx_lli.dst        = uart1_get_tx_register();
+        g_tx_lli.next       = 0;
+        g_tx_lli.control    =   GPDMA_CTRL_SIZE(length)
+                            |   GPDMA_CTRL_SBSIZE_1
+                            |   GPDMA_CTRL_DBSIZE_1
+                            |   GPDMA_CTRL_SWIDTH_8
+                            |   GPDMA_CTRL_DWIDTH_8
+                            |   GPDMA_CTRL_SI
+                            |   GPDMA_CTRL_I;
+        gpdma_start
+            (MIDI_DIN_DMA_CHANNEL
+            ,&g_tx_lli
+            ,GPDMA_CFG_DST_PERIPH(GPDMA_PERIPH_UART1_TX) | GPDMA_CFG_M2P | GPDMA_CFG_IE | GPDMA_CFG_ITC
+            ,midi_din_tx_done
+            );
+    }
+}
+
+static
+void
+midi_din_tx_done
+    (unsigned   channel
+    ,int        error
+    )
+{
+    /* Bytes of a failed transfer are dropped rather than retried as a
+     * repeat could be taken for a new message. */
+    const unsigned long state = critical_enter();
+    (void)channel;
+    (void)error;
+    g_tx_tail      += g_tx_in_flight;
+    midi_din_tx_start();
+    critical_exit(state);
+}
+
+int
+midi_din_send
+    (unsigned long packet
+    )
+{
+    const unsigned  cin     = USB_MIDI_PACKET_CIN(packet);
+    unsigned        length  = CIN_LENGTH[cin];
+    unsigned        status  = USB_MIDI_PACKET_STATUS(packet);
+    int             queued  = 0;
+    unsigned long   state;
+    if (!length)
+    {
+        return 1;
+    }
+    state = critical_enter();
+    if (TX_RING_LEN - (g_tx_head - g_tx_tail) >= length)
+    {
+        unsigned i = 0;
+        if ((cin >= 0x8) && (cin <= 0xe))
+        {
+            /* Channel voice message */
+            if (status == g_tx_running_status)
+            {
+                i = 1;
+                g_stats.tx_saved++;
+            }
+            g_tx_running_status = status;
+        }
+        else if (((status >= 0xf0) && (status <= 0xf7)) || ((cin >= 0x5) && (cin <= 0x7)))
+        {
+            /* System common messages and SysEx cancel running status, real
+             * time messages do not. */
+            g_tx_running_status = 0;
+        }
+        for (packet >>= 8 * (i + 1); i < length; i++, packet >>= 8)
+        {
+            g_tx_ring[g_tx_head++ & (TX_RING_LEN - 1)] = packet & 0xff;
+            g_stats.tx_bytes++;
+        }
+        if (!g_tx_in_flight)
+        {
+            midi_din_tx_start();
+        }
+        queued = 1;
+    }
+    else
+    {
+        g_stats.tx_dropped++;
+    }
+    critical_exit(state);
+    return queued;
+}
+
+static
+void
+midi_din_rx_byte
+    (unsigned   byte
+    ,int        error
+    )
+{
+    if (error)
+    {
+        /* The parser resynchronises on the next status byte */
+        g_stats.rx_errors++;
+    }
+    else if (g_rx_head - g_rx_tail < RX_RING_LEN)
+    {
+        g_rx_ring[g_rx_head & (RX_RING_LEN - 1)] = byte;
+        g_rx_head++;
+        sched_post(SCHED_TASK_MIDI_DIN);
+    }
+    else
+    {
+        g_stats.rx_dropped++;
+    }
+}
+
+static
+void
+midi_din_rx_post
+    (unsigned   cin
+    ,unsigned   b0
+    ,unsigned   b1
+    ,unsigned   b2
+    )
+{
+    (void)midi_router_post
+        (MIDI_ROUTER_SRC_DIN
+        ,   ((unsigned long)USB_MIDI_CABLE_DIN << 4)
+        |   cin
+        |   ((unsigned long)b0 << 8)
+        |   ((unsigned long)b1 << 16)
+        |   ((unsigned long)b2 << 24)
+        );
+}
+
+/* Turn one received byte into USB-MIDI event packets (USB MIDI 1.0 section
+ * 4). */
+static
+void
+midi_din_parse
+    (unsigned byte
+    )
+{
+    if (byte >= 0xf8)
+    {
+        /* Real time messages may appear anywhere, even inside SysEx */
+        midi_din_rx_post(0xf, byte, 0, 0);
+    }
+    else if ((byte == 0xf7) && (g_rx.in_sysex))
+    {
+        g_rx.data[g_rx.pos] = byte;
+        midi_din_rx_post(0x5 + g_rx.pos, g_rx.data[0], g_rx.data[1], g_rx.data[2]);
+        g_rx.in_sysex = 0;
+        g_rx.pos      = 0;
+        g_rx.status   = 0;
+    }
+    else if (byte >= 0x80)
+    {
+        /* Any other status byte ends (and loses) an unterminated SysEx */
+        g_rx.in_sysex   = (byte == 0xf0);
+        g_rx.data[0]    = byte;
+        g_rx.data[1]    = 0;
+        g_rx.data[2]    = 0;
+        g_rx.pos        = (g_rx.in_sysex) ? 1 : 0;
+        g_rx.status     = 0;
+        if (byte < 0xf0)
+        {
+            g_rx.status     = byte;
+            g_rx.nb_data    = ((byte & 0xe0) == 0xc0) ? 1 : 2;
+        }
+        else if ((byte == 0xf1) || (byte == 0xf3))
+        {
+            g_rx.status     = byte;
+            g_rx.nb_data    = 1;
+        }
+        else if (byte == 0xf2)
+        {
+            g_rx.status     = byte;
+            g_rx.nb_data    = 2;
+        }
+        else if (byte == 0xf6)
+        {
+            midi_din_rx_post(0x5, byte, 0, 0);
+        }
+    }
+    else if (g_rx.in_sysex)
+    {
+        g_rx.data[g_rx.pos++] = byte;
+        if (g_rx.pos == 3)
+        {
+            midi_din_rx_post(0x4, g_rx.data[0], g_rx.data[1], g_rx.data[2]);
+            g_rx.pos        = 0;
+            g_rx.data[1]    = 0;
+            g_rx.data[2]    = 0;
+        }
+    }
+    else if (g_rx.status)
+    {
+        g_rx.data[1 + g_rx.pos++] = byte;
+        if (g_rx.pos == g_rx.nb_data)
+        {
+            const unsigned cin = (g_rx.status < 0xf0)
+                ? (g_rx.status >> 4)
+                : (1 + g_rx.nb_data);
+            midi_din_rx_post(cin, g_rx.status, g_rx.data[1], (g_rx.nb_data == 2) ? g_rx.data[2] : 0);
+            g_rx.pos = 0;
+            if (g_rx.status >= 0xf0)
+            {
+                /* System common messages have no running status */
+                g_rx.status = 0;
+            }
+        }
+    }
+}
+
+static
+void
+midi_din_rx_task
+    (void
+    )
+{
+    const unsigned head = g_rx_head;
+    while (g_rx_tail != head)
+    {
+        midi_din_parse(g_rx_ring[g_rx_tail & (RX_RING_LEN - 1)]);
+        g_rx_tail++;
+        g_stats.rx_bytes++;
+    }
+}
+
+void
+midi_din_init
+    (void
+    )
+{
+    sched_register(SCHED_TASK_MIDI_DIN, midi_din_rx_task);
+    gpdma_setup();
+    (void)uart1_setup(MIDI_DIN_BAUD_RATE, midi_din_rx_byte);
+}
+
+void
+midi_din_get_stats
+    (struct midi_din_stats_s *stats
+    )
+{
+    const unsigned long state = critical_enter();
+    *stats = g_stats;
+    critical_exit(state);
+}
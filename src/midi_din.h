@@ -0,0 +1,53 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_DIN_H_
+#define MIDI_DIN_H_
+
+/* 5-pin DIN MIDI port on UART1 at 31250 baud. It is the external jack pair of
+ * the DIN cable (USB_MIDI_CABLE_DIN). What it sends and receives is routed
+ * by midi_router, by default packets the host sends on that cable go out of
+ * the DIN port and everything received on the DIN port is sent to the host
+ * on it.
+ *
+ * Output uses running status (a channel voice message with the same status
+ * byte as the previous one is sent without it), which saves a third of the
+ * wire time of a stream of note-ons. The bytes are moved to the UART by
+ * GPDMA straight out of the transmit ring. Input is collected into a ring by
+ * the receive interrupt and turned into USB-MIDI event packets by a
+ * scheduler task. */
+
+struct midi_din_stats_s
+{
+    unsigned long   tx_bytes;       /* Bytes queued for transmission */
+    unsigned long   tx_saved;       /* Status bytes left out by running status */
+    unsigned long   tx_dropped;     /* Packets which did not fit in the ring */
+    unsigned long   rx_bytes;
+    unsigned long   rx_errors;      /* Framing, parity or UART overrun */
+    unsigned long   rx_dropped;     /* Bytes which did not fit in the ring */
+};
+
+void    midi_din_init(void);
+
+/* Queue the MIDI message bytes of a USB-MIDI event packet (the cable number
+ * is ignored) for transmission. Returns zero if it did not fit. May be called
+ * from any interrupt priority. */
+int     midi_din_send(unsigned long packet);
+
+void    midi_din_get_stats(struct midi_din_stats_s *stats);
+
+#endif /* MIDI_DIN_H_ */
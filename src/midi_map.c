@@ -0,0 +1,114 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_map.h"
+#include "usb_midi.h"
+
+union midi_map_word_u
+{
+    unsigned long           word;
+    struct midi_map_entry_s entry;
+};
+
+static unsigned long                    g_tables[2][MIDI_MAP_MAX_INPUTS];
+static const unsigned long * volatile   g_active_table;
+
+void
+midi_map_init
+    (void
+    )
+{
+    unsigned i;
+    for (i = 0; i < MIDI_MAP_MAX_INPUTS; i++)
+    {
+        union midi_map_word_u e;
+        e.entry.cable   = 0;
+        e.entry.status  = (36 + i < 128) ? 0x90 : 0x00;
+        e.entry.data1   = (36 + i) & 0x7f;
+        e.entry.flags   = 0;
+        g_tables[0][i]  = e.word;
+    }
+    g_active_table = g_tables[0];
+}
+
+unsigned char *
+midi_map_get_staging
+    (void
+    )
+{
+    return (unsigned char *)((g_active_table == g_tables[0]) ? g_tables[1] : g_tables[0]);
+}
+
+void
+midi_map_commit
+    (unsigned nb_entries
+    )
+{
+    unsigned long *staging = (unsigned long *)midi_map_get_staging();
+    for (; nb_entries < MIDI_MAP_MAX_INPUTS; nb_entries++)
+    {
+        staging[nb_entries] = 0;
+    }
+    g_active_table = staging;
+}
+
+void
+midi_map_use_table
+    (const void *table
+    )
+{
+    g_active_table = (const unsigned long *)table;
+}
+
+const void *
+midi_map_get_table
+    (void
+    )
+{
+    return g_active_table;
+}
+
+struct midi_map_entry_s
+midi_map_lookup
+    (unsigned input
+    )
+{
+    union midi_map_word_u e;
+    e.word = (input < MIDI_MAP_MAX_INPUTS) ? g_active_table[input] : 0;
+    return e.entry;
+}
+
+unsigned long
+midi_map_input_event
+    (unsigned   input
+    ,int        active
+    )
+{
+    const struct midi_map_entry_s e = midi_map_lookup(input);
+    unsigned status = e.status;
+    if (!status)
+    {
+        return 0;
+    }
+    if ((status & 0xf0) == 0x90)
+    {
+        return (active)
+            ? USB_MIDI_PACKET(e.cable, status, e.data1, 0x7f)
+            : USB_MIDI_PACKET(e.cable, 0x80 | (status & 0x0f), e.data1, 0x40);
+    }
+    return USB_MIDI_PACKET(e.cable, status, e.data1, (active) ? 0x7f : 0x00);
+}
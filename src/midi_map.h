@@ -0,0 +1,67 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_MAP_H_
+#define MIDI_MAP_H_
+
+/* Maximum number of conbus inputs which can be given a mapping. */
+#define MIDI_MAP_MAX_INPUTS     (512)
+
+/* Size in bytes of a complete mapping table. */
+#define MIDI_MAP_TABLE_SIZE     (4 * MIDI_MAP_MAX_INPUTS)
+
+/* A mapping entry is exactly one 32-bit word so that it can be fetched with a
+ * single load while a new table is being committed. */
+struct midi_map_entry_s
+{
+    unsigned char   cable;  /* USB-MIDI virtual cable number (0-15) */
+    unsigned char   status; /* Status byte sent when the input becomes active
+                             * (0x9n = note, 0xBn = controller, 0 = unmapped) */
+    unsigned char   data1;  /* Note or controller number */
+    unsigned char   flags;  /* Reserved - must be zero */
+};
+
+/* Install the default mapping (inputs mapped to consecutive notes on channel
+ * 1 starting at C2). */
+void                            midi_map_init(void);
+
+/* Returns the staging table which may be filled with up to
+ * MIDI_MAP_MAX_INPUTS entries. The staging table is never the one in use. */
+unsigned char                  *midi_map_get_staging(void);
+
+/* Make the first nb_entries of the staging table live. The remaining entries
+ * are unmapped. The switch is a single pointer store so events generated
+ * while the commit happens use either the old or the new table, never a mix
+ * of both. */
+void                            midi_map_commit(unsigned nb_entries);
+
+/* Use a complete table of MIDI_MAP_TABLE_SIZE bytes stored elsewhere (the
+ * configuration store in flash) as the live table without copying it. The
+ * table must stay valid until the next commit. */
+void                            midi_map_use_table(const void *table);
+
+/* Returns the live table (MIDI_MAP_TABLE_SIZE bytes). */
+const void                     *midi_map_get_table(void);
+
+/* Returns the mapping for the given conbus input. */
+struct midi_map_entry_s         midi_map_lookup(unsigned input);
+
+/* Returns the USB-MIDI event packet to send when the given conbus input
+ * becomes active or inactive or zero if the input is not mapped. */
+unsigned long                   midi_map_input_event(unsigned input, int active);
+
+#endif /* MIDI_MAP_H_ */
@@ -0,0 +1,371 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_out.h"
+#include "usb_midi.h"
+#include "critical.h"
+#include "trace.h"
+
+/* Queue lengths in packets. Must be powers of two. */
+#define NOTE_OFF_QUEUE_LEN      (128)
+#define NOTE_ON_QUEUE_LEN       (128)
+#define CONTROL_QUEUE_LEN       (64)
+#define SYSEX_QUEUE_LEN         (64)
+
+/* Bits of a packet which identify the key of a note message (cable, channel
+ * and note number) and the target of a controller message (cable, status
+ * and controller number). */
+#define NOTE_KEY_MASK           (0x007f0ff0ul)
+#define CONTROL_KEY_MASK        (0x007ffff0ul)
+#define BEND_KEY_MASK           (0x0000fff0ul)
+
+struct queue_s
+{
+    unsigned long  *buf;
+    unsigned char  *source; /* who posted each entry */
+    unsigned        mask;
+    unsigned        head; /* write position (free running) */
+    unsigned        tail; /* read position (free running) */
+};
+
+static unsigned long    g_note_off_buf[NOTE_OFF_QUEUE_LEN];
+static unsigned long    g_note_on_buf[NOTE_ON_QUEUE_LEN];
+static unsigned long    g_control_buf[CONTROL_QUEUE_LEN];
+static unsigned long    g_sysex_buf[SYSEX_QUEUE_LEN];
+static unsigned char    g_note_off_source[NOTE_OFF_QUEUE_LEN];
+static unsigned char    g_note_on_source[NOTE_ON_QUEUE_LEN];
+static unsigned char    g_control_source[CONTROL_QUEUE_LEN];
+static unsigned char    g_sysex_source[SYSEX_QUEUE_LEN];
+
+static struct queue_s   g_queues[MIDI_OUT_NB_CLASSES] =
+    {   {g_note_off_buf, g_note_off_source, NOTE_OFF_QUEUE_LEN - 1, 0, 0}
+    ,   {g_note_on_buf,  g_note_on_source,  NOTE_ON_QUEUE_LEN - 1,  0, 0}
+    ,   {g_control_buf,  g_control_source,  CONTROL_QUEUE_LEN - 1,  0, 0}
+    ,   {g_sysex_buf,    g_sysex_source,    SYSEX_QUEUE_LEN - 1,    0, 0}
+    };
+
+/* Channels which need an all-notes-off because a note-off did not fit. One
+ * bit per channel for every cable. */
+static unsigned short           g_all_notes_off[16];
+static unsigned                 g_all_notes_off_pending;
+static int                      g_sysex_in_progress;
+static struct midi_out_stats_s  g_stats;
+
+static
+unsigned
+midi_out_classify
+    (unsigned long packet
+    )
+{
+    switch (USB_MIDI_PACKET_CIN(packet))
+    {
+    case 0x8:
+        return MIDI_OUT_CLASS_NOTE_OFF;
+    case 0x9:
+        return (USB_MIDI_PACKET_DATA2(packet) == 0) ? MIDI_OUT_CLASS_NOTE_OFF : MIDI_OUT_CLASS_NOTE_ON;
+    case 0xb:
+        /* All sound off, all notes off and the mode changes which imply
+         * all notes off */
+        return ((USB_MIDI_PACKET_DATA1(packet) == 120) || (USB_MIDI_PACKET_DATA1(packet) >= 123))
+            ? MIDI_OUT_CLASS_NOTE_OFF
+            : MIDI_OUT_CLASS_CONTROL;
+    case 0x4:
+    case 0x5:
+    case 0x6:
+    case 0x7:
+        return MIDI_OUT_CLASS_SYSEX;
+    default:
+        return MIDI_OUT_CLASS_CONTROL;
+    }
+}
+
+static
+int
+queue_push
+    (struct queue_s    *q
+    ,unsigned           source
+    ,unsigned long      packet
+    ,unsigned          *high_water
+    )
+{
+    const unsigned depth = q->head - q->tail;
+    if (depth > q->mask)
+    {
+        return 0;
+    }
+    q->source[q->head & q->mask]    = (unsigned char)source;
+    q->buf[q->head++ & q->mask]     = packet;
+    if (depth + 1 > *high_water)
+    {
+        *high_water = depth + 1;
+    }
+    return 1;
+}
+
+static
+unsigned long
+queue_pop
+    (struct queue_s    *q
+    )
+{
+    while (q->tail != q->head)
+    {
+        /* Entries which have been cancelled are zero */
+        const unsigned long packet = q->buf[q->tail++ & q->mask];
+        if (packet)
+        {
+            return packet;
+        }
+    }
+    return 0;
+}
+
+static
+unsigned long *
+queue_find
+    (struct queue_s    *q
+    ,unsigned long      packet
+    ,unsigned long      key_mask
+    )
+{
+    unsigned i;
+    for (i = q->tail; i != q->head; i++)
+    {
+        unsigned long *entry = &(q->buf[i & q->mask]);
+        if ((*entry) && (((*entry ^ packet) & key_mask) == 0))
+        {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+int
+midi_out_post
+    (unsigned       source
+    ,unsigned long  packet
+    )
+{
+    const unsigned  cls     = midi_out_classify(packet);
+    struct queue_s *q       = &(g_queues[cls]);
+    int             queued  = 1;
+    unsigned long  *entry;
+    unsigned long   state   = critical_enter();
+    g_stats.posted[cls]++;
+    switch (cls)
+    {
+    case MIDI_OUT_CLASS_NOTE_OFF:
+        if  (   (USB_MIDI_PACKET_CIN(packet) != 0xb)
+            &&  ((entry = queue_find(&(g_queues[MIDI_OUT_CLASS_NOTE_ON]), packet, NOTE_KEY_MASK)) != 0)
+            )
+        {
+            /* The note never got to the host - forget about both */
+            *entry = 0;
+            g_stats.merged++;
+        }
+        else if (!queue_push(q, source, packet, &(g_stats.high_water[cls])))
+        {
+            g_all_notes_off[USB_MIDI_PACKET_CABLE(packet)] |= 1u << (USB_MIDI_PACKET_STATUS(packet) & 0xf);
+            g_all_notes_off_pending = 1;
+            g_stats.all_notes_off++;
+        }
+        break;
+    case MIDI_OUT_CLASS_NOTE_ON:
+        if (queue_find(q, packet, NOTE_KEY_MASK))
+        {
+            g_stats.merged++;
+        }
+        else if (!queue_push(q, source, packet, &(g_stats.high_water[cls])))
+        {
+            g_stats.dropped[cls]++;
+            queued = 0;
+        }
+        break;
+    default:
+        entry = 0;
+        if (USB_MIDI_PACKET_CIN(packet) == 0xb)
+        {
+            entry = queue_find(q, packet, CONTROL_KEY_MASK);
+        }
+        else if (USB_MIDI_PACKET_CIN(packet) == 0xe)
+        {
+            entry = queue_find(q, packet, BEND_KEY_MASK);
+        }
+        if (entry)
+        {
+            *entry                      = packet;
+            q->source[entry - q->buf]   = (unsigned char)source;
+            g_stats.merged++;
+        }
+        else if (!queue_push(q, source, packet, &(g_stats.high_water[cls])))
+        {
+            g_stats.dropped[cls]++;
+            queued = 0;
+        }
+        break;
+    }
+    critical_exit(state);
+    if (!queued)
+    {
+        TRACE(TRACE_EVENT_MIDI_DROPPED, cls, packet);
+    }
+    return queued;
+}
+
+int
+midi_out_post_sysex
+    (unsigned               source
+    ,const unsigned long   *packets
+    ,unsigned               nb_packets
+    )
+{
+    struct queue_s *q       = &(g_queues[MIDI_OUT_CLASS_SYSEX]);
+    int             queued  = 0;
+    unsigned long   state   = critical_enter();
+    g_stats.posted[MIDI_OUT_CLASS_SYSEX]++;
+    if (q->mask + 1 - (q->head - q->tail) >= nb_packets)
+    {
+        while (nb_packets--)
+        {
+            (void)queue_push(q, source, *packets++, &(g_stats.high_water[MIDI_OUT_CLASS_SYSEX]));
+        }
+        queued = 1;
+    }
+    else
+    {
+        g_stats.dropped[MIDI_OUT_CLASS_SYSEX]++;
+    }
+    critical_exit(state);
+    return queued;
+}
+
+static
+unsigned long
+midi_out_take_all_notes_off
+    (void
+    )
+{
+    unsigned cable;
+    for (cable = 0; cable < 16; cable++)
+    {
+        const unsigned channels = g_all_notes_off[cable];
+        if (channels)
+        {
+            unsigned channel = 0;
+            while (!(channels & (1u << channel)))
+            {
+                channel++;
+            }
+            g_all_notes_off[cable] = channels & ~(1u << channel);
+            return USB_MIDI_PACKET(cable, 0xb0 | channel, 123, 0);
+        }
+    }
+    g_all_notes_off_pending = 0;
+    return 0;
+}
+
+unsigned
+midi_out_read
+    (unsigned long     *packets
+    ,unsigned           max_packets
+    )
+{
+    unsigned        nb_packets  = 0;
+    unsigned long   state       = critical_enter();
+    while (nb_packets < max_packets)
+    {
+        unsigned long packet = 0;
+        if (g_sysex_in_progress)
+        {
+            /* Never interleave anything with the rest of a SysEx message */
+            packet = queue_pop(&(g_queues[MIDI_OUT_CLASS_SYSEX]));
+        }
+        else
+        {
+            unsigned cls;
+            if (g_all_notes_off_pending)
+            {
+                packet = midi_out_take_all_notes_off();
+            }
+            for (cls = 0; (!packet) && (cls < MIDI_OUT_NB_CLASSES); cls++)
+            {
+                packet = queue_pop(&(g_queues[cls]));
+            }
+        }
+        if (!packet)
+        {
+            g_sysex_in_progress = 0;
+            break;
+        }
+        g_sysex_in_progress = (USB_MIDI_PACKET_CIN(packet) == 0x4);
+        packets[nb_packets++] = packet;
+    }
+    critical_exit(state);
+    return nb_packets;
+}
+
+void
+midi_out_clear
+    (void
+    )
+{
+    unsigned long   state = critical_enter();
+    unsigned        i;
+    for (i = 0; i < MIDI_OUT_NB_CLASSES; i++)
+    {
+        g_queues[i].tail = g_queues[i].head;
+    }
+    for (i = 0; i < 16; i++)
+    {
+        g_all_notes_off[i] = 0;
+    }
+    g_all_notes_off_pending = 0;
+    g_sysex_in_progress     = 0;
+    critical_exit(state);
+}
+
+void
+midi_out_cancel
+    (unsigned source
+    )
+{
+    unsigned long   state = critical_enter();
+    unsigned        cls;
+    for (cls = 0; cls < MIDI_OUT_CLASS_SYSEX; cls++)
+    {
+        struct queue_s *q = &(g_queues[cls]);
+        unsigned        i;
+        for (i = q->tail; i != q->head; i++)
+        {
+            if (q->source[i & q->mask] == source)
+            {
+                q->buf[i & q->mask] = 0;
+            }
+        }
+    }
+    critical_exit(state);
+}
+
+void
+midi_out_get_stats
+    (struct midi_out_stats_s *stats
+    )
+{
+    unsigned long state = critical_enter();
+    *stats = g_stats;
+    critical_exit(state);
+}
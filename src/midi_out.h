@@ -0,0 +1,76 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_OUT_H_
+#define MIDI_OUT_H_
+
+/* Outgoing MIDI events are queued by priority class. When the host endpoint
+ * is ready, all pending note-offs are sent before any note-on, all note-ons
+ * before any controller or other channel traffic and SysEx last. Every class
+ * has a bounded queue. Under overload events which have been superseded are
+ * merged or dropped rather than sent late:
+ *
+ * - A note-off cancels a queued note-on for the same key (both are dropped)
+ *   as otherwise the note-off would overtake it and leave the note stuck.
+ * - A note-on for a key which already has a queued note-on is dropped.
+ * - A controller or pitch bend change replaces a queued value for the same
+ *   controller.
+ * - If the note-off queue is full, an all-notes-off is sent for the channel
+ *   instead so that a note-off is never lost.
+ *
+ * Every event carries the number of the source which posted it (0-255) so
+ * that one source's events can be withdrawn without touching the others.
+ *
+ * All functions may be called from any interrupt priority. */
+
+#define MIDI_OUT_CLASS_NOTE_OFF     (0) /* note-off, all-notes-off */
+#define MIDI_OUT_CLASS_NOTE_ON      (1)
+#define MIDI_OUT_CLASS_CONTROL      (2) /* everything else (CC, stops...) */
+#define MIDI_OUT_CLASS_SYSEX        (3)
+#define MIDI_OUT_NB_CLASSES         (4)
+
+struct midi_out_stats_s
+{
+    unsigned long   posted[MIDI_OUT_NB_CLASSES];
+    unsigned long   dropped[MIDI_OUT_NB_CLASSES];   /* queue was full */
+    unsigned long   merged;                         /* superseded events */
+    unsigned long   all_notes_off;                  /* note-off overflows */
+    unsigned        high_water[MIDI_OUT_NB_CLASSES];/* max queue depth */
+};
+
+/* Queue a USB-MIDI event packet. Returns zero if it was dropped. */
+int         midi_out_post(unsigned source, unsigned long packet);
+
+/* Queue a complete SysEx message (all of its packets or none of them).
+ * Returns zero if there is not enough space. */
+int         midi_out_post_sysex(unsigned source, const unsigned long *packets, unsigned nb_packets);
+
+/* Take up to max_packets packets in priority order. Returns the number of
+ * packets stored. */
+unsigned    midi_out_read(unsigned long *packets, unsigned max_packets);
+
+/* Discard everything which is queued. */
+void        midi_out_clear(void);
+
+/* Discard the queued events of one source. Its SysEx is left alone so that
+ * a message is never cut short, as are all-notes-off which stand in for
+ * note-offs that did not fit. */
+void        midi_out_cancel(unsigned source);
+
+void        midi_out_get_stats(struct midi_out_stats_s *stats);
+
+#endif /* MIDI_OUT_H_ */
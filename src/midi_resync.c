@@ -0,0 +1,199 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_resync.h"
+#include "midi_map.h"
+#include "midi_router.h"
+#include "usb_midi.h"
+#include "conbus.h"
+#include "sched.h"
+#include "critical.h"
+
+#define PHASE_IDLE              (0)
+#define PHASE_NOTES_OFF         (1) /* pos is cable * 16 + channel */
+#define PHASE_INPUTS            (2) /* pos is the input */
+
+static int                      g_enabled;
+static int                      g_configured;
+static volatile int             g_start;
+static volatile unsigned        g_phase;
+static unsigned                 g_pos;
+static unsigned                 g_dests;            /* yet to take pos */
+static unsigned short           g_note_channels[16]; /* bit per channel */
+
+/* Post the packet to the destinations which have not taken it yet. Returns
+ * zero if one of them is still full, to be tried again at the next frame. */
+static
+int
+midi_resync_post
+    (unsigned long packet
+    )
+{
+    g_dests = midi_router_post_to(MIDI_ROUTER_SRC_CONSOLE, g_dests, packet);
+    if (g_dests)
+    {
+        return 0;
+    }
+    g_dests = ~0u;
+    return 1;
+}
+
+/* Returns the number of inputs which can be replayed. */
+static
+unsigned
+midi_resync_nb_inputs
+    (void
+    )
+{
+    const unsigned nb_inputs = 8 * conbus_get_nb_inputs_div_8();
+    return (nb_inputs < MIDI_MAP_MAX_INPUTS) ? nb_inputs : MIDI_MAP_MAX_INPUTS;
+}
+
+static
+void
+midi_resync_task
+    (void
+    )
+{
+    if (g_start)
+    {
+        unsigned input;
+        g_start = 0;
+        midi_router_cancel(MIDI_ROUTER_SRC_CONSOLE);
+        for (input = 0; input < 16; input++)
+        {
+            g_note_channels[input] = 0;
+        }
+        for (input = 0; input < MIDI_MAP_MAX_INPUTS; input++)
+        {
+            const struct midi_map_entry_s e = midi_map_lookup(input);
+            if ((e.status & 0xf0) == 0x90)
+            {
+                g_note_channels[e.cable & 0xf] |= 1u << (e.status & 0xf);
+            }
+        }
+        g_pos   = 0;
+        g_dests = ~0u;
+        g_phase = PHASE_NOTES_OFF;
+    }
+    if (g_phase == PHASE_NOTES_OFF)
+    {
+        for (; g_pos < 16 * 16; g_pos++)
+        {
+            const unsigned cable    = g_pos >> 4;
+            const unsigned channel  = g_pos & 0xf;
+            if  (   (g_note_channels[cable] & (1u << channel))
+                &&  (!midi_resync_post(USB_MIDI_PACKET(cable, 0xb0 | channel, 123, 0)))
+                )
+            {
+                /* Try again at the next frame */
+                return;
+            }
+        }
+        /* From here on a change flag means the input's own event went out
+         * after the all-notes-off */
+        {
+            const unsigned      nb_inputs = midi_resync_nb_inputs();
+            const unsigned long state     = critical_enter();
+            unsigned            input;
+            for (input = 0; input < nb_inputs; input++)
+            {
+                (void)conbus_test_and_clear_change(input);
+            }
+            critical_exit(state);
+        }
+        g_pos   = 0;
+        g_phase = PHASE_INPUTS;
+    }
+    if (g_phase == PHASE_INPUTS)
+    {
+        const unsigned nb_inputs = midi_resync_nb_inputs();
+        for (; g_pos < nb_inputs; g_pos++)
+        {
+            /* The input is read and its event posted with the debouncing
+             * locked out, so a change is either in the state read here or
+             * posted after the replayed event and never overtaken by it. An
+             * input which changed since the replay of inputs started has
+             * already sent its current state and is skipped. A retry reads
+             * the input again. */
+            const unsigned long state   = critical_enter();
+            const int           changed = conbus_test_and_clear_change(g_pos);
+            const int           active  = conbus_get_input(g_pos);
+            const unsigned long packet  = midi_map_input_event(g_pos, active);
+            int                 posted  = 1;
+            /* Released notes were covered by the all-notes-off */
+            if  (   (packet)
+                &&  (!changed)
+                &&  ((active) || (USB_MIDI_PACKET_CIN(packet) == 0xb))
+                )
+            {
+                posted = midi_resync_post(packet);
+            }
+            else
+            {
+                g_dests = ~0u;
+            }
+            critical_exit(state);
+            if (!posted)
+            {
+                return;
+            }
+        }
+        g_phase = PHASE_IDLE;
+    }
+}
+
+void
+midi_resync_init
+    (int enabled
+    )
+{
+    g_enabled = enabled;
+    sched_register(SCHED_TASK_RESYNC, midi_resync_task);
+}
+
+void
+midi_resync_set_enabled
+    (int enabled
+    )
+{
+    g_enabled = enabled;
+}
+
+int
+midi_resync_get_enabled
+    (void
+    )
+{
+    return g_enabled;
+}
+
+void
+midi_resync_frame
+    (int configured
+    )
+{
+    if ((configured) && (!g_configured) && (g_enabled))
+    {
+        g_start = 1;
+    }
+    g_configured = configured;
+    if ((g_start) || (g_phase != PHASE_IDLE))
+    {
+        sched_post(SCHED_TASK_RESYNC);
+    }
+}
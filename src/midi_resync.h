@@ -0,0 +1,50 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_RESYNC_H_
+#define MIDI_RESYNC_H_
+
+/* Optional replay of the console state after the host has (re)configured the
+ * device, so that host software which restarted or lost events while the
+ * bus was down ends up agreeing with the console:
+ *
+ * - Console events still queued from before are discarded; the other
+ *   sources are left alone.
+ * - Every cable and channel which has notes mapped to it gets one
+ *   all-notes-off (controller 123) instead of a note-off per key.
+ * - Every input which is active gets its note-on and every input mapped to
+ *   a controller gets its current value, unless the input changed after
+ *   the all-notes-off were sent and its own event already carried the
+ *   state. An input changing while the all-notes-off are being sent is
+ *   replayed, so a held key may then get its note-on twice rather than
+ *   lose it to an all-notes-off sent after it.
+ *
+ * The events go to the console's midi_router destinations. A replay which
+ * does not fit in the queues continues at the next USB frame. */
+
+/* Register the replay task. */
+void    midi_resync_init(int enabled);
+
+/* Turn the replay on or off. */
+void    midi_resync_set_enabled(int enabled);
+int     midi_resync_get_enabled(void);
+
+/* Called from the USB frame interrupt. configured is non-zero while the
+ * device is configured; a replay starts when it becomes configured. */
+void    midi_resync_frame(int configured);
+
+#endif /* MIDI_RESYNC_H_ */
@@ -0,0 +1,358 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_router.h"
+#include "midi_out.h"
+#include "midi_din.h"
+#include "usb_midi.h"
+#include "critical.h"
+#include "debughlprs.h"
+
+#define NO_OWNER                    (MIDI_ROUTER_NB_SOURCES)
+
+/* SysEx only has to stay whole within one stream. Every USB-MIDI cable is a
+ * stream of its own to the host while the DIN output is a single one, so the
+ * host destination has a SysEx lock per cable and DIN has one. */
+#define NB_LOCKS                    (16)
+
+/* What a packet does to SysEx framing */
+#define PACKET_MESSAGE              (0) /* a complete message */
+#define PACKET_SYSEX                (1) /* starts or continues SysEx */
+#define PACKET_SYSEX_END            (2)
+#define PACKET_REAL_TIME            (3)
+
+struct route_queue_s
+{
+    unsigned long   buf[MIDI_ROUTER_QUEUE_LEN];
+    unsigned        head; /* write position (free running) */
+    unsigned        tail; /* read position (free running) */
+};
+
+static struct route_queue_s         g_queues[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS];
+static unsigned                     g_routes[MIDI_ROUTER_NB_SOURCES];
+static unsigned                     g_owner[MIDI_ROUTER_NB_DESTS][NB_LOCKS];  /* source in SysEx */
+static unsigned                     g_idle[MIDI_ROUTER_NB_DESTS][NB_LOCKS];   /* frames since the
+                                                                               * owner's last packet */
+static unsigned                     g_locked[MIDI_ROUTER_NB_DESTS];           /* locks with an owner */
+static unsigned                     g_next[MIDI_ROUTER_NB_DESTS];             /* drained first */
+static unsigned                     g_waiting[MIDI_ROUTER_NB_DESTS];          /* queued packets */
+static struct midi_router_stats_s   g_stats;
+
+static
+unsigned
+midi_router_classify
+    (unsigned long packet
+    )
+{
+    switch (USB_MIDI_PACKET_CIN(packet))
+    {
+    case 0x4:
+        return PACKET_SYSEX;
+    case 0x5:
+        /* Single byte: end of SysEx or tune request */
+        return (USB_MIDI_PACKET_STATUS(packet) == 0xf7) ? PACKET_SYSEX_END : PACKET_MESSAGE;
+    case 0x6:
+    case 0x7:
+        return PACKET_SYSEX_END;
+    case 0xf:
+        return (USB_MIDI_PACKET_STATUS(packet) >= 0xf8) ? PACKET_REAL_TIME : PACKET_MESSAGE;
+    default:
+        return PACKET_MESSAGE;
+    }
+}
+
+static
+unsigned
+midi_router_lock
+    (unsigned       dest
+    ,unsigned long  packet
+    )
+{
+    return (dest == MIDI_ROUTER_DST_HOST) ? USB_MIDI_PACKET_CABLE(packet) : 0;
+}
+
+/* Non-zero if the packet from the source does not have to wait for another
+ * source's SysEx. Called with interrupts disabled. */
+static
+int
+midi_router_may_forward
+    (unsigned       source
+    ,unsigned       dest
+    ,unsigned long  packet
+    )
+{
+    const unsigned owner = g_owner[dest][midi_router_lock(dest, packet)];
+    return (owner == NO_OWNER) || (owner == source);
+}
+
+/* Called with interrupts disabled. */
+static
+void
+midi_router_release
+    (unsigned dest
+    ,unsigned lock
+    )
+{
+    g_next[dest]            = (g_owner[dest][lock] + 1) % MIDI_ROUTER_NB_SOURCES;
+    g_owner[dest][lock]     = NO_OWNER;
+    g_locked[dest]--;
+}
+
+/* Hand a packet to a destination. Returns zero if the destination dropped
+ * it. Called with interrupts disabled. */
+static
+int
+midi_router_forward
+    (unsigned       source
+    ,unsigned       dest
+    ,unsigned long  packet
+    )
+{
+    const unsigned lock = midi_router_lock(dest, packet);
+    int delivered;
+    switch (midi_router_classify(packet))
+    {
+    case PACKET_SYSEX:
+        if (g_owner[dest][lock] == NO_OWNER)
+        {
+            g_owner[dest][lock] = source;
+            g_locked[dest]++;
+        }
+        g_idle[dest][lock] = 0;
+        break;
+    case PACKET_REAL_TIME:
+        break;
+    default:
+        /* Anything else from the owner on the same stream ends its SysEx,
+         * even if it was not terminated, so a source can never lock out the
+         * others. */
+        if (g_owner[dest][lock] == source)
+        {
+            midi_router_release(dest, lock);
+        }
+        break;
+    }
+    switch (dest)
+    {
+    case MIDI_ROUTER_DST_HOST:
+        delivered = midi_out_post(source, packet);
+        break;
+    default:
+        ASSERT(dest == MIDI_ROUTER_DST_DIN);
+        delivered = midi_din_send(packet);
+        break;
+    }
+    if (delivered)
+    {
+        g_stats.forwarded[source][dest]++;
+    }
+    else
+    {
+        g_stats.dropped[source][dest]++;
+    }
+    return delivered;
+}
+
+/* Deliver whatever has been held for a destination and may go now, one
+ * source after the other starting after the last one which completed a
+ * SysEx. A source whose next packet waits for another's SysEx is passed
+ * over. Called with interrupts disabled. */
+static
+void
+midi_router_drain
+    (unsigned dest
+    )
+{
+    unsigned i = 0;
+    while ((g_waiting[dest]) && (i < MIDI_ROUTER_NB_SOURCES))
+    {
+        const unsigned          source  = (g_next[dest] + i) % MIDI_ROUTER_NB_SOURCES;
+        struct route_queue_s   *q       = &(g_queues[source][dest]);
+        if  (   (q->head != q->tail)
+            &&  (midi_router_may_forward(source, dest, q->buf[q->tail & (MIDI_ROUTER_QUEUE_LEN - 1)]))
+            )
+        {
+            g_waiting[dest]--;
+            (void)midi_router_forward(source, dest, q->buf[q->tail++ & (MIDI_ROUTER_QUEUE_LEN - 1)]);
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void
+midi_router_init
+    (void
+    )
+{
+    unsigned dest;
+    g_routes[MIDI_ROUTER_SRC_CONSOLE]   = MIDI_ROUTE(HOST);
+    g_routes[MIDI_ROUTER_SRC_HOST]      = MIDI_ROUTE(DIN);
+    g_routes[MIDI_ROUTER_SRC_DIN]       = MIDI_ROUTE(HOST);
+    for (dest = 0; dest < MIDI_ROUTER_NB_DESTS; dest++)
+    {
+        unsigned lock;
+        for (lock = 0; lock < NB_LOCKS; lock++)
+        {
+            g_owner[dest][lock] = NO_OWNER;
+        }
+    }
+}
+
+void
+midi_router_set_routes
+    (unsigned source
+    ,unsigned dests
+    )
+{
+    ASSERT(source < MIDI_ROUTER_NB_SOURCES);
+    g_routes[source] = dests & ((1u << MIDI_ROUTER_NB_DESTS) - 1);
+}
+
+unsigned
+midi_router_get_routes
+    (unsigned source
+    )
+{
+    ASSERT(source < MIDI_ROUTER_NB_SOURCES);
+    return g_routes[source];
+}
+
+int
+midi_router_post
+    (unsigned       source
+    ,unsigned long  packet
+    )
+{
+    return midi_router_post_to(source, ~0u, packet) == 0;
+}
+
+unsigned
+midi_router_post_to
+    (unsigned       source
+    ,unsigned       dests
+    ,unsigned long  packet
+    )
+{
+    const int       real_time   = (midi_router_classify(packet) == PACKET_REAL_TIME);
+    unsigned        failed      = 0;
+    unsigned        dest;
+    unsigned long   state;
+    ASSERT(source < MIDI_ROUTER_NB_SOURCES);
+    state = critical_enter();
+    for (dest = 0; dest < MIDI_ROUTER_NB_DESTS; dest++)
+    {
+        struct route_queue_s   *q      = &(g_queues[source][dest]);
+        const unsigned          depth  = q->head - q->tail;
+        if (!(g_routes[source] & dests & (1u << dest)))
+        {
+            /* Nothing new, but still deliver what was held before the route
+             * was removed */
+        }
+        else if ((real_time) || ((!depth) && (midi_router_may_forward(source, dest, packet))))
+        {
+            if (!midi_router_forward(source, dest, packet))
+            {
+                failed |= 1u << dest;
+            }
+        }
+        else if (depth < MIDI_ROUTER_QUEUE_LEN)
+        {
+            q->buf[q->head++ & (MIDI_ROUTER_QUEUE_LEN - 1)] = packet;
+            g_waiting[dest]++;
+            g_stats.held[source][dest]++;
+            if (depth + 1 > g_stats.high_water[source][dest])
+            {
+                g_stats.high_water[source][dest] = depth + 1;
+            }
+        }
+        else
+        {
+            g_stats.dropped[source][dest]++;
+            failed |= 1u << dest;
+        }
+        midi_router_drain(dest);
+    }
+    critical_exit(state);
+    return failed;
+}
+
+void
+midi_router_cancel
+    (unsigned source
+    )
+{
+    unsigned long   state;
+    unsigned        dest;
+    ASSERT(source < MIDI_ROUTER_NB_SOURCES);
+    state = critical_enter();
+    for (dest = 0; dest < MIDI_ROUTER_NB_DESTS; dest++)
+    {
+        struct route_queue_s   *q = &(g_queues[source][dest]);
+        unsigned                lock;
+        g_waiting[dest] -= q->head - q->tail;
+        q->tail          = q->head;
+        for (lock = 0; lock < NB_LOCKS; lock++)
+        {
+            if (g_owner[dest][lock] == source)
+            {
+                midi_router_release(dest, lock);
+            }
+        }
+        midi_router_drain(dest);
+    }
+    midi_out_cancel(source);
+    critical_exit(state);
+}
+
+void
+midi_router_frame
+    (void
+    )
+{
+    const unsigned long state = critical_enter();
+    unsigned dest;
+    for (dest = 0; dest < MIDI_ROUTER_NB_DESTS; dest++)
+    {
+        unsigned lock;
+        for (lock = 0; (g_locked[dest]) && (lock < NB_LOCKS); lock++)
+        {
+            if  (   (g_owner[dest][lock] != NO_OWNER)
+                &&  (++g_idle[dest][lock] > MIDI_ROUTER_SYSEX_TIMEOUT)
+                )
+            {
+                g_stats.abandoned[g_owner[dest][lock]][dest]++;
+                midi_router_release(dest, lock);
+                midi_router_drain(dest);
+            }
+        }
+    }
+    critical_exit(state);
+}
+
+void
+midi_router_get_stats
+    (struct midi_router_stats_s *stats
+    )
+{
+    const unsigned long state = critical_enter();
+    *stats = g_stats;
+    critical_exit(state);
+}
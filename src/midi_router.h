@@ -0,0 +1,104 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_ROUTER_H_
+#define MIDI_ROUTER_H_
+
+/* Merges the MIDI streams of every source into the destinations it is routed
+ * to. A packet is handed to its destinations (midi_out for the host,
+ * midi_din for the DIN port) as soon as it is posted, the only exception
+ * being a stream which is in the middle of a SysEx message from another
+ * source: packets for it then wait in the queue of their route (one per
+ * source and destination pair) until the message has ended, so SysEx is
+ * never interleaved. Each cable is a stream of its own to the host, the DIN
+ * output is one stream. A SysEx which stalls for MIDI_ROUTER_SYSEX_TIMEOUT
+ * frames is abandoned. Real time messages are never held.
+ *
+ * All functions may be called from any interrupt priority. */
+
+#define MIDI_ROUTER_SOURCES(SOURCE) \
+    SOURCE(CONSOLE)     /* conbus inputs and expression pedals */ \
+    SOURCE(HOST)        /* packets from the host on the DIN cable */ \
+    SOURCE(DIN)         /* DIN MIDI input */
+
+#define MIDI_ROUTER_DESTS(DEST) \
+    DEST(HOST)          /* USB-MIDI IN endpoint */ \
+    DEST(DIN)           /* DIN MIDI output */
+
+#define MIDI_ROUTER_SRC_ENUM_(name) MIDI_ROUTER_SRC_##name,
+enum midi_router_source_e
+{
+    MIDI_ROUTER_SOURCES(MIDI_ROUTER_SRC_ENUM_)
+    MIDI_ROUTER_NB_SOURCES
+};
+
+#define MIDI_ROUTER_DST_ENUM_(name) MIDI_ROUTER_DST_##name,
+enum midi_router_dest_e
+{
+    MIDI_ROUTER_DESTS(MIDI_ROUTER_DST_ENUM_)
+    MIDI_ROUTER_NB_DESTS
+};
+
+/* Bit of a destination in a route mask */
+#define MIDI_ROUTE(dest)            (1u << MIDI_ROUTER_DST_##dest)
+
+/* Packets a route can hold. Must be a power of two. */
+#define MIDI_ROUTER_QUEUE_LEN       (64)
+
+/* USB frames (milliseconds) a SysEx may go without a packet before its
+ * stream is given to the other sources. A DIN sender takes 0.32 ms a byte. */
+#define MIDI_ROUTER_SYSEX_TIMEOUT   (200)
+
+/* Returned by USB_MIDI_REQ_ROUTER. Every counter is 32-bit little endian and
+ * indexed [source][destination]. */
+struct midi_router_stats_s
+{
+    unsigned long   forwarded[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS];
+    unsigned long   held[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS];       /* waited for another SysEx */
+    unsigned long   dropped[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS];    /* route queue or destination full */
+    unsigned long   high_water[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS]; /* deepest route queue */
+    unsigned long   abandoned[MIDI_ROUTER_NB_SOURCES][MIDI_ROUTER_NB_DESTS];  /* SysEx timed out */
+};
+
+/* Route every source to its defaults: console and DIN input to the host,
+ * host to the DIN output. */
+void        midi_router_init(void);
+
+/* Set the destinations of a source as a combination of MIDI_ROUTE() bits.
+ * Packets still queued on a route which is removed are delivered. */
+void        midi_router_set_routes(unsigned source, unsigned dests);
+unsigned    midi_router_get_routes(unsigned source);
+
+/* Send a USB-MIDI event packet from a source to all of its destinations.
+ * Returns zero if it was dropped for any of them. */
+int         midi_router_post(unsigned source, unsigned long packet);
+
+/* Send a packet from a source to those of its destinations which are in
+ * dests (MIDI_ROUTE() bits). Returns the destinations which dropped it, so
+ * that a retry does not repeat it to the others. */
+unsigned    midi_router_post_to(unsigned source, unsigned dests, unsigned long packet);
+
+/* Withdraw what a source has posted and is still held or queued for the
+ * host. What was already handed to the DIN output is sent. */
+void        midi_router_cancel(unsigned source);
+
+/* Called on every USB start of frame to time out stalled SysEx. */
+void        midi_router_frame(void);
+
+void        midi_router_get_stats(struct midi_router_stats_s *stats);
+
+#endif /* MIDI_ROUTER_H_ */
@@ -0,0 +1,262 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "midi_sysex.h"
+#include "midi_map.h"
+#include "crc.h"
+#include "config_store.h"
+#include "midi_router.h"
+#include "stop_action.h"
+
+/* Number of bytes following the F0 up to the first data byte. */
+#define SYSEX_HEADER_LEN        (8)
+
+#define RX_STATE_IDLE           (0) /* Waiting for F0 */
+#define RX_STATE_HEADER         (1) /* Collecting the header */
+#define RX_STATE_DATA           (2) /* Decoding data into the staging area */
+#define RX_STATE_DISCARD        (3) /* Ignoring everything up to the F7 */
+
+static struct
+{
+    unsigned                    state;
+    unsigned                    cable;
+    unsigned char               header[SYSEX_HEADER_LEN];
+    unsigned                    header_len;
+    unsigned char              *dst;
+    unsigned char              *dst_end;
+    unsigned                    group_pos;
+    unsigned                    msbs;
+    unsigned                    crc;
+    unsigned                    expected_crc;
+    unsigned                    nb_entries;
+} g_rx;
+
+static struct midi_sysex_stats_s g_stats;
+
+/* Record saved by SYSEX_CMD_SET_ROUTES */
+static unsigned char g_routes[MIDI_ROUTER_NB_SOURCES];
+
+static
+void
+midi_sysex_begin_data
+    (void
+    )
+{
+    const unsigned char *h = g_rx.header;
+    g_rx.state = RX_STATE_DISCARD;
+    if ((h[0] != SYSEX_MANUFACTURER_ID) || (h[1] != SYSEX_DEVICE_ID))
+    {
+        /* Not for us. */
+        return;
+    }
+    if ((h[2] == SYSEX_CMD_LOAD_MAP) || (h[2] == SYSEX_CMD_PULSE))
+    {
+        g_rx.nb_entries     = h[3] | ((unsigned)h[4] << 7);
+        g_rx.expected_crc   = h[5] | ((unsigned)h[6] << 7) | ((unsigned)h[7] << 14);
+        g_rx.dst            = 0;
+        if (h[2] == SYSEX_CMD_PULSE)
+        {
+            if (g_rx.nb_entries <= STOP_ACTION_QUEUE_SIZE)
+            {
+                g_rx.dst    = stop_action_get_staging();
+            }
+        }
+        /* The live table can not be replaced while it is being saved as
+         * the staging table would be the one being saved next. */
+        else if ((g_rx.nb_entries <= MIDI_MAP_MAX_INPUTS) && (!config_store_busy()))
+        {
+            g_rx.dst        = midi_map_get_staging();
+        }
+        if (g_rx.dst)
+        {
+            g_rx.dst_end    = g_rx.dst + 4 * g_rx.nb_entries;
+            g_rx.group_pos  = 0;
+            g_rx.crc        = CRC16_INIT;
+            g_rx.state      = RX_STATE_DATA;
+            return;
+        }
+    }
+    else if (h[2] == SYSEX_CMD_SET_ROUTES)
+    {
+        if ((h[3] < MIDI_ROUTER_NB_SOURCES) && (!config_store_busy()))
+        {
+            unsigned source;
+            midi_router_set_routes(h[3], h[4]);
+            for (source = 0; source < MIDI_ROUTER_NB_SOURCES; source++)
+            {
+                g_routes[source] = midi_router_get_routes(source);
+            }
+            if (config_store_write(CONFIG_TAG_ROUTES, g_routes, sizeof(g_routes)))
+            {
+                g_stats.unsaved++;
+            }
+            else
+            {
+                g_stats.completed++;
+            }
+            return;
+        }
+    }
+    g_stats.rejected++;
+}
+
+static
+void
+midi_sysex_end
+    (void
+    )
+{
+    if (g_rx.state == RX_STATE_DATA)
+    {
+        if ((g_rx.dst != g_rx.dst_end) || (g_rx.crc != g_rx.expected_crc))
+        {
+            g_stats.rejected++;
+        }
+        else if (g_rx.header[2] == SYSEX_CMD_PULSE)
+        {
+            if (stop_action_commit(g_rx.nb_entries))
+            {
+                g_stats.completed++;
+            }
+            else
+            {
+                g_stats.rejected++;
+            }
+        }
+        else
+        {
+            midi_map_commit(g_rx.nb_entries);
+            if (config_store_write(CONFIG_TAG_MIDI_MAP, midi_map_get_table(), MIDI_MAP_TABLE_SIZE))
+            {
+                g_stats.unsaved++;
+            }
+            else
+            {
+                g_stats.completed++;
+            }
+        }
+    }
+    g_rx.state = RX_STATE_IDLE;
+}
+
+static
+void
+midi_sysex_rx_byte
+    (unsigned b
+    )
+{
+    if (b & 0x80)
+    {
+        if (b == 0xf0)
+        {
+            if (g_rx.state == RX_STATE_DATA)
+            {
+                /* Unterminated message */
+                g_stats.rejected++;
+            }
+            g_rx.state      = RX_STATE_HEADER;
+            g_rx.header_len = 0;
+        }
+        else if (b == 0xf7)
+        {
+            midi_sysex_end();
+        }
+        else
+        {
+            if (g_rx.state == RX_STATE_DATA)
+            {
+                g_stats.rejected++;
+            }
+            g_rx.state = RX_STATE_IDLE;
+        }
+    }
+    else if (g_rx.state == RX_STATE_DATA)
+    {
+        if (g_rx.group_pos == 0)
+        {
+            g_rx.msbs = b;
+        }
+        else if (g_rx.dst != g_rx.dst_end)
+        {
+            b               |= ((g_rx.msbs >> (g_rx.group_pos - 1)) & 1) << 7;
+            *g_rx.dst++      = b;
+            g_rx.crc         = crc16_update(g_rx.crc, b);
+        }
+        else
+        {
+            /* More data than announced */
+            g_stats.rejected++;
+            g_rx.state = RX_STATE_DISCARD;
+        }
+        g_rx.group_pos = (g_rx.group_pos + 1) & 7;
+    }
+    else if (g_rx.state == RX_STATE_HEADER)
+    {
+        g_rx.header[g_rx.header_len++] = b;
+        if (g_rx.header_len == SYSEX_HEADER_LEN)
+        {
+            midi_sysex_begin_data();
+        }
+    }
+}
+
+void
+midi_sysex_rx
+    (unsigned long packet
+    )
+{
+    const unsigned cable = (packet >> 4) & 0xf;
+    unsigned nb_bytes;
+    switch (packet & 0xf)
+    {
+    case 0x4: /* SysEx starts or continues */
+    case 0x7: /* SysEx ends with following three bytes */
+        nb_bytes = 3;
+        break;
+    case 0x5: /* SysEx ends with following single byte */
+        nb_bytes = 1;
+        break;
+    case 0x6: /* SysEx ends with following two bytes */
+        nb_bytes = 2;
+        break;
+    default:
+        return;
+    }
+    if (((packet >> 8) & 0xff) == 0xf0)
+    {
+        g_rx.cable = cable;
+    }
+    else if ((g_rx.state == RX_STATE_IDLE) || (cable != g_rx.cable))
+    {
+        /* Continuation of a message we are not interested in. */
+        return;
+    }
+    packet >>= 8;
+    do
+    {
+        midi_sysex_rx_byte(packet & 0xff);
+        packet >>= 8;
+    } while (--nb_bytes);
+}
+
+void
+midi_sysex_get_stats
+    (struct midi_sysex_stats_s *stats
+    )
+{
+    *stats = g_stats;
+}
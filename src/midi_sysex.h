@@ -0,0 +1,78 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef MIDI_SYSEX_H_
+#define MIDI_SYSEX_H_
+
+/* Configuration is uploaded using system exclusive messages carried in the
+ * USB-MIDI OUT endpoint. Every message has the form:
+ *
+ *   F0 7D 01 <command> <header...> <data...> F7
+ *
+ * 7D is the non-commercial manufacturer ID and 01 identifies this device.
+ * Binary data is sent in groups of up to 8 bytes: the first byte of a group
+ * holds the most significant bits of the following (up to) 7 bytes with bit
+ * 0 belonging to the first of them.
+ *
+ * SYSEX_CMD_LOAD_MAP
+ *   header: <n 0-6> <n 7-13> <crc 0-6> <crc 7-13> <crc 14-15>
+ *   data:   n packed midi_map_entry_s records (4 bytes each)
+ *   n is the number of records and crc is the CRC-16/CCITT of the unpacked
+ *   record bytes. The records are decoded directly into the staging mapping
+ *   table as the packets arrive and the table is committed when the F7 is
+ *   received and the length and crc are both correct. Anything else leaves
+ *   the live mapping untouched. A committed table is then saved to flash and
+ *   further uploads are rejected until the save has finished.
+ *
+ * SYSEX_CMD_SET_ROUTES
+ *   header: <source> <destinations> 00 00 00
+ *   data:   none
+ *   Sets the midi_router destinations (MIDI_ROUTE() bits) of a source and
+ *   saves the routes of every source to flash. Rejected while a save is in
+ *   progress.
+ *
+ * SYSEX_CMD_PULSE
+ *   header: <n 0-6> <n 7-13> <crc 0-6> <crc 7-13> <crc 14-15>
+ *   data:   n packed stop_action records (4 bytes each)
+ *   Pulses n outputs (see stop_action.h), for example the magnets of a
+ *   combination recall. The records are checked like those of
+ *   SYSEX_CMD_LOAD_MAP and queued as one batch when the F7 is received. */
+
+#define SYSEX_MANUFACTURER_ID   (0x7d)
+#define SYSEX_DEVICE_ID         (0x01)
+
+#define SYSEX_CMD_LOAD_MAP      (0x01)
+#define SYSEX_CMD_SET_ROUTES    (0x02)
+#define SYSEX_CMD_PULSE         (0x03)
+
+struct midi_sysex_stats_s
+{
+    unsigned long   completed; /* Number of uploads committed */
+    unsigned long   rejected;  /* Number of uploads addressed to this device
+                                * which were discarded */
+    unsigned long   unsaved;   /* Number of uploads which were applied but
+                                * could not be saved to flash */
+};
+
+/* Feed one 32-bit USB-MIDI event packet (as read from the endpoint FIFO) to
+ * the receiver. Packets which are not SysEx (CIN 0x4-0x7) are ignored. */
+void    midi_sysex_rx(unsigned long packet);
+
+/* Returns upload statistics. */
+void    midi_sysex_get_stats(struct midi_sysex_stats_s *stats);
+
+#endif /* MIDI_SYSEX_H_ */
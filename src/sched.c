@@ -0,0 +1,75 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "sched.h"
+#include <LPC17xx.h>
+#include "critical.h"
+#include "debughlprs.h"
+
+static sched_task_t             g_tasks[SCHED_NB_TASKS];
+static volatile unsigned long   g_pending;
+
+void
+sched_register
+    (unsigned       task
+    ,sched_task_t   function
+    )
+{
+    ASSERT(task < SCHED_NB_TASKS);
+    g_tasks[task] = function;
+}
+
+void
+sched_post
+    (unsigned task
+    )
+{
+    const unsigned long state = critical_enter();
+    g_pending |= 1ul << task;
+    critical_exit(state);
+}
+
+void
+sched_run
+    (void
+    )
+{
+    for (;;)
+    {
+        unsigned long pending;
+        __disable_irq();
+        pending = g_pending;
+        if (pending)
+        {
+            /* Lowest set bit is the highest priority task */
+            const unsigned task = __CLZ(__RBIT(pending));
+            g_pending = pending & ~(1ul << task);
+            __enable_irq();
+            if (g_tasks[task])
+            {
+                g_tasks[task]();
+            }
+        }
+        else
+        {
+            /* An interrupt which arrives after the check above still wakes
+             * the core as it only stays masked until the __enable_irq. */
+            __WFI();
+            __enable_irq();
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+/* Cooperative run-to-completion scheduler. Interrupt handlers only do the
+ * minimum needed to service their hardware and post a task, the main loop
+ * then runs the posted tasks one at a time in priority order and sleeps when
+ * there is nothing left to do.
+ *
+ * A task is identified by its priority (lower runs first). Posting a task
+ * which is already pending has no effect: a task must process everything
+ * which has accumulated when it runs. */
+enum sched_task_e
+{   SCHED_TASK_STOP_ACTION      /* end and start stop action magnet pulses */
+,   SCHED_TASK_MIDI_DIN         /* parse bytes received on the DIN port */
+,   SCHED_TASK_EXPRESSION       /* filter a block of pedal samples */
+,   SCHED_TASK_RESYNC           /* replay the console state to the host */
+,   SCHED_TASK_CONFIG_STORE     /* program the next page of a settings record */
+,   SCHED_NB_TASKS
+};
+
+typedef void (*sched_task_t)(void);
+
+/* Set the function which is run for the given task. */
+void sched_register(unsigned task, sched_task_t function);
+
+/* Mark a task as pending. May be called from any interrupt. */
+void sched_post(unsigned task);
+
+/* Run tasks forever. Called by main once everything is set up. */
+void sched_run(void);
+
+#endif /* SCHED_H_ */
@@ -0,0 +1,218 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "stop_action.h"
+#include "conbus.h"
+#include "sched.h"
+#include "critical.h"
+#include "debughlprs.h"
+
+#define NO_COIL                 (0xff)
+#define NO_OUTPUT               (0xffff)
+
+struct pulse_s
+{
+    unsigned short  output;
+    unsigned short  ticks;      /* scan periods, 1 to STOP_ACTION_WHEEL_SIZE - 1 */
+};
+
+/* Energised coil, linked into the wheel slot of its release. Free ones
+ * have output NO_OUTPUT and are linked from g_free. */
+struct coil_s
+{
+    unsigned short  output;
+    unsigned char   next;
+};
+
+static struct pulse_s               g_queue[STOP_ACTION_QUEUE_SIZE];
+static unsigned                     g_queue_head;   /* written by commit */
+static unsigned                     g_queue_tail;   /* written by the task */
+static unsigned char                g_staging[STOP_ACTION_QUEUE_SIZE * STOP_ACTION_RECORD_SIZE];
+static struct coil_s                g_coils[STOP_ACTION_MAX_ACTIVE];
+static unsigned char                g_free;
+static unsigned char                g_wheel[STOP_ACTION_WHEEL_SIZE];
+static unsigned                     g_wheel_pos;
+static unsigned                     g_nb_active;
+static unsigned                     g_max_active;
+static unsigned                     g_pending_ticks;    /* scans not yet seen by the task */
+static struct stop_action_stats_s   g_stats;
+
+static
+int
+stop_action_is_active
+    (unsigned output
+    )
+{
+    unsigned coil;
+    for (coil = 0; coil < STOP_ACTION_MAX_ACTIVE; coil++)
+    {
+        if (g_coils[coil].output == output)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static
+void
+stop_action_task
+    (void
+    )
+{
+    unsigned long state = critical_enter();
+    unsigned ticks = g_pending_ticks;
+    g_pending_ticks = 0;
+    critical_exit(state);
+
+    /* Release the coils whose pulses have ended */
+    while (ticks--)
+    {
+        unsigned coil;
+        g_wheel_pos = (g_wheel_pos + 1) & (STOP_ACTION_WHEEL_SIZE - 1);
+        coil        = g_wheel[g_wheel_pos];
+        g_wheel[g_wheel_pos] = NO_COIL;
+        while (coil != NO_COIL)
+        {
+            const unsigned next = g_coils[coil].next;
+            conbus_set_output_level(g_coils[coil].output, 0);
+            g_coils[coil].output = NO_OUTPUT;
+            g_coils[coil].next  = g_free;
+            g_free              = coil;
+            g_nb_active--;
+            coil                = next;
+        }
+    }
+
+    /* Fire as many queued pulses as the supply allows */
+    while ((g_nb_active < g_max_active) && (g_queue_tail != g_queue_head))
+    {
+        const struct pulse_s *pulse = &g_queue[g_queue_tail & (STOP_ACTION_QUEUE_SIZE - 1)];
+        const unsigned slot = (g_wheel_pos + pulse->ticks) & (STOP_ACTION_WHEEL_SIZE - 1);
+        const unsigned coil = g_free;
+        if (stop_action_is_active(pulse->output))
+        {
+            break;
+        }
+        g_free              = g_coils[coil].next;
+        g_coils[coil].output = pulse->output;
+        g_coils[coil].next  = g_wheel[slot];
+        g_wheel[slot]       = coil;
+        g_nb_active++;
+        conbus_set_output_level(pulse->output, CONBUS_OUTPUT_LEVELS - 1);
+        g_stats.fired++;
+        g_queue_tail++;
+    }
+}
+
+void
+stop_action_init
+    (unsigned max_active
+    )
+{
+    unsigned i;
+    ASSERT((max_active > 0) && (max_active <= STOP_ACTION_MAX_ACTIVE));
+    g_max_active = max_active;
+    for (i = 0; i < STOP_ACTION_WHEEL_SIZE; i++)
+    {
+        g_wheel[i] = NO_COIL;
+    }
+    for (i = 0; i < STOP_ACTION_MAX_ACTIVE; i++)
+    {
+        g_coils[i].output = NO_OUTPUT;
+        g_coils[i].next   = (i + 1 < STOP_ACTION_MAX_ACTIVE) ? i + 1 : NO_COIL;
+    }
+    g_free = 0;
+    sched_register(SCHED_TASK_STOP_ACTION, stop_action_task);
+}
+
+void
+stop_action_scan
+    (void
+    )
+{
+    g_pending_ticks++;
+    sched_post(SCHED_TASK_STOP_ACTION);
+}
+
+unsigned char *
+stop_action_get_staging
+    (void
+    )
+{
+    return g_staging;
+}
+
+int
+stop_action_commit
+    (unsigned nb_records
+    )
+{
+    const unsigned nb_outputs = 8 * conbus_get_nb_outputs_div_8();
+    const unsigned char *r;
+    unsigned long state;
+    unsigned i;
+    int queued = 0;
+    ASSERT(nb_records <= STOP_ACTION_QUEUE_SIZE);
+    for (i = 0, r = g_staging; i < nb_records; i++, r += STOP_ACTION_RECORD_SIZE)
+    {
+        const unsigned output = r[0] | ((unsigned)r[1] << 8);
+        const unsigned ms     = r[2] | ((unsigned)r[3] << 8);
+        if ((output >= nb_outputs) || (ms == 0) || (ms > STOP_ACTION_MAX_MS))
+        {
+            g_stats.rejected++;
+            return 0;
+        }
+    }
+    state = critical_enter();
+    if (STOP_ACTION_QUEUE_SIZE - (g_queue_head - g_queue_tail) >= nb_records)
+    {
+        for (i = 0, r = g_staging; i < nb_records; i++, r += STOP_ACTION_RECORD_SIZE)
+        {
+            struct pulse_s *pulse = &g_queue[(g_queue_head + i) & (STOP_ACTION_QUEUE_SIZE - 1)];
+            const unsigned ms     = r[2] | ((unsigned)r[3] << 8);
+            pulse->output         = r[0] | ((unsigned)r[1] << 8);
+            pulse->ticks          = (ms * 1000 + CONBUS_SCAN_PERIOD_US - 1) / CONBUS_SCAN_PERIOD_US;
+        }
+        g_queue_head += nb_records;
+        if (g_queue_head - g_queue_tail > g_stats.high_water)
+        {
+            g_stats.high_water = g_queue_head - g_queue_tail;
+        }
+        queued = 1;
+    }
+    else
+    {
+        g_stats.rejected++;
+    }
+    critical_exit(state);
+    if (queued)
+    {
+        sched_post(SCHED_TASK_STOP_ACTION);
+    }
+    return queued;
+}
+
+void
+stop_action_get_stats
+    (struct stop_action_stats_s *stats
+    )
+{
+    const unsigned long state = critical_enter();
+    *stats = g_stats;
+    critical_exit(state);
+}
@@ -0,0 +1,72 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef STOP_ACTION_H_
+#define STOP_ACTION_H_
+
+#include "conbus.h"
+
+/* Timed pulses for stop action magnets (the on and off coils of drawknobs
+ * and tabs) on the conbus outputs. A pulse fully turns an output on and off
+ * again after the requested width, which is rounded up to whole scan
+ * periods. Requests are queued in order and fired as soon as fewer than
+ * max_active coils are energised, which keeps the magnet supply within its
+ * rating. A request for a coil which is still energised waits for the end of
+ * its current pulse (and holds up the queue behind it).
+ *
+ * The releases are kept on a timing wheel of STOP_ACTION_WHEEL_SIZE scan
+ * periods which is advanced once per scan by a task. Outputs used for coils
+ * should not be given lamp levels. */
+
+#define STOP_ACTION_QUEUE_SIZE  (128)   /* power of 2 */
+#define STOP_ACTION_MAX_ACTIVE  (16)
+#define STOP_ACTION_WHEEL_SIZE  (64)    /* power of 2 */
+
+/* Longest pulse in milliseconds */
+#define STOP_ACTION_MAX_MS      ((STOP_ACTION_WHEEL_SIZE - 1) * (CONBUS_SCAN_PERIOD_US / 1000))
+
+/* Size of a staging record: <output 0-7> <output 8-15> <ms 0-7> <ms 8-15> */
+#define STOP_ACTION_RECORD_SIZE (4)
+
+struct stop_action_stats_s
+{
+    unsigned long   fired;          /* Pulses started */
+    unsigned long   rejected;       /* Batches which did not fit in the queue
+                                     * or had an invalid record */
+    unsigned        high_water;     /* Deepest the queue has been */
+};
+
+/* Register the task. At most max_active (up to STOP_ACTION_MAX_ACTIVE) coils
+ * are energised at once. */
+void            stop_action_init(unsigned max_active);
+
+/* Called by conbus at the start of every scan period (on_scan). */
+void            stop_action_scan(void);
+
+/* Returns the staging area which may be filled with up to
+ * STOP_ACTION_QUEUE_SIZE records. */
+unsigned char  *stop_action_get_staging(void);
+
+/* Queue the first nb_records of the staging area as one batch. Either every
+ * pulse is queued or, if one of them is invalid or they do not all fit,
+ * none. Returns non-zero if the batch was queued. May be called from any
+ * interrupt, but only one context may use the staging area. */
+int             stop_action_commit(unsigned nb_records);
+
+void            stop_action_get_stats(struct stop_action_stats_s *stats);
+
+#endif /* STOP_ACTION_H_ */
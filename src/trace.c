@@ -0,0 +1,68 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "trace.h"
+#include "cycles.h"
+#include "critical.h"
+#include "lpc176x_clock.h"
+
+static struct trace_record_s g_ring[TRACE_NB_RECORDS];
+static unsigned long         g_total;
+
+static struct
+{
+    struct trace_header_s   header;
+    struct trace_record_s   records[TRACE_NB_RECORDS];
+} g_snapshot;
+
+void
+trace_write
+    (unsigned       event
+    ,unsigned long  a
+    ,unsigned long  b
+    )
+{
+    const unsigned long     state   = critical_enter();
+    struct trace_record_s  *record  = &(g_ring[g_total++ & (TRACE_NB_RECORDS - 1)]);
+    record->cycles  = cycles_now();
+    record->event   = event;
+    record->a       = a;
+    record->b       = b;
+    critical_exit(state);
+}
+
+const void *
+trace_snapshot
+    (unsigned *length
+    )
+{
+    const unsigned long state = critical_enter();
+    const unsigned long total = g_total;
+    const unsigned      count = (total < TRACE_NB_RECORDS) ? total : TRACE_NB_RECORDS;
+    unsigned i;
+    for (i = 0; i < count; i++)
+    {
+        g_snapshot.records[i] = g_ring[(total - count + i) & (TRACE_NB_RECORDS - 1)];
+    }
+    critical_exit(state);
+    g_snapshot.header.magic      = TRACE_MAGIC;
+    g_snapshot.header.total      = total;
+    g_snapshot.header.cclk       = clock_get_cclk();
+    g_snapshot.header.nb_records = count;
+    *length = sizeof(g_snapshot.header) + count * sizeof(struct trace_record_s);
+    return &g_snapshot;
+}
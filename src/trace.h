@@ -0,0 +1,83 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/* Binary event trace. Every event is a fixed size record written into a RAM
+ * ring which the host reads with the USB_MIDI_REQ_TRACE vendor request, so
+ * recording an event costs a handful of stores and can be left enabled in
+ * production builds (define TRACE_DISABLE to remove it). This header is also
+ * used by the host decoder in tools/. */
+
+/* Events and the meaning of their arguments. */
+#define TRACE_EVENTS(EVENT)                                                   \
+    EVENT(ASSERT)               /* a: line, b: address of file name */        \
+    EVENT(USB_RESET)            /* - */                                       \
+    EVENT(USB_SETUP)            /* a, b: setup packet bytes 0-3 and 4-7 */    \
+    EVENT(USB_UNHANDLED)        /* a, b: setup packet bytes 0-3 and 4-7 */    \
+    EVENT(CONBUS_OVERRUN)       /* a: frames, scan still running at tick */   \
+    EVENT(CONBUS_MISMATCH)      /* a: frames */                               \
+    EVENT(CONBUS_BAD_GUARD)     /* a: frames, b: guard byte read */           \
+    EVENT(MIDI_DROPPED)         /* a: midi_out class, b: packet */
+
+#define TRACE_EVENT_ENUM_(name) TRACE_EVENT_##name,
+enum trace_event_e
+{
+    TRACE_EVENT_NONE,
+    TRACE_EVENTS(TRACE_EVENT_ENUM_)
+    TRACE_NB_EVENTS
+};
+
+/* Number of records kept. Must be a power of two. */
+#define TRACE_NB_RECORDS        (128)
+
+#define TRACE_MAGIC             (0x45435254ul) /* "TRCE" */
+
+/* All fields are 32-bit little endian. */
+struct trace_record_s
+{
+    unsigned long   cycles;     /* CPU clock cycles (cycles_now) */
+    unsigned long   event;
+    unsigned long   a;
+    unsigned long   b;
+};
+
+/* What USB_MIDI_REQ_TRACE returns, followed by nb_records records from the
+ * oldest to the newest. */
+struct trace_header_s
+{
+    unsigned long   magic;      /* TRACE_MAGIC */
+    unsigned long   total;      /* Records written since reset */
+    unsigned long   cclk;       /* CPU clock in Hz to convert cycles */
+    unsigned long   nb_records;
+};
+
+#ifdef TRACE_DISABLE
+#define TRACE(event, a, b)      ((void)0)
+#else
+#define TRACE(event, a, b)      trace_write((event), (unsigned long)(a), (unsigned long)(b))
+#endif
+
+/* Append a record. May be called from any interrupt. Use TRACE instead. */
+void            trace_write(unsigned event, unsigned long a, unsigned long b);
+
+/* Copy the ring into a buffer which stays unchanged until the next call and
+ * return it. The length in bytes is stored in *length. */
+const void     *trace_snapshot(unsigned *length);
+
+#endif /* TRACE_H_ */
@@ -16,7 +16,20 @@
  */
 
 #include "lpc176x_usb.h"
-#include "lpc176x_usb_sie.h"
+#include "midi_sysex.h"
+#include "usb_midi.h"
+#include "midi_out.h"
+#include "midi_router.h"
+#include "midi_din.h"
+#include "midi_resync.h"
+#include "stop_action.h"
+#include "midi_map.h"
+#include "conbus.h"
+#include "lpc176x_clock.h"
+#include "config_store.h"
+#include "boot_time.h"
+#include "trace.h"
+#include "hotpath.h"
 
 /* MS Class-Specific Interface Descriptor Subtypes */
 #define MS_IFACE_DESC_UNDEFINED     (0x00)
@@ -60,12 +73,76 @@ const unsigned char midi_desc[] =
     ,   0x01 /* 1 cfg */
     };
 
+/* Every cable has four jacks. The embedded IN jack receives from the host and
+ * is wired to the external OUT jack. The external IN jack is wired to the
+ * embedded OUT jack which sends to the host. Only the external jacks of the
+ * DIN cable are real connectors (see midi_din.h), they are named by a string
+ * descriptor. */
+#define MIDI_JACK_ID_EMB_IN(cable)  (4 * (cable) + 1)
+#define MIDI_JACK_ID_EXT_IN(cable)  (4 * (cable) + 2)
+#define MIDI_JACK_ID_EMB_OUT(cable) (4 * (cable) + 3)
+#define MIDI_JACK_ID_EXT_OUT(cable) (4 * (cable) + 4)
+
+#define MIDI_IN_JACK_DESC_LEN       (6)
+#define MIDI_OUT_JACK_DESC_LEN      (9) /* with a single input pin */
+#define MIDI_CABLE_DESC_LEN         (2 * MIDI_IN_JACK_DESC_LEN + 2 * MIDI_OUT_JACK_DESC_LEN)
+#define MS_ENDP_DESC_LEN            (4 + USB_MIDI_NB_CABLES)
+
+/* Length of the class specific midi streaming interface. Includes the
+ * endpoint descriptors (see the example in USB MIDI 1.0 appendix B.4.2) */
+#define MS_TOTAL_LEN                (7 + USB_MIDI_NB_CABLES * MIDI_CABLE_DESC_LEN + 2 * (9 + MS_ENDP_DESC_LEN))
+#define CFG_TOTAL_LEN               (9 + 9 + 9 + 9 + MS_TOTAL_LEN)
+
+#define MIDI_STRING_ID_DIN          (3)
+#define MIDI_EXT_JACK_STRING(cable) (((cable) == USB_MIDI_CABLE_DIN) ? MIDI_STRING_ID_DIN : 0)
+
+typedef char usb_midi_cable_count_check[(USB_MIDI_NB_CABLES <= 16) ? 1 : -1];
+
+#define MIDI_CABLE_JACK_DESCS(name)                                     \
+    /* midi in jack (embedded) */                                       \
+    ,   MIDI_IN_JACK_DESC_LEN                                           \
+    ,   USB_DESC_TYPE_CS_INTERFACE                                      \
+    ,   MS_IFACE_DESC_MIDI_IN_JACK                                      \
+    ,   MS_MIDI_IO_JACK_EMBEDDED                                        \
+    ,   MIDI_JACK_ID_EMB_IN(USB_MIDI_CABLE_##name)                      \
+    ,   0x00    /* unused */                                            \
+    /* midi in jack (external) */                                       \
+    ,   MIDI_IN_JACK_DESC_LEN                                           \
+    ,   USB_DESC_TYPE_CS_INTERFACE                                      \
+    ,   MS_IFACE_DESC_MIDI_IN_JACK                                      \
+    ,   MS_MIDI_IO_JACK_EXTERNAL                                        \
+    ,   MIDI_JACK_ID_EXT_IN(USB_MIDI_CABLE_##name)                      \
+    ,   MIDI_EXT_JACK_STRING(USB_MIDI_CABLE_##name)                     \
+    /* midi out jack (embedded) */                                      \
+    ,   MIDI_OUT_JACK_DESC_LEN                                          \
+    ,   USB_DESC_TYPE_CS_INTERFACE                                      \
+    ,   MS_IFACE_DESC_MIDI_OUT_JACK                                     \
+    ,   MS_MIDI_IO_JACK_EMBEDDED                                        \
+    ,   MIDI_JACK_ID_EMB_OUT(USB_MIDI_CABLE_##name)                     \
+    ,   0x01    /* input pins */                                        \
+    ,   MIDI_JACK_ID_EXT_IN(USB_MIDI_CABLE_##name) /* source id */      \
+    ,   0x01    /* source pin */                                        \
+    ,   0x00    /* unused */                                            \
+    /* midi out jack (external) */                                      \
+    ,   MIDI_OUT_JACK_DESC_LEN                                          \
+    ,   USB_DESC_TYPE_CS_INTERFACE                                      \
+    ,   MS_IFACE_DESC_MIDI_OUT_JACK                                     \
+    ,   MS_MIDI_IO_JACK_EXTERNAL                                        \
+    ,   MIDI_JACK_ID_EXT_OUT(USB_MIDI_CABLE_##name)                     \
+    ,   0x01    /* input pins */                                        \
+    ,   MIDI_JACK_ID_EMB_IN(USB_MIDI_CABLE_##name) /* source id */      \
+    ,   0x01    /* source pin */                                        \
+    ,   MIDI_EXT_JACK_STRING(USB_MIDI_CABLE_##name)
+
+#define MIDI_CABLE_EMB_IN_ID(name)  , MIDI_JACK_ID_EMB_IN(USB_MIDI_CABLE_##name)
+#define MIDI_CABLE_EMB_OUT_ID(name) , MIDI_JACK_ID_EMB_OUT(USB_MIDI_CABLE_##name)
+
 static
 const unsigned char midi_conf_desc[] =
     {   9
     ,   USB_DESC_TYPE_CONFIGURATION
-    ,   101     /* size of the entire descriptor + endpoints */
-    ,   0       /* msb of above */
+    ,   CFG_TOTAL_LEN & 0xff    /* size of the entire descriptor + endpoints */
+    ,   CFG_TOTAL_LEN >> 8      /* msb of above */
     ,   2       /* nb of interfaces */
     ,   1       /* this is configuration id 1 */
     ,   0       /* unused */
@@ -107,42 +184,10 @@ const unsigned char midi_conf_desc[] =
     ,   MS_IFACE_DESC_HEADER
     ,   0x00
     ,   0x01
-    ,   65      /* size */
-    ,   0
-    /* b4.3 midi in jack 1 */
-    ,   6
-    ,   USB_DESC_TYPE_CS_INTERFACE
-    ,   MS_IFACE_DESC_MIDI_IN_JACK
-    ,   MS_MIDI_IO_JACK_EMBEDDED
-    ,   0x01    /* jack ID */
-    ,   0x00    /* unused */
-    /* midi in jack 2 */
-    ,   6
-    ,   USB_DESC_TYPE_CS_INTERFACE
-    ,   MS_IFACE_DESC_MIDI_IN_JACK
-    ,   MS_MIDI_IO_JACK_EXTERNAL
-    ,   0x02    /* jack ID */
-    ,   0       /* unused */
-    /* b4.4) midi out jack */
-    ,   9
-    ,   USB_DESC_TYPE_CS_INTERFACE
-    ,   MS_IFACE_DESC_MIDI_OUT_JACK
-    ,   MS_MIDI_IO_JACK_EMBEDDED
-    ,   0x03    /* jack ID */
-    ,   0x01    /* input pins */
-    ,   0x02    /* source id */
-    ,   0x01    /* source pin */
-    ,   0x00    /* unused */
-    /* midi out jack */
-    ,   9
-    ,   USB_DESC_TYPE_CS_INTERFACE
-    ,   MS_IFACE_DESC_MIDI_OUT_JACK
-    ,   MS_MIDI_IO_JACK_EXTERNAL
-    ,   0x04    /* jack ID */
-    ,   0x01    /* input pins */
-    ,   0x01    /* source id */
-    ,   0x01    /* source pin */
-    ,   0x00    /* unused */
+    ,   MS_TOTAL_LEN & 0xff /* size */
+    ,   MS_TOTAL_LEN >> 8
+    /* b4.3) midi jacks for every cable */
+    USB_MIDI_CABLES(MIDI_CABLE_JACK_DESCS)
     /* b5.1) std bulk out endpoint desc */
     ,   9
     ,   USB_DESC_TYPE_ENDPOINT
@@ -154,11 +199,11 @@ const unsigned char midi_conf_desc[] =
     ,   0       /* unused */
     ,   0       /* unused */
     /* b5.2) class specific ms bulk out endpoint desc */
-    ,   5
+    ,   MS_ENDP_DESC_LEN
     ,   USB_DESC_TYPE_CS_ENDPOINT
     ,   MS_ENDP_DESC_GENERAL
-    ,   1       /* nb embedded midi's */
-    ,   1       /* id of embedded midi */
+    ,   USB_MIDI_NB_CABLES  /* nb embedded midi's */
+    USB_MIDI_CABLES(MIDI_CABLE_EMB_IN_ID)
     /* b6.1) std bulk in endpoint desc */
     ,   9
     ,   USB_DESC_TYPE_ENDPOINT
@@ -170,13 +215,15 @@ const unsigned char midi_conf_desc[] =
     ,   0       /* unused */
     ,   0       /* unused */
     /* b6.2) class specific ms bulk in endpoint desc */
-    ,   5
+    ,   MS_ENDP_DESC_LEN
     ,   USB_DESC_TYPE_CS_ENDPOINT
     ,   MS_ENDP_DESC_GENERAL
-    ,   1       /* nb embedded midi's */
-    ,   3       /* id of embedded midi */
+    ,   USB_MIDI_NB_CABLES  /* nb embedded midi's */
+    USB_MIDI_CABLES(MIDI_CABLE_EMB_OUT_ID)
     };
 
+typedef char midi_conf_desc_len_check[(sizeof(midi_conf_desc) == CFG_TOTAL_LEN) ? 1 : -1];
+
 static
 const unsigned char midi_mfg_str[] =
     {   28
@@ -221,11 +268,26 @@ const unsigned char midi_prod_str[] =
     ,   'r', 0
     };
 
+static
+const unsigned char midi_din_str[] =
+    {   18
+    ,   USB_DESC_TYPE_STRING
+    ,   'D', 0
+    ,   'I', 0
+    ,   'N', 0
+    ,   ' ', 0
+    ,   'M', 0
+    ,   'I', 0
+    ,   'D', 0
+    ,   'I', 0
+    };
+
 static
 const unsigned char* midi_strings[] =
     {   0 /* should return string table 9.6.7 */
     ,   midi_mfg_str
     ,   midi_prod_str
+    ,   midi_din_str    /* MIDI_STRING_ID_DIN */
     };
 
 #define NB_STRINGS (sizeof(midi_strings) / sizeof(unsigned char*))
@@ -249,7 +311,42 @@ midi_get_cfg_desc
     return (index == 0) ? midi_conf_desc : 0;
 }
 
-volatile unsigned the_mode = 0;
+/* Physical endpoints of the MIDI streaming bulk endpoints */
+#define MIDI_OUT_PHY_EP             (4)
+#define MIDI_IN_PHY_EP              (5)
+
+/* Called for every event packet received from the host. */
+static
+void
+midi_host_packet
+    (unsigned long packet
+    )
+{
+    midi_sysex_rx(packet);
+    if (USB_MIDI_PACKET_CABLE(packet) == USB_MIDI_CABLE_DIN)
+    {
+        (void)midi_router_post(MIDI_ROUTER_SRC_HOST, packet);
+    }
+}
+
+/* Non-zero while a packet is waiting in the IN endpoint buffer */
+static int g_in_busy;
+
+static
+void
+midi_send_pending
+    (void
+    )
+{
+    unsigned long packets[16];
+    const unsigned nb_packets = midi_out_read(packets, 16);
+    if (nb_packets)
+    {
+        /* Every event packet is one FIFO word, as on the way in */
+        usb_write_words(MIDI_IN_PHY_EP, packets, nb_packets);
+        g_in_busy = 1;
+    }
+}
 
 static
 void
@@ -257,9 +354,19 @@ midi_frame_event
     (unsigned frame_index
     )
 {
-    if ((the_mode == 1) || (the_mode == 2))
+    midi_resync_frame(usb_is_configured());
+    midi_router_frame();
+    if (!usb_is_configured())
     {
-        usb_sie_set_mode(1 << 5 /* INAK_BI */);
+        g_in_busy = 0;
+    }
+    else
+    {
+        boot_time_mark(BOOT_PHASE_CONFIGURED);
+        if (!g_in_busy)
+        {
+            midi_send_pending();
+        }
     }
 }
 
@@ -271,32 +378,163 @@ midi_endpoint_event
 {
     if (physical_endpoint & 1)
     {
-        /*FIXME for testing - should be removed */
-        if (the_mode == 1)
+        /* The previous packet has been collected by the host. */
+        g_in_busy = 0;
+        midi_send_pending();
+    }
+    else
+    {
+        /* Every USB-MIDI event packet is exactly one FIFO word so the packets
+         * are handed over without being copied out of the endpoint first. */
+        (void)usb_read_words
+            (physical_endpoint
+            ,midi_host_packet
+            );
+    }
+}
+
+#define REQ_TYPE_VENDOR_D2H         (0xc0)
+#define REQ_TYPE_VENDOR_H2D         (0x40)
+
+/* Responses while they are being sent */
+static struct midi_router_stats_s g_router_stats;
+static unsigned char g_inputs[4 + MIDI_MAP_MAX_INPUTS / 8];
+static unsigned char g_resync_setting;
+static unsigned long g_health[2 + USB_MIDI_HEALTH_NB_FIELDS];
+
+static
+void
+midi_fill_health
+    (void
+    )
+{
+    struct conbus_stats_s       conbus;
+    struct midi_out_stats_s     out;
+    struct midi_din_stats_s     din;
+    struct usb_stats_s          usb;
+    struct stop_action_stats_s  pulses;
+    struct midi_sysex_stats_s   sysex;
+    struct config_store_stats_s store;
+    unsigned long              *f = g_health + 2;
+    unsigned i, j;
+    conbus_get_stats(&conbus);
+    midi_out_get_stats(&out);
+    midi_din_get_stats(&din);
+    midi_router_get_stats(&g_router_stats);
+    usb_get_stats(&usb);
+    stop_action_get_stats(&pulses);
+    midi_sysex_get_stats(&sysex);
+    config_store_get_stats(&store);
+    g_health[0] = USB_MIDI_HEALTH_MAGIC;
+    g_health[1] = USB_MIDI_HEALTH_NB_FIELDS;
+    f[USB_MIDI_HEALTH_SCANS]                = conbus.frames;
+    f[USB_MIDI_HEALTH_SCAN_OVERRUNS]        = conbus.overruns;
+    f[USB_MIDI_HEALTH_SCAN_WORST_CYCLES]    = conbus.worst_cycles;
+    f[USB_MIDI_HEALTH_SCAN_DISCARDED]       = conbus.mismatched + conbus.bad_guard;
+    f[USB_MIDI_HEALTH_CPU_CLOCK]            = clock_get_cclk();
+    f[USB_MIDI_HEALTH_EVENT_OVERFLOWS]      = 0;
+    for (i = 0; i < MIDI_OUT_NB_CLASSES; i++)
+    {
+        f[USB_MIDI_HEALTH_EVENT_OVERFLOWS] += out.dropped[i];
+    }
+    f[USB_MIDI_HEALTH_ROUTER_DROPS]         = 0;
+    for (i = 0; i < MIDI_ROUTER_NB_SOURCES; i++)
+    {
+        for (j = 0; j < MIDI_ROUTER_NB_DESTS; j++)
         {
-            static const unsigned char buf[8] = {0x09, 0x90, 60, 0x7f, 0x09, 0x90, 64, 0x7f};
-            usb_write(physical_endpoint, buf, 8);
-            the_mode = 0;
+            f[USB_MIDI_HEALTH_ROUTER_DROPS] += g_router_stats.dropped[i][j];
         }
-        else if (the_mode == 2)
+    }
+    f[USB_MIDI_HEALTH_DIN_DROPS]            = din.tx_dropped + din.rx_dropped;
+    f[USB_MIDI_HEALTH_USB_OUT_NAKS]         = usb.out_naks;
+    f[USB_MIDI_HEALTH_USB_CONTROL_STALLS]   = usb.control_stalls;
+    f[USB_MIDI_HEALTH_PULSE_REJECTS]        = pulses.rejected;
+    f[USB_MIDI_HEALTH_SYSEX_UNSAVED]        = sysex.unsaved;
+    f[USB_MIDI_HEALTH_CONFIG_FAILURES]      = store.failures;
+    f[USB_MIDI_HEALTH_BUS_CLOCK]            = conbus_get_baud_rate();
+    f[USB_MIDI_HEALTH_BUS_INPUTS]           = conbus_get_nb_inputs_div_8();
+    f[USB_MIDI_HEALTH_BUS_OUTPUTS]          = conbus_get_nb_outputs_div_8();
+    f[USB_MIDI_HEALTH_BUS_PROBE]            = conbus_get_probe();
+    f[USB_MIDI_HEALTH_DIMMING]              = conbus_get_dimming();
+    f[USB_MIDI_HEALTH_REFRESH_SKIPS]        = conbus.skipped_refreshes;
+}
+
+static
+int
+midi_control_request
+    (const unsigned char   *setup
+    ,const unsigned char  **data
+    ,unsigned              *length
+    )
+{
+    if ((setup[0] == REQ_TYPE_VENDOR_H2D) && (setup[1] == USB_MIDI_REQ_SET_RESYNC))
+    {
+        /* Applied either way but the request stalls if the setting can not
+         * be saved, for example while another setting is being saved */
+        midi_resync_set_enabled(setup[2] != 0);
+        if (config_store_busy())
         {
-            static const unsigned char buf[4] = {0x08, 0x80, 60, 0x00};
-            usb_write(physical_endpoint, buf, 4);
-            the_mode = 0;
+            return 0;
         }
-        else
+        g_resync_setting = (setup[2] != 0);
+        return config_store_write(CONFIG_TAG_RESYNC, &g_resync_setting, 1) == 0;
+    }
+    if ((setup[0] == REQ_TYPE_VENDOR_H2D) && (setup[1] == USB_MIDI_REQ_SET_OUTPUT))
+    {
+        const unsigned output = setup[2] | ((unsigned)setup[3] << 8);
+        const unsigned level  = setup[4] | ((unsigned)setup[5] << 8);
+        if ((output >= 8 * conbus_get_nb_outputs_div_8()) || (level >= CONBUS_OUTPUT_LEVELS))
         {
-            usb_sie_set_mode(0); /* disable interrupt on NAKs... */
+            return 0;
         }
+        conbus_set_output_level(output, level);
+        return 1;
     }
-    else
+    if (setup[0] != REQ_TYPE_VENDOR_D2H)
     {
-        static unsigned char pdata[64];
-        (void)usb_read
-            (physical_endpoint
-            ,pdata
-            ,sizeof(pdata)
-            );
+        return 0;
+    }
+    switch (setup[1])
+    {
+    case USB_MIDI_REQ_BOOT_TIME:
+        *data   = (const unsigned char *)boot_time_get();
+        *length = 4 * BOOT_NB_PHASES;
+        return 1;
+    case USB_MIDI_REQ_TRACE:
+        *data   = (const unsigned char *)trace_snapshot(length);
+        return 1;
+    case USB_MIDI_REQ_INPUTS:
+    {
+        /* This interrupt may have preempted the debounce bottom half half
+         * way through a pass, conbus_copy_inputs copies the image of the
+         * last complete one. */
+        const unsigned nb_bytes = conbus_copy_inputs(g_inputs + 4, sizeof(g_inputs) - 4);
+        const unsigned nb_inputs = 8 * nb_bytes;
+        g_inputs[0] = nb_inputs & 0xff;
+        g_inputs[1] = nb_inputs >> 8;
+        g_inputs[2] = 0;
+        g_inputs[3] = 0;
+        *data   = g_inputs;
+        *length = 4 + nb_bytes;
+        return 1;
+    }
+    case USB_MIDI_REQ_ROUTER:
+        midi_router_get_stats(&g_router_stats);
+        *data   = (const unsigned char *)&g_router_stats;
+        *length = sizeof(g_router_stats);
+        return 1;
+    case USB_MIDI_REQ_HEALTH:
+        midi_fill_health();
+        *data   = (const unsigned char *)g_health;
+        *length = sizeof(g_health);
+        return 1;
+#if defined(HOTPATH_PROFILE)
+    case USB_MIDI_REQ_PROFILE:
+        *data   = (const unsigned char *)hotpath_get_stats(length);
+        return 1;
+#endif
+    default:
+        return 0;
     }
 }
 
@@ -307,68 +545,15 @@ const struct usb_configuration_s midi_config =
 ,   midi_get_string_desc
 ,   midi_frame_event
 ,   midi_endpoint_event
+,   midi_control_request
 };
 
-#include <LPC17xx.h>
-
 void
 usb_midi_setup
-    (unsigned long fosc
+    (void
     )
 {
-    usb_setup(fosc, &midi_config);
-#if 0
-    {
-        /* for testing. a slow loop which will trigger note on/off messages
-         * that never ends. */
-        unsigned i = 0;
-        while (1)
-        {
-            static unsigned char x = 0;
-            static unsigned char xmask = 0xff;
-            static unsigned long z = 0;
-            if (LPC_SSP1->SR & 0x2)
-            {
-                z++;
-                if (z == 100000)
-                {
-                    LPC_GPIO2->FIOSET = 1 << 13;
-                    LPC_SSP1->DR = x & xmask;
-                    if (LPC_SSP1->SR & 0x4)
-                    {
-                        while (LPC_SSP1->SR & 0x4)
-                        {
-                            xmask = (~LPC_SSP1->DR) & 0xff;
-                        }
-                    }
-                    else
-                    {
-                        xmask = 0xff;
-                    }
-                    x++;
-                    z = 0;
-                }
-                else if (z == 50000)
-                {
-                    LPC_GPIO2->FIOCLR = 1 << 13;
-                }
-            }
-            if (usb_is_configured())
-            {
-                i++;
-                if (i == 10000000)
-                {
-                    the_mode = 1;
-                }
-                else if (i == 20000000)
-                {
-                    the_mode = 2;
-                    i = 0;
-                }
-            }
-        }
-    }
-#endif
+    usb_setup(&midi_config);
 }
 
 
@@ -18,6 +18,115 @@
 #ifndef USB_MIDI_H_
 #define USB_MIDI_H_
 
-void usb_midi_setup(unsigned long fosc);
+/* Virtual MIDI cables presented to the host. Each one shows up as a separate
+ * MIDI port and its position in this list is the cable number carried in the
+ * upper nibble of the first byte of each USB-MIDI event packet. There can be
+ * at most 16. */
+#define USB_MIDI_CABLES(CABLE) \
+    CABLE(GREAT)               \
+    CABLE(SWELL)               \
+    CABLE(CHOIR)               \
+    CABLE(PEDAL)               \
+    CABLE(STOPS)               \
+    CABLE(DIN)
+
+#define USB_MIDI_CABLE_ENUM_(name) USB_MIDI_CABLE_##name,
+enum usb_midi_cable_e
+{
+    USB_MIDI_CABLES(USB_MIDI_CABLE_ENUM_)
+    USB_MIDI_NB_CABLES
+};
+
+/* Builds a USB-MIDI event packet for a channel voice message. The result is
+ * the 32-bit word as it appears in the endpoint FIFO. */
+#define USB_MIDI_PACKET(cable, status, data1, data2)    \
+    (   (((unsigned long)(cable) & 0xf) << 4)           \
+    |   (((unsigned long)(status) >> 4) & 0xf)          \
+    |   (((unsigned long)(status) & 0xff) << 8)         \
+    |   (((unsigned long)(data1) & 0x7f) << 16)         \
+    |   (((unsigned long)(data2) & 0x7f) << 24)         \
+    )
+
+#define USB_MIDI_PACKET_CIN(packet)     ((packet) & 0xf)
+#define USB_MIDI_PACKET_CABLE(packet)   (((packet) >> 4) & 0xf)
+#define USB_MIDI_PACKET_STATUS(packet)  (((packet) >> 8) & 0xff)
+#define USB_MIDI_PACKET_DATA1(packet)   (((packet) >> 16) & 0xff)
+#define USB_MIDI_PACKET_DATA2(packet)   (((packet) >> 24) & 0xff)
+
+/* Vendor requests (bmRequestType 0xC0) on the control endpoint. All of them
+ * return little endian binary data. */
+#define USB_MIDI_REQ_BOOT_TIME          (0x01) /* boot_time_get() */
+#define USB_MIDI_REQ_TRACE              (0x02) /* trace_snapshot() */
+#define USB_MIDI_REQ_PROFILE            (0x03) /* hotpath_get_stats(), only
+                                                  with HOTPATH_PROFILE */
+#define USB_MIDI_REQ_ROUTER             (0x04) /* midi_router_get_stats() */
+#define USB_MIDI_REQ_INPUTS             (0x05) /* 32-bit number of inputs, then
+                                                  conbus_copy_inputs() */
+#define USB_MIDI_REQ_HEALTH             (0x07) /* USB_MIDI_HEALTH_FIELDS */
+
+/* Vendor requests without a data stage (bmRequestType 0x40). */
+#define USB_MIDI_REQ_SET_RESYNC         (0x06) /* wValue 1 enables the state
+                                                  replay of midi_resync.h, 0
+                                                  disables it. Saved, stalls
+                                                  if it could not be. */
+#define USB_MIDI_REQ_SET_OUTPUT         (0x08) /* wValue output, wIndex level
+                                                  for conbus_set_output_level() */
+
+/* The USB_MIDI_REQ_HEALTH response is USB_MIDI_HEALTH_MAGIC, the number of
+ * fields which follow and then one 32-bit counter per field in this order.
+ * Counters run from reset and wrap. Fields are only ever added at the end so
+ * a host can read the ones it knows by position.
+ *
+ * SCANS                conbus scans completed
+ * SCAN_OVERRUNS        scans skipped as the previous one was still running
+ * SCAN_WORST_CYCLES    longest scan, in CPU_CLOCK cycles
+ * SCAN_DISCARDED       frames failing the double read or guard byte check
+ * CPU_CLOCK            CPU clock in Hz
+ * EVENT_OVERFLOWS      events lost to a full midi_out queue
+ * ROUTER_DROPS         packets lost to a full router queue or destination
+ * DIN_DROPS            bytes or packets lost to a full DIN ring
+ * USB_OUT_NAKS         bulk OUT NAKs reported by INAK_BO, not host retry bursts
+ * USB_CONTROL_STALLS   control requests answered with a stall
+ * PULSE_REJECTS        stop_action batches which were not queued
+ * SYSEX_UNSAVED        uploads applied but not saved to flash
+ * CONFIG_FAILURES      settings which failed to program or found no blank
+ *                      sector (until the next reset)
+ * BUS_CLOCK            conbus serial clock in Hz, calibrated or default
+ * BUS_INPUTS           conbus input bytes scanned, probed or configured
+ * BUS_OUTPUTS          conbus output bytes driven
+ * BUS_PROBE            CONBUS_PROBE_ outcome of the chain length probe
+ * DIMMING              1 if the outputs are dimmed, 0 if the bus clock was
+ *                      too slow for CONBUS_FLAG_DIMMING or it was not asked
+ * REFRESH_SKIPS        dimming frames skipped as the bus was still busy */
+#define USB_MIDI_HEALTH_MAGIC           (0x48544c48ul) /* "HLTH" */
+#define USB_MIDI_HEALTH_FIELDS(FIELD) \
+    FIELD(SCANS)                      \
+    FIELD(SCAN_OVERRUNS)              \
+    FIELD(SCAN_WORST_CYCLES)          \
+    FIELD(SCAN_DISCARDED)             \
+    FIELD(CPU_CLOCK)                  \
+    FIELD(EVENT_OVERFLOWS)            \
+    FIELD(ROUTER_DROPS)               \
+    FIELD(DIN_DROPS)                  \
+    FIELD(USB_OUT_NAKS)               \
+    FIELD(USB_CONTROL_STALLS)         \
+    FIELD(PULSE_REJECTS)              \
+    FIELD(SYSEX_UNSAVED)              \
+    FIELD(CONFIG_FAILURES)            \
+    FIELD(BUS_CLOCK)                  \
+    FIELD(BUS_INPUTS)                 \
+    FIELD(BUS_OUTPUTS)                \
+    FIELD(BUS_PROBE)                  \
+    FIELD(DIMMING)                    \
+    FIELD(REFRESH_SKIPS)
+
+#define USB_MIDI_HEALTH_ENUM_(name) USB_MIDI_HEALTH_##name,
+enum usb_midi_health_e
+{
+    USB_MIDI_HEALTH_FIELDS(USB_MIDI_HEALTH_ENUM_)
+    USB_MIDI_HEALTH_NB_FIELDS
+};
+
+void usb_midi_setup(void);
 
 #endif /* USB_MIDI_H_ */
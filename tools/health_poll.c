@@ -0,0 +1,164 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Reads the health counters (USB_MIDI_REQ_HEALTH) from a console controller
+ * and prints them as "name value" lines, once or every few seconds.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../src -o health_poll health_poll.c -lusb-1.0
+ *
+ * Usage:
+ *   health_poll [-d vid:pid] [-i seconds]
+ *
+ *   -d    USB vendor and product ID in hex (default 0000:0000)
+ *   -i    poll every so many seconds until interrupted */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <libusb-1.0/libusb.h>
+
+/* Only the constants are used from the firmware headers */
+#include "usb_midi.h"
+
+#define HEADER_SIZE     (8)
+/* Room for fields added by newer firmware */
+#define RESPONSE_SIZE   (HEADER_SIZE + 4 * 64)
+
+#define HEALTH_NAME_(name) #name,
+static const char *field_names[] =
+    {   USB_MIDI_HEALTH_FIELDS(HEALTH_NAME_)
+    };
+
+static
+uint32_t
+get_u32
+    (const unsigned char *p
+    )
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static
+int
+decode
+    (const unsigned char   *buffer
+    ,int                    len
+    )
+{
+    uint32_t nb_fields, i;
+    if ((len < HEADER_SIZE) || (get_u32(buffer) != USB_MIDI_HEALTH_MAGIC))
+    {
+        fprintf(stderr, "not a health response\n");
+        return 1;
+    }
+    nb_fields = get_u32(buffer + 4);
+    if (HEADER_SIZE + 4 * nb_fields > (uint32_t)len)
+    {
+        fprintf(stderr, "truncated response\n");
+        return 1;
+    }
+    printf("# %ld\n", (long)time(NULL));
+    for (i = 0; i < nb_fields; i++)
+    {
+        const uint32_t value = get_u32(buffer + HEADER_SIZE + 4 * i);
+        if (i < USB_MIDI_HEALTH_NB_FIELDS)
+        {
+            printf("%s %u\n", field_names[i], value);
+        }
+        else
+        {
+            printf("FIELD_%u %u\n", i, value);
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    static unsigned char buffer[RESPONSE_SIZE];
+    libusb_device_handle *dev;
+    unsigned vid = 0, pid = 0;
+    unsigned interval = 0;
+    int ret = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-d")) && (i + 1 < argc) && (sscanf(argv[i + 1], "%x:%x", &vid, &pid) == 2))
+        {
+            i++;
+        }
+        else if ((!strcmp(argv[i], "-i")) && (i + 1 < argc) && (sscanf(argv[i + 1], "%u", &interval) == 1))
+        {
+            i++;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-d vid:pid] [-i seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (libusb_init(NULL) != 0)
+    {
+        fprintf(stderr, "libusb_init failed\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, vid, pid);
+    if (!dev)
+    {
+        fprintf(stderr, "device %04x:%04x not found\n", vid, pid);
+        libusb_exit(NULL);
+        return 1;
+    }
+    do
+    {
+        const int len = libusb_control_transfer
+            (dev
+            ,LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE
+            ,USB_MIDI_REQ_HEALTH
+            ,0
+            ,0
+            ,buffer
+            ,RESPONSE_SIZE
+            ,1000
+            );
+        if (len < 0)
+        {
+            fprintf(stderr, "request failed: %s\n", libusb_error_name(len));
+            ret = 1;
+            break;
+        }
+        ret = decode(buffer, len);
+        if (interval)
+        {
+            sleep(interval);
+        }
+    } while (interval && !ret);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    return ret;
+}
@@ -0,0 +1,418 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Prints the code placement and the cycle counts of the hot functions listed
+ * in HOTPATH_POINTS (src/hotpath.h). The address and size of each function
+ * come from the linker map (or from "arm-none-eabi-nm -S" output, which also
+ * lists static functions); the cycle counts from a firmware built with
+ * HOTPATH_PROFILE, read over USB or from a saved USB_MIDI_REQ_PROFILE
+ * response.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../src -o hotpath_report hotpath_report.c -lusb-1.0
+ *
+ * Usage:
+ *   hotpath_report -m file [-d vid:pid] [-f file] [-o file]
+ *
+ *   -m    linker map or nm -S output of the firmware image
+ *   -d    USB vendor and product ID in hex (default 0000:0000)
+ *   -f    use a saved response instead of reading the device
+ *   -o    also save the raw response */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <libusb-1.0/libusb.h>
+
+/* Only the constants are used from the firmware headers. The response is
+ * decoded from bytes as long is not 32 bits everywhere. */
+#include "hotpath.h"
+#include "usb_midi.h"
+
+#define POINT_SIZE      (12)
+#define RESPONSE_SIZE   (4 + HOTPATH_NB_POINTS * POINT_SIZE)
+
+#define HOTPATH_SYMBOL_(name, symbol) #symbol,
+static const char *symbols[] =
+    {   HOTPATH_POINTS(HOTPATH_SYMBOL_)
+    };
+
+struct placement_s
+{
+    uint32_t    address;
+    uint32_t    size;
+    int         found;
+};
+
+static struct placement_s placements[HOTPATH_NB_POINTS];
+
+static
+uint32_t
+get_u32
+    (const unsigned char *p
+    )
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static
+const char *
+region_name
+    (uint32_t address
+    )
+{
+    if (address < 0x10000000ul)
+    {
+        return "flash";
+    }
+    if (address < 0x10008000ul)
+    {
+        return "RAM";
+    }
+    if ((address >= 0x2007c000ul) && (address < 0x20080000ul))
+    {
+        return "AHB SRAM0";
+    }
+    if ((address >= 0x20080000ul) && (address < 0x20084000ul))
+    {
+        return "AHB SRAM1";
+    }
+    return "?";
+}
+
+static
+int
+find_point
+    (const char *symbol
+    )
+{
+    int i;
+    for (i = 0; i < HOTPATH_NB_POINTS; i++)
+    {
+        if (!strcmp(symbols[i], symbol))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Records a function whose address is known. Sizes which are not known yet
+ * (a symbol line of a map) are fixed up once the whole map has been read. */
+static
+void
+place
+    (const char    *symbol
+    ,uint32_t       address
+    ,uint32_t       size
+    )
+{
+    const int i = find_point(symbol);
+    if ((i >= 0) && ((!placements[i].found) || (size)))
+    {
+        placements[i].address   = address;
+        placements[i].size      = size;
+        placements[i].found     = 1;
+    }
+}
+
+/* Addresses of every symbol and section end in the map, used to size the
+ * functions which only appear as symbol lines (everything placed in a shared
+ * section such as the one __RAMFUNC uses). */
+static uint32_t    *boundaries;
+static unsigned     nb_boundaries;
+
+static
+void
+add_boundary
+    (uint32_t address
+    )
+{
+    static unsigned capacity;
+    if (nb_boundaries == capacity)
+    {
+        capacity    = capacity ? (2 * capacity) : 1024;
+        boundaries  = realloc(boundaries, capacity * sizeof(*boundaries));
+        if (!boundaries)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    boundaries[nb_boundaries++] = address;
+}
+
+static
+void
+size_from_boundaries
+    (void
+    )
+{
+    int i;
+    for (i = 0; i < HOTPATH_NB_POINTS; i++)
+    {
+        if ((placements[i].found) && (!placements[i].size))
+        {
+            uint32_t next = 0;
+            unsigned j;
+            for (j = 0; j < nb_boundaries; j++)
+            {
+                if ((boundaries[j] > placements[i].address) && ((!next) || (boundaries[j] < next)))
+                {
+                    next = boundaries[j];
+                }
+            }
+            if (next)
+            {
+                placements[i].size = next - placements[i].address;
+            }
+        }
+    }
+}
+
+static
+int
+read_map
+    (const char *file_name
+    )
+{
+    char line[512];
+    char section[256] = "";
+    FILE *f = fopen(file_name, "r");
+    if (!f)
+    {
+        perror(file_name);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f))
+    {
+        char name[256];
+        char kind;
+        unsigned long address, size;
+        if (sscanf(line, "%lx %lx %c %255s", &address, &size, &kind, name) == 4)
+        {
+            /* nm -S output */
+            if (toupper((unsigned char)kind) == 'T')
+            {
+                place(name, address, size);
+            }
+        }
+        else if ((line[0] == ' ') && (line[1] == '.') && (sscanf(line, " %255s", section) == 1))
+        {
+            /* Input section, with its address and size on this line or on
+             * the next one. The per-function sections of -ffunction-sections
+             * are named after the function. */
+            const char *fn = strrchr(section + 1, '.');
+            if  (   (sscanf(line, " %*s 0x%lx 0x%lx", &address, &size) == 2)
+                ||  (   (fgets(line, sizeof(line), f))
+                    &&  (sscanf(line, " 0x%lx 0x%lx", &address, &size) == 2)
+                    )
+                )
+            {
+                add_boundary(address + size);
+                if ((fn) && (!strncmp(section, ".text.", 6)))
+                {
+                    place(fn + 1, address, size);
+                }
+            }
+        }
+        else if ((sscanf(line, " 0x%lx %255s", &address, name) == 2) && (!strchr(line, '=')) && (strncmp(name, "0x", 2)))
+        {
+            /* Symbol defined inside the current input section */
+            add_boundary(address);
+            place(name, address, 0);
+        }
+    }
+    fclose(f);
+    size_from_boundaries();
+    return 0;
+}
+
+static
+int
+read_device
+    (unsigned        vid
+    ,unsigned        pid
+    ,unsigned char  *buffer
+    )
+{
+    libusb_device_handle *dev;
+    int len = -1;
+    if (libusb_init(NULL) != 0)
+    {
+        fprintf(stderr, "libusb_init failed\n");
+        return -1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, vid, pid);
+    if (!dev)
+    {
+        fprintf(stderr, "device %04x:%04x not found\n", vid, pid);
+    }
+    else
+    {
+        len = libusb_control_transfer
+            (dev
+            ,LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE
+            ,USB_MIDI_REQ_PROFILE
+            ,0
+            ,0
+            ,buffer
+            ,RESPONSE_SIZE
+            ,1000
+            );
+        if (len < 0)
+        {
+            fprintf(stderr, "request failed (firmware built without HOTPATH_PROFILE?): %s\n", libusb_error_name(len));
+        }
+        libusb_close(dev);
+    }
+    libusb_exit(NULL);
+    return len;
+}
+
+static
+int
+report
+    (const unsigned char   *buffer
+    ,int                    len
+    )
+{
+    uint32_t cclk;
+    int i;
+    if (len != RESPONSE_SIZE)
+    {
+        fprintf(stderr, "expected a %d byte response, got %d (firmware and tool from different versions?)\n", RESPONSE_SIZE, len);
+        return 1;
+    }
+    cclk = get_u32(buffer);
+    if (cclk < 1000000)
+    {
+        fprintf(stderr, "corrupt response\n");
+        return 1;
+    }
+    printf("# CPU clock %u Hz, cycles include any interrupt which preempted the function\n", cclk);
+    printf("# %-18s %-9s %-10s %6s %10s %10s %10s %9s\n", "function", "region", "address", "bytes", "calls", "avg cyc", "max cyc", "max us");
+    for (i = 0; i < HOTPATH_NB_POINTS; i++)
+    {
+        const unsigned char *p = buffer + 4 + i * POINT_SIZE;
+        const uint32_t calls = get_u32(p);
+        const uint32_t total = get_u32(p + 4);
+        const uint32_t max   = get_u32(p + 8);
+        printf("  %-18s ", symbols[i]);
+        if (placements[i].found)
+        {
+            printf("%-9s 0x%08x %6u ", region_name(placements[i].address), placements[i].address, placements[i].size);
+        }
+        else
+        {
+            printf("%-9s %-10s %6s ", "-", "-", "-");
+        }
+        printf
+            ("%10u %10.1f %10u %9.2f\n"
+            ,calls
+            ,calls ? ((double)total / calls) : 0.0
+            ,max
+            ,(double)max * 1e6 / cclk
+            );
+    }
+    return 0;
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    static unsigned char buffer[RESPONSE_SIZE];
+    const char *map_file = NULL;
+    const char *in_file  = NULL;
+    const char *out_file = NULL;
+    unsigned vid = 0, pid = 0;
+    int len;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-d")) && (i + 1 < argc) && (sscanf(argv[i + 1], "%x:%x", &vid, &pid) == 2))
+        {
+            i++;
+        }
+        else if ((!strcmp(argv[i], "-m")) && (i + 1 < argc))
+        {
+            map_file = argv[++i];
+        }
+        else if ((!strcmp(argv[i], "-f")) && (i + 1 < argc))
+        {
+            in_file = argv[++i];
+        }
+        else if ((!strcmp(argv[i], "-o")) && (i + 1 < argc))
+        {
+            out_file = argv[++i];
+        }
+        else
+        {
+            map_file = NULL;
+            break;
+        }
+    }
+    if (!map_file)
+    {
+        fprintf(stderr, "usage: %s -m file [-d vid:pid] [-f file] [-o file]\n", argv[0]);
+        return 2;
+    }
+    if (read_map(map_file))
+    {
+        return 1;
+    }
+
+    if (in_file)
+    {
+        FILE *f = fopen(in_file, "rb");
+        if (!f)
+        {
+            perror(in_file);
+            return 1;
+        }
+        len = (int)fread(buffer, 1, sizeof(buffer), f);
+        fclose(f);
+    }
+    else
+    {
+        len = read_device(vid, pid, buffer);
+    }
+    if (len < 0)
+    {
+        return 1;
+    }
+
+    if (out_file)
+    {
+        FILE *f = fopen(out_file, "wb");
+        if ((!f) || (fwrite(buffer, 1, len, f) != (size_t)len))
+        {
+            perror(out_file);
+        }
+        if (f)
+        {
+            fclose(f);
+        }
+    }
+    return report(buffer, len);
+}
@@ -0,0 +1,235 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Decodes a captured SWO byte stream (for example the file written by
+ * OpenOCD's "tpiu config internal <file> uart off <cclk>") into the records
+ * written by itm.c. Characters on stimulus port 0 (ITM_SendChar) are passed
+ * through as they are.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../src -o itm_decode itm_decode.c
+ *
+ * Usage:
+ *   itm_decode [file]   (reads stdin without a file) */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "itm.h"
+
+#define MAX_PAYLOAD     (0x10000)
+
+static struct
+{
+    int             active;     /* header seen, payload incomplete */
+    unsigned        type;
+    unsigned        length;
+    unsigned        received;
+    unsigned char   payload[MAX_PAYLOAD];
+} record;
+
+static unsigned long nb_records;
+static unsigned long nb_truncated;
+static unsigned long nb_stray;
+static unsigned long nb_overflows;
+
+static
+void
+print_record
+    (int truncated
+    )
+{
+    unsigned i;
+    const unsigned length = (record.received < record.length) ? record.received : record.length;
+    if (truncated)
+    {
+        nb_truncated++;
+        printf("[truncated %u/%u] ", record.received, record.length);
+    }
+    switch (record.type)
+    {
+    case ITM_RECORD_TEXT:
+        printf("%.*s\n", (int)length, (const char *)record.payload);
+        break;
+    case ITM_RECORD_DUMP:
+        printf("BUF:");
+        for (i = 0; i < length; i++)
+        {
+            printf(" %02x", record.payload[i]);
+        }
+        printf("\n");
+        break;
+    default:
+        printf("record type %u, %u bytes\n", record.type, length);
+        break;
+    }
+    nb_records++;
+    record.active = 0;
+}
+
+static
+void
+on_stimulus
+    (unsigned   port
+    ,uint32_t   value
+    ,unsigned   size
+    )
+{
+    if (port == 0)
+    {
+        unsigned i;
+        for (i = 0; i < size; i++)
+        {
+            putchar((value >> (8 * i)) & 0xff);
+        }
+    }
+    else if (port == ITM_PORT_HEADER)
+    {
+        if (record.active)
+        {
+            print_record(1);
+        }
+        if ((size == 4) && ((value & 0xff) == ITM_RECORD_SYNC))
+        {
+            record.active   = 1;
+            record.type     = (value >> 8) & 0xff;
+            record.length   = value >> 16;
+            record.received = 0;
+            if (!record.length)
+            {
+                print_record(0);
+            }
+        }
+        else
+        {
+            nb_stray++;
+        }
+    }
+    else if (port == ITM_PORT_PAYLOAD)
+    {
+        unsigned i;
+        if ((!record.active) || (size != 4))
+        {
+            /* Payload of a record whose header was dropped */
+            nb_stray++;
+            return;
+        }
+        for (i = 0; (i < 4) && (record.received < record.length); i++)
+        {
+            record.payload[record.received++] = (value >> (8 * i)) & 0xff;
+        }
+        if (record.received >= record.length)
+        {
+            print_record(0);
+        }
+    }
+}
+
+/* Skip the continuation bytes of a packet whose header had bit 7 set. */
+static
+int
+skip_continuation
+    (FILE *f
+    )
+{
+    int c;
+    do
+    {
+        c = fgetc(f);
+    } while ((c != EOF) && (c & 0x80));
+    return c;
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    FILE *f = stdin;
+    int c;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [file]\n", argv[0]);
+        return 2;
+    }
+    if ((argc == 2) && (!(f = fopen(argv[1], "rb"))))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while ((c = fgetc(f)) != EOF)
+    {
+        if ((c == 0x00) || (c == 0x80))
+        {
+            /* Synchronisation packet: zeros followed by 0x80 */
+        }
+        else if (c == 0x70)
+        {
+            nb_overflows++;
+        }
+        else if (c & 0x03)
+        {
+            /* Source packet with 1, 2 or 4 bytes of payload. Bit 2 set
+             * means it came from the DWT rather than a stimulus port. */
+            const unsigned size = ((c & 0x03) == 3) ? 4 : (c & 0x03);
+            uint32_t value = 0;
+            unsigned i;
+            for (i = 0; i < size; i++)
+            {
+                const int b = fgetc(f);
+                if (b == EOF)
+                {
+                    break;
+                }
+                value |= (uint32_t)b << (8 * i);
+            }
+            if ((i == size) && (!(c & 0x04)))
+            {
+                on_stimulus(c >> 3, value, size);
+            }
+        }
+        else if (c & 0x80)
+        {
+            /* Timestamp, extension or global timestamp packet with
+             * continuation bytes */
+            if (skip_continuation(f) == EOF)
+            {
+                break;
+            }
+        }
+        /* Anything else is a single byte timestamp or extension packet. */
+    }
+    if (record.active)
+    {
+        print_record(1);
+    }
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+    fprintf
+        (stderr
+        ,"%lu records, %lu truncated, %lu stray words, %lu ITM overflows\n"
+        ,nb_records
+        ,nb_truncated
+        ,nb_stray
+        ,nb_overflows
+        );
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# LPC176x based USB MIDI Organ Console Controller
+# Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+# Checks the record framing of itm_decode against a fixed SWO capture.
+# testdata/itm_capture.bin holds, in order: a synchronisation packet,
+# characters on port 0, a text record whose last payload word is padded, a
+# timestamp with continuation bytes, a dump record, an ITM overflow, a record
+# cut short by the next header, an empty record of an unknown type, a payload
+# word without a header, a DWT packet, a text record and a record cut short
+# by the end of the capture. testdata/itm_capture.expected is the output
+# followed by the summary line.
+#
+# Usage (from this directory):
+#   ./itm_decode_test.sh
+
+set -e
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+gcc -O2 -Wall -I../src -o "$tmp/itm_decode" itm_decode.c
+"$tmp/itm_decode" testdata/itm_capture.bin > "$tmp/out" 2> "$tmp/summary"
+cat "$tmp/summary" >> "$tmp/out"
+if diff -u testdata/itm_capture.expected "$tmp/out"; then
+    echo "itm_decode: ok"
+else
+    echo "itm_decode: output differs"
+    exit 1
+fi
@@ -0,0 +1,166 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Stand-in for the CMSIS device header when conbus.c is built for the host
+ * benchmark (see sspbench.c). The SSP1 and GPIO2 registers are C++ objects
+ * which pass every access to the model in sspbench.c, so the FIFOs fill and
+ * drain at the bus clock while the interrupt runs. The timer, GPIO0 and the
+ * system control block are plain memory. Only what conbus.c uses exists.
+ *
+ * A discarded read such as "(void)LPC_SSP1->DR;" does not reach the model
+ * as no conversion of the object takes place. conbus.c only does that for
+ * the bytes ahead of the inputs when there are more outputs than inputs,
+ * which the benchmark does not allow. */
+
+#ifndef LPC17XX_H_
+#define LPC17XX_H_
+
+#include <stdint.h>
+
+#define SSPBENCH_SSP_REGISTERS(REG) \
+    REG(SSP1, CR0)                  \
+    REG(SSP1, CR1)                  \
+    REG(SSP1, DR)                   \
+    REG(SSP1, SR)                   \
+    REG(SSP1, CPSR)                 \
+    REG(SSP1, IMSC)                 \
+    REG(SSP1, RIS)                  \
+    REG(SSP1, MIS)                  \
+    REG(SSP1, ICR)                  \
+    REG(SSP1, DMACR)
+
+#define SSPBENCH_GPIO_REGISTERS(REG) \
+    REG(GPIO2, FIODIR)              \
+    REG(GPIO2, FIOMASK)             \
+    REG(GPIO2, FIOPIN)              \
+    REG(GPIO2, FIOSET)              \
+    REG(GPIO2, FIOCLR)
+
+#define SSPBENCH_REG_ENUM_(block, name) SSPBENCH_REG_##block##_##name,
+enum sspbench_reg_e
+{
+    SSPBENCH_SSP_REGISTERS(SSPBENCH_REG_ENUM_)
+    SSPBENCH_GPIO_REGISTERS(SSPBENCH_REG_ENUM_)
+    SSPBENCH_NB_REGS
+};
+
+uint32_t    sspbench_reg_read(unsigned reg);
+void        sspbench_reg_write(unsigned reg, uint32_t value);
+
+template <unsigned REG>
+class sspbench_reg
+{
+public:
+    operator uint32_t() const
+    {
+        return sspbench_reg_read(REG);
+    }
+    sspbench_reg &operator=(uint32_t value)
+    {
+        sspbench_reg_write(REG, value);
+        return *this;
+    }
+    sspbench_reg &operator|=(uint32_t value)
+    {
+        sspbench_reg_write(REG, sspbench_reg_read(REG) | value);
+        return *this;
+    }
+    sspbench_reg &operator&=(uint32_t value)
+    {
+        sspbench_reg_write(REG, sspbench_reg_read(REG) & value);
+        return *this;
+    }
+};
+
+#define SSPBENCH_REG_MEMBER_(block, name) sspbench_reg<SSPBENCH_REG_##block##_##name> name;
+typedef struct
+{
+    SSPBENCH_SSP_REGISTERS(SSPBENCH_REG_MEMBER_)
+} LPC_SSP_TypeDef;
+
+typedef struct
+{
+    SSPBENCH_GPIO_REGISTERS(SSPBENCH_REG_MEMBER_)
+} sspbench_gpio_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t FIODIR;
+    volatile uint32_t FIOMASK;
+    volatile uint32_t FIOPIN;
+    volatile uint32_t FIOSET;
+    volatile uint32_t FIOCLR;
+} LPC_GPIO_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t IR;
+    volatile uint32_t TCR;
+    volatile uint32_t TC;
+    volatile uint32_t PR;
+    volatile uint32_t PC;
+    volatile uint32_t MCR;
+    volatile uint32_t MR0;
+    volatile uint32_t MR1;
+    volatile uint32_t MR2;
+    volatile uint32_t MR3;
+    volatile uint32_t CTCR;
+} LPC_TIM_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t ICSR;
+} SCB_Type;
+
+#define SCB_ICSR_PENDSVSET_Msk  (1UL << 28)
+
+extern LPC_SSP_TypeDef          sspbench_ssp1;
+extern sspbench_gpio_TypeDef    sspbench_gpio2;
+extern LPC_GPIO_TypeDef         sspbench_gpio0;
+extern LPC_TIM_TypeDef          sspbench_tim0;
+extern SCB_Type                 sspbench_scb;
+
+#define LPC_SSP1                (&sspbench_ssp1)
+#define LPC_GPIO2               (&sspbench_gpio2)
+#define LPC_GPIO0               (&sspbench_gpio0)
+#define LPC_TIM0                (&sspbench_tim0)
+#define SCB                     (&sspbench_scb)
+
+typedef enum
+{
+    PendSV_IRQn     = -2,
+    TIMER0_IRQn     = 1,
+    SSP1_IRQn       = 15
+} IRQn_Type;
+
+void        NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void        NVIC_EnableIRQ(IRQn_Type irq);
+void        NVIC_DisableIRQ(IRQn_Type irq);
+
+/* The benchmark runs one handler at a time, so PRIMASK is only recorded. */
+uint32_t    __get_PRIMASK(void);
+void        __set_PRIMASK(uint32_t primask);
+void        __disable_irq(void);
+void        __enable_irq(void);
+
+/* Single core host model: a compiler barrier is all the ordering needed. */
+static inline void __DMB(void)
+{
+    __asm__ volatile ("" ::: "memory");
+}
+
+#endif /* LPC17XX_H_ */
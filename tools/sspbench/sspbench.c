@@ -0,0 +1,878 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Host benchmark of the conbus scan interrupt (SSP1_IRQHandler). The real
+ * conbus.c runs against a model of the SSP1 controller with its 8 byte
+ * transmit and receive FIFOs shifting at the bus clock, the shift register
+ * chains of the console on the other side, and the scan timer. Every scan
+ * checks that the frame went through: each input change is reported by
+ * the debouncing and every output latch shows the plane which was sent.
+ *
+ * conbus.c is built once per kernel, the generic one which takes the bus
+ * lengths from the configuration and the fixed-geometry one selected by
+ * CONBUS_FIXED_INPUTS_DIV_8 and CONBUS_FIXED_OUTPUTS_DIV_8, and both are
+ * run with the same options to compare them. For the handler the benchmark
+ * reports the interrupts, the SSP1 and GPIO2 register accesses by register
+ * and the cycles they cost in the model.
+ *
+ * The model prices register accesses and exception entry and return only:
+ * the instructions in between are not counted, so the cycles are a lower
+ * bound. They are the part the two kernels differ in, as the fixed one
+ * exists to poll SR less.
+ *
+ * Build (generic, then fixed for 64 input and 8 output registers):
+ *   g++ -O2 -Wall -x c++ -I. -I../../src -o sspbench_generic sspbench.c \
+ *       ../../src/conbus.c
+ *   g++ -O2 -Wall -x c++ -I. -I../../src -DCONBUS_FIXED_INPUTS_DIV_8=64 \
+ *       -DCONBUS_FIXED_OUTPUTS_DIV_8=8 -o sspbench_fixed sspbench.c \
+ *       ../../src/conbus.c
+ *
+ * Usage:
+ *   sspbench_generic [-i inputs] [-o outputs] [options]
+ *   sspbench_fixed [options]
+ *
+ *   -i    input registers (default 64), fixed builds take CONBUS_FIXED_
+ *   -o    output registers (default 8), at most as many as inputs
+ *   -b    bus clock in Hz (default 1000000)
+ *   -c    CPU clock in Hz (default 120000000)
+ *   -a    CPU cycles per SSP1 access (default 4, the APB at CCLK/4)
+ *   -e    CPU cycles of exception entry and return (default 24)
+ *   -n    scans to run (default 200)
+ *   -f    conbus flags (CONBUS_FLAG_, default 0)
+ *   -v    print model errors as they happen
+ *
+ * The exit status is non-zero if a check failed, the model saw an access
+ * the hardware would not have done what conbus expected with, or an ASSERT
+ * in conbus failed.
+ *
+ * The bit-band aliases, the conbus memory and the cycle counter are at
+ * fixed addresses on the part, so those pages are mapped at the same
+ * addresses in the host process. The alias pages are plain memory and
+ * unsigned long is 8 bytes on the host, so what conbus stores through them
+ * is not read back: the inputs are checked as on_input_changed reports
+ * them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "LPC17xx.h"
+#include "conbus.h"
+#include "lpc176x_ssp1.h"
+#include "lpc176x_clock.h"
+#include "boot_time.h"
+#include "bitband.h"
+#include "cycles.h"
+#include "trace.h"
+
+/* Exception handlers of conbus.c */
+void SSP1_IRQHandler(void);
+void TIMER0_IRQHandler(void);
+void PendSV_Handler(void);
+
+#if defined(CONBUS_FIXED_INPUTS_DIV_8) && defined(CONBUS_FIXED_OUTPUTS_DIV_8)
+#define KERNEL_NAME             "fixed"
+#define DEFAULT_INPUTS_DIV_8    (CONBUS_FIXED_INPUTS_DIV_8)
+#define DEFAULT_OUTPUTS_DIV_8   (CONBUS_FIXED_OUTPUTS_DIV_8)
+#else
+#define KERNEL_NAME             "generic"
+#define DEFAULT_INPUTS_DIV_8    (64)
+#define DEFAULT_OUTPUTS_DIV_8   (8)
+#endif
+
+#define MAX_INPUTS_DIV_8        (256)
+#define FIFO_DEPTH              (8)
+#define GUARD_VALUE             (0xa5)
+
+/* Where main.c puts the conbus memory: the AHB SRAM */
+#define CONBUS_MEMORY_ADDRESS   (0x2007c000ul)
+#define PAGE_SIZE               (0x1000ul)
+
+#define SSP_SR_TFE              (1 << 0)
+#define SSP_SR_TNF              (1 << 1)
+#define SSP_SR_RNE              (1 << 2)
+#define SSP_SR_RFF              (1 << 3)
+#define SSP_SR_BSY              (1 << 4)
+#define SSP_INT_ROR             (1 << 0)
+#define SSP_INT_RT              (1 << 1)
+#define SSP_INT_RX              (1 << 2)
+#define SSP_INT_TX              (1 << 3)
+#define LOAD_PIN                (1 << 13)
+
+LPC_SSP_TypeDef             sspbench_ssp1;
+sspbench_gpio_TypeDef       sspbench_gpio2;
+LPC_GPIO_TypeDef            sspbench_gpio0;
+LPC_TIM_TypeDef             sspbench_tim0;
+SCB_Type                    sspbench_scb;
+
+struct fifo_s
+{
+    unsigned char   data[FIFO_DEPTH];
+    unsigned        head;   /* free running */
+    unsigned        tail;
+};
+
+/* The controller and the console */
+struct model_s
+{
+    unsigned long long  now;            /* CPU cycles */
+    unsigned long long  byte_cycles;    /* one byte on the bus */
+    struct fifo_s       tx;
+    struct fifo_s       rx;
+    int                 shifting;
+    unsigned long long  shift_done;     /* when the byte on the bus is in */
+    unsigned char       shift_byte;
+    unsigned long long  rx_activity;    /* last receive or RT clear */
+    int                 overrun;        /* ROR raised */
+    uint32_t            imsc;
+    uint32_t            pins;           /* GPIO2 */
+    uint32_t            regs[SSPBENCH_NB_REGS];
+    unsigned            frame_pos;      /* bytes shifted since the load */
+    unsigned char       inputs[MAX_INPUTS_DIV_8];
+    unsigned char       chain[MAX_INPUTS_DIV_8]; /* output registers */
+    unsigned long       latches;
+};
+
+struct counters_s
+{
+    unsigned long long  accesses[SSPBENCH_NB_REGS];
+    unsigned long long  interrupts;
+    unsigned long long  cycles;
+    unsigned long long  worst_cycles;
+};
+
+static const char          *g_reg_names[SSPBENCH_NB_REGS] =
+    {
+#define SSPBENCH_REG_NAME_(block, name) #block "->" #name,
+        SSPBENCH_SSP_REGISTERS(SSPBENCH_REG_NAME_)
+        SSPBENCH_GPIO_REGISTERS(SSPBENCH_REG_NAME_)
+    };
+
+static struct model_s       g_model;
+static struct counters_s    g_handler;      /* in SSP1_IRQHandler */
+static unsigned             g_access_cycles = 4;
+static unsigned             g_irq_cycles    = 24;
+static unsigned long        g_cclk          = 120000000ul;
+static unsigned long        g_baud          = 1000000ul;
+static int                  g_verbose;
+static unsigned             g_nb_inputs_div_8;
+static unsigned             g_nb_outputs_div_8;
+static unsigned char       *g_memory;
+static unsigned char        g_state[8 * MAX_INPUTS_DIV_8]; /* as reported */
+static unsigned long        g_errors;
+static unsigned long        g_failures;
+static unsigned long        g_asserts;
+static uint32_t             g_primask;
+
+static
+void
+model_error
+    (const char *format
+    ,...
+    )
+{
+    g_errors++;
+    if (g_verbose)
+    {
+        va_list args;
+        va_start(args, format);
+        fprintf(stderr, "sspbench: ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+    }
+}
+
+static
+void
+check
+    (int         ok
+    ,const char *format
+    ,...
+    )
+{
+    if (!ok)
+    {
+        va_list args;
+        va_start(args, format);
+        printf("FAIL: ");
+        vprintf(format, args);
+        printf("\n");
+        va_end(args);
+        g_failures++;
+    }
+}
+
+static
+unsigned
+fifo_count
+    (const struct fifo_s *fifo
+    )
+{
+    return fifo->head - fifo->tail;
+}
+
+/* One byte has been clocked: the byte sent goes into the output chain and
+ * the next input byte comes back. The inputs start the frame as conbus has
+ * at least as many input registers as output ones here. */
+static
+void
+model_byte_done
+    (void
+    )
+{
+    const unsigned nb_outputs = g_nb_outputs_div_8;
+    const unsigned char in    = (g_model.frame_pos < g_nb_inputs_div_8) ? g_model.inputs[g_model.frame_pos] : 0;
+    if (nb_outputs)
+    {
+        memmove(&g_model.chain[0], &g_model.chain[1], nb_outputs - 1);
+        g_model.chain[nb_outputs - 1] = g_model.shift_byte;
+    }
+    g_model.frame_pos++;
+    if (fifo_count(&g_model.rx) == FIFO_DEPTH)
+    {
+        g_model.overrun = 1;
+        model_error("receive FIFO overrun at frame byte %u", g_model.frame_pos - 1);
+    }
+    else
+    {
+        g_model.rx.data[g_model.rx.head++ % FIFO_DEPTH] = in;
+    }
+    g_model.rx_activity = g_model.shift_done;
+}
+
+static
+void
+model_run_until
+    (unsigned long long t
+    )
+{
+    while ((g_model.shifting) && (g_model.shift_done <= t))
+    {
+        model_byte_done();
+        if (fifo_count(&g_model.tx))
+        {
+            g_model.shift_byte  = g_model.tx.data[g_model.tx.tail++ % FIFO_DEPTH];
+            g_model.shift_done += g_model.byte_cycles;
+        }
+        else
+        {
+            g_model.shifting    = 0;
+        }
+    }
+    CYCLES_DWT_CYCCNT = (unsigned long)(g_model.now & 0xfffffffful);
+}
+
+static
+void
+model_advance
+    (unsigned long long cycles
+    )
+{
+    g_model.now += cycles;
+    model_run_until(g_model.now);
+}
+
+/* Receive timeout: data in the receive FIFO and nothing received or read
+ * for 32 bit periods */
+static
+unsigned long long
+model_rt_time
+    (void
+    )
+{
+    return g_model.rx_activity + 4 * g_model.byte_cycles;
+}
+
+static
+uint32_t
+model_ris
+    (void
+    )
+{
+    uint32_t ris = 0;
+    if (g_model.overrun)
+    {
+        ris |= SSP_INT_ROR;
+    }
+    if ((fifo_count(&g_model.rx)) && (g_model.now >= model_rt_time()))
+    {
+        ris |= SSP_INT_RT;
+    }
+    if (fifo_count(&g_model.rx) >= FIFO_DEPTH / 2)
+    {
+        ris |= SSP_INT_RX;
+    }
+    if (fifo_count(&g_model.tx) <= FIFO_DEPTH / 2)
+    {
+        ris |= SSP_INT_TX;
+    }
+    return ris;
+}
+
+static
+uint32_t
+model_sr
+    (void
+    )
+{
+    uint32_t sr = 0;
+    if (!fifo_count(&g_model.tx))
+    {
+        sr |= SSP_SR_TFE;
+    }
+    if (fifo_count(&g_model.tx) < FIFO_DEPTH)
+    {
+        sr |= SSP_SR_TNF;
+    }
+    if (fifo_count(&g_model.rx))
+    {
+        sr |= SSP_SR_RNE;
+    }
+    if (fifo_count(&g_model.rx) == FIFO_DEPTH)
+    {
+        sr |= SSP_SR_RFF;
+    }
+    if ((g_model.shifting) || (fifo_count(&g_model.tx)))
+    {
+        sr |= SSP_SR_BSY;
+    }
+    return sr;
+}
+
+static
+void
+model_access
+    (unsigned reg
+    )
+{
+    g_model.regs[reg]++;
+    /* GPIO is on the AHB and takes a cycle, SSP1 on the APB */
+    model_advance((reg >= SSPBENCH_REG_GPIO2_FIODIR) ? 1 : g_access_cycles);
+}
+
+uint32_t
+sspbench_reg_read
+    (unsigned reg
+    )
+{
+    model_access(reg);
+    switch (reg)
+    {
+    case SSPBENCH_REG_SSP1_DR:
+        if (!fifo_count(&g_model.rx))
+        {
+            model_error("read of an empty receive FIFO");
+            return 0;
+        }
+        g_model.rx_activity = g_model.now;
+        return g_model.rx.data[g_model.rx.tail++ % FIFO_DEPTH];
+    case SSPBENCH_REG_SSP1_SR:
+        return model_sr();
+    case SSPBENCH_REG_SSP1_RIS:
+        return model_ris();
+    case SSPBENCH_REG_SSP1_MIS:
+        return model_ris() & g_model.imsc;
+    case SSPBENCH_REG_SSP1_IMSC:
+        return g_model.imsc;
+    case SSPBENCH_REG_GPIO2_FIOPIN:
+    case SSPBENCH_REG_GPIO2_FIOSET:
+        return g_model.pins;
+    default:
+        return 0;
+    }
+}
+
+void
+sspbench_reg_write
+    (unsigned reg
+    ,uint32_t value
+    )
+{
+    model_access(reg);
+    switch (reg)
+    {
+    case SSPBENCH_REG_SSP1_DR:
+        if (fifo_count(&g_model.tx) == FIFO_DEPTH)
+        {
+            model_error("write to a full transmit FIFO");
+        }
+        else if (!g_model.shifting)
+        {
+            g_model.shift_byte  = (unsigned char)value;
+            g_model.shift_done  = g_model.now + g_model.byte_cycles;
+            g_model.shifting    = 1;
+        }
+        else
+        {
+            g_model.tx.data[g_model.tx.head++ % FIFO_DEPTH] = (unsigned char)value;
+        }
+        break;
+    case SSPBENCH_REG_SSP1_IMSC:
+        g_model.imsc = value & 0xf;
+        break;
+    case SSPBENCH_REG_SSP1_ICR:
+        if (value & SSP_INT_ROR)
+        {
+            g_model.overrun = 0;
+        }
+        if (value & SSP_INT_RT)
+        {
+            g_model.rx_activity = g_model.now;
+        }
+        break;
+    case SSPBENCH_REG_GPIO2_FIOSET:
+        if ((value & LOAD_PIN) && (!(g_model.pins & LOAD_PIN)))
+        {
+            /* Shift mode: the input registers hold what they loaded */
+            if ((g_model.shifting) || (fifo_count(&g_model.tx)) || (fifo_count(&g_model.rx)))
+            {
+                model_error("frame started with bytes still in the FIFOs");
+            }
+            g_model.frame_pos = 0;
+        }
+        g_model.pins |= value;
+        break;
+    case SSPBENCH_REG_GPIO2_FIOCLR:
+        if ((value & LOAD_PIN) && (g_model.pins & LOAD_PIN))
+        {
+            const unsigned       nb_outputs = g_nb_outputs_div_8;
+            const unsigned char *planes     = g_memory;
+            unsigned             plane;
+            /* Outputs latch, which has to be one of the bit planes */
+            for (plane = 0; plane < CONBUS_OUTPUT_BITS; plane++)
+            {
+                if (!memcmp(g_model.chain, planes + plane * nb_outputs, nb_outputs))
+                {
+                    break;
+                }
+            }
+            check(plane < CONBUS_OUTPUT_BITS, "latch %lu: outputs are not a bit plane", g_model.latches);
+            g_model.latches++;
+        }
+        g_model.pins &= ~value;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Stand-ins for what conbus.c calls */
+
+void
+ssp1_setup
+    (const struct ssp_config_s *config
+    )
+{
+    (void)config;
+}
+
+unsigned long
+ssp1_set_baud_rate
+    (unsigned long baud_rate
+    )
+{
+    (void)baud_rate;
+    return g_baud;
+}
+
+unsigned long
+clock_get_cclk
+    (void
+    )
+{
+    return g_cclk;
+}
+
+unsigned long
+clock_set_pclk
+    (unsigned peripheral
+    ,unsigned divider
+    )
+{
+    (void)peripheral;
+    return g_cclk / divider;
+}
+
+void
+boot_time_mark
+    (unsigned phase
+    )
+{
+    (void)phase;
+}
+
+void
+trace_write
+    (unsigned       event
+    ,unsigned long  a
+    ,unsigned long  b
+    )
+{
+    if (event == TRACE_EVENT_ASSERT)
+    {
+        fprintf(stderr, "sspbench: ASSERT failed at line %lu of %s\n", a, (const char *)b);
+        g_asserts++;
+    }
+}
+
+void
+NVIC_SetPriority
+    (IRQn_Type  irq
+    ,uint32_t   priority
+    )
+{
+    (void)irq;
+    (void)priority;
+}
+
+void
+NVIC_EnableIRQ
+    (IRQn_Type irq
+    )
+{
+    (void)irq;
+}
+
+void
+NVIC_DisableIRQ
+    (IRQn_Type irq
+    )
+{
+    (void)irq;
+}
+
+uint32_t
+__get_PRIMASK
+    (void
+    )
+{
+    return g_primask;
+}
+
+void
+__set_PRIMASK
+    (uint32_t primask
+    )
+{
+    g_primask = primask;
+}
+
+void
+__disable_irq
+    (void
+    )
+{
+    g_primask = 1;
+}
+
+void
+__enable_irq
+    (void
+    )
+{
+    g_primask = 0;
+}
+
+/* The benchmark */
+
+static
+void
+input_changed
+    (unsigned   input
+    ,int        active
+    )
+{
+    g_state[input] = (unsigned char)active;
+}
+
+static
+void *
+map_fixed
+    (unsigned long  address
+    ,unsigned long  size
+    )
+{
+    void *p = mmap
+        ((void *)address
+        ,(size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)
+        ,PROT_READ | PROT_WRITE
+        ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE
+        ,-1
+        ,0
+        );
+    if (p != (void *)address)
+    {
+        fprintf(stderr, "sspbench: cannot map %08lx\n", address);
+        exit(2);
+    }
+    return p;
+}
+
+static
+void
+fill_pattern
+    (unsigned char *dst
+    ,unsigned       length
+    ,unsigned      *lfsr
+    )
+{
+    unsigned i;
+    for (i = 0; i < length; i++)
+    {
+        unsigned j;
+        for (j = 0; j < 8; j++)
+        {
+            *lfsr = (*lfsr >> 1) ^ ((*lfsr & 1) ? 0xb400u : 0);
+        }
+        dst[i] = *lfsr & 0xff;
+    }
+}
+
+/* Inputs held by the console: a pattern which changes halfway through the
+ * run so that presses and releases are both debounced */
+static
+void
+set_inputs
+    (unsigned   seed
+    ,unsigned   flags
+    )
+{
+    unsigned lfsr = seed;
+    fill_pattern(g_model.inputs, g_nb_inputs_div_8, &lfsr);
+    if (flags & CONBUS_FLAG_GUARD_BYTE)
+    {
+        g_model.inputs[g_nb_inputs_div_8 - 1] = GUARD_VALUE;
+    }
+}
+
+static
+void
+handler_call
+    (void        (*handler)(void)
+    ,struct counters_s *counters
+    )
+{
+    const unsigned long long start = g_model.now;
+    unsigned long long saved[SSPBENCH_NB_REGS];
+    unsigned long long cycles;
+    unsigned reg;
+    for (reg = 0; reg < SSPBENCH_NB_REGS; reg++)
+    {
+        saved[reg] = g_model.regs[reg];
+    }
+    model_advance(g_irq_cycles);
+    handler();
+    if (counters)
+    {
+        cycles = g_model.now - start;
+        counters->interrupts++;
+        counters->cycles += cycles;
+        if (cycles > counters->worst_cycles)
+        {
+            counters->worst_cycles = cycles;
+        }
+        for (reg = 0; reg < SSPBENCH_NB_REGS; reg++)
+        {
+            counters->accesses[reg] += g_model.regs[reg] - saved[reg];
+        }
+    }
+}
+
+int
+main
+    (int    argc
+    ,char **argv
+    )
+{
+    struct conbus_config_s  cfg;
+    struct conbus_stats_s   stats;
+    unsigned                nb_scans    = 200;
+    unsigned                flags       = 0;
+    unsigned                scans       = 0;
+    unsigned long long      period;
+    unsigned long long      period_start = 0;
+    unsigned long long      next_mr1;
+    unsigned long long      total_accesses = 0;
+    unsigned                memory_size;
+    unsigned                input;
+    unsigned                reg;
+    int                     opt;
+
+    g_nb_inputs_div_8  = DEFAULT_INPUTS_DIV_8;
+    g_nb_outputs_div_8 = DEFAULT_OUTPUTS_DIV_8;
+    while ((opt = getopt(argc, argv, "i:o:b:c:a:e:n:f:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': g_nb_inputs_div_8  = strtoul(optarg, NULL, 0); break;
+        case 'o': g_nb_outputs_div_8 = strtoul(optarg, NULL, 0); break;
+        case 'b': g_baud             = strtoul(optarg, NULL, 0); break;
+        case 'c': g_cclk             = strtoul(optarg, NULL, 0); break;
+        case 'a': g_access_cycles    = strtoul(optarg, NULL, 0); break;
+        case 'e': g_irq_cycles       = strtoul(optarg, NULL, 0); break;
+        case 'n': nb_scans           = strtoul(optarg, NULL, 0); break;
+        case 'f': flags              = strtoul(optarg, NULL, 0); break;
+        case 'v': g_verbose          = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-i inputs] [-o outputs] [-b baud] [-c cclk] [-a cycles] [-e cycles] [-n scans] [-f flags] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if  (   (g_nb_inputs_div_8 < 1)
+        ||  (g_nb_inputs_div_8 > MAX_INPUTS_DIV_8)
+        ||  (g_nb_outputs_div_8 > g_nb_inputs_div_8)
+        ||  (g_baud < 1)
+        ||  (g_baud > g_cclk / 2)
+        ||  (nb_scans < 40)
+        ||  (flags & (CONBUS_FLAG_CALIBRATE | CONBUS_FLAG_PROBE))
+        )
+    {
+        fprintf(stderr, "sspbench: needs 1 to %u inputs, no more outputs than inputs, a bus clock up to CCLK/2, 40 scans or more and no calibration or probe\n", MAX_INPUTS_DIV_8);
+        return 2;
+    }
+#if defined(CONBUS_FIXED_INPUTS_DIV_8) && defined(CONBUS_FIXED_OUTPUTS_DIV_8)
+    if ((g_nb_inputs_div_8 != CONBUS_FIXED_INPUTS_DIV_8) || (g_nb_outputs_div_8 != CONBUS_FIXED_OUTPUTS_DIV_8))
+    {
+        fprintf(stderr, "sspbench: this build is fixed to %u input and %u output registers\n", CONBUS_FIXED_INPUTS_DIV_8, CONBUS_FIXED_OUTPUTS_DIV_8);
+        return 2;
+    }
+#endif
+
+    /* The conbus memory in the bit-banded SRAM, its aliases and the cycle
+     * counter. The debouncer reads the frame a word at a time, which is 8
+     * bytes on the host, hence the slack. */
+    memory_size = CONBUS_MEMORY_SIZE(g_nb_inputs_div_8, g_nb_outputs_div_8) + 8;
+    g_memory    = (unsigned char *)map_fixed(CONBUS_MEMORY_ADDRESS, memory_size);
+    (void)map_fixed((unsigned long)bitband_sram(g_memory), 32 * memory_size);
+    (void)map_fixed((unsigned long)&CYCLES_DWT_CYCCNT & ~(PAGE_SIZE - 1), PAGE_SIZE);
+
+    g_model.byte_cycles = 8ull * g_cclk / g_baud;
+    cfg.nb_inputs_div_8  = g_nb_inputs_div_8;
+    cfg.nb_outputs_div_8 = g_nb_outputs_div_8;
+    cfg.on_input_changed = input_changed;
+    cfg.flags            = flags;
+    cfg.guard_value      = GUARD_VALUE;
+    cfg.debounce_ticks   = 0;
+    cfg.on_scan          = NULL;
+    cfg.baud_rate        = g_baud;
+    conbus_init(&cfg, g_memory);
+    {
+        /* Different bytes in every output bit plane */
+        unsigned lfsr = 0x1234u;
+        fill_pattern(g_memory, CONBUS_OUTPUT_BITS * g_nb_outputs_div_8, &lfsr);
+    }
+    set_inputs(0xace1u, flags);
+
+    period   = (unsigned long long)CONBUS_SCAN_PERIOD_US * g_cclk / 1000000ul;
+    next_mr1 = ~0ull;
+    sspbench_tim0.IR = 1;
+    while (scans < nb_scans)
+    {
+        const unsigned long long next_mr0 = period_start + period;
+        if (g_model.now >= next_mr0)
+        {
+            /* MR0 starts the scan period and restarts the timer */
+            period_start = next_mr0;
+            scans++;
+            if (scans == nb_scans / 2)
+            {
+                set_inputs(0x5eedu, flags);
+            }
+            sspbench_tim0.IR = 1;
+            handler_call(TIMER0_IRQHandler, NULL);
+            next_mr1 = (conbus_get_dimming()) ? period_start + (unsigned long long)sspbench_tim0.MR1 * g_cclk / 1000000ul : ~0ull;
+        }
+        else if (g_model.now >= next_mr1)
+        {
+            /* MR1 starts the other slots of a dimmed scan period. A match
+             * which is not later in the period comes after the restart. */
+            const unsigned long long match = next_mr1;
+            sspbench_tim0.IR = 2;
+            handler_call(TIMER0_IRQHandler, NULL);
+            next_mr1 = period_start + (unsigned long long)sspbench_tim0.MR1 * g_cclk / 1000000ul;
+            if ((next_mr1 <= match) || (next_mr1 >= period_start + period))
+            {
+                next_mr1 = ~0ull;
+            }
+        }
+        else if (model_ris() & g_model.imsc)
+        {
+            handler_call(SSP1_IRQHandler, &g_handler);
+        }
+        else if (sspbench_scb.ICSR & SCB_ICSR_PENDSVSET_Msk)
+        {
+            sspbench_scb.ICSR = 0;
+            handler_call(PendSV_Handler, NULL);
+        }
+        else
+        {
+            /* Nothing to run until the next byte, timeout or timer match */
+            unsigned long long next = (next_mr0 < next_mr1) ? next_mr0 : next_mr1;
+            if ((g_model.shifting) && (g_model.shift_done < next))
+            {
+                next = g_model.shift_done;
+            }
+            if ((fifo_count(&g_model.rx)) && (model_rt_time() > g_model.now) && (model_rt_time() < next))
+            {
+                next = model_rt_time();
+            }
+            g_model.now = next;
+            model_run_until(next);
+        }
+    }
+
+    /* Every input has to be reported as it is held now */
+    for (input = 0; input < 8 * (g_nb_inputs_div_8 - ((flags & CONBUS_FLAG_GUARD_BYTE) ? 1 : 0)); input++)
+    {
+        const int active = (g_model.inputs[input / 8] >> (input % 8)) & 1;
+        check(g_state[input] == active, "input %u reported %s", input, (g_state[input]) ? "active" : "released");
+    }
+    conbus_get_stats(&stats);
+    check(stats.frames + 1 >= nb_scans, "%lu frames in %u scans", stats.frames, nb_scans);
+    check(!stats.overruns, "%lu overruns", stats.overruns);
+    check(!stats.skipped_refreshes, "%lu skipped refresh frames", stats.skipped_refreshes);
+    check(!stats.mismatched, "%lu mismatched frames", stats.mismatched);
+    check(!stats.bad_guard, "%lu frames with a bad guard", stats.bad_guard);
+    check(g_model.latches >= stats.frames, "%lu latches for %lu frames", g_model.latches, stats.frames);
+
+    printf("kernel          %s, %u input and %u output registers, flags 0x%x\n"
+        , KERNEL_NAME, g_nb_inputs_div_8, g_nb_outputs_div_8, flags);
+    printf("bus             %lu Hz (%llu cycles a byte), CCLK %lu Hz\n"
+        , g_baud, g_model.byte_cycles, g_cclk);
+    printf("scans           %u, %lu frames, worst %lu cycles from tick to last byte\n"
+        , nb_scans, stats.frames, stats.worst_cycles);
+    printf("SSP1_IRQHandler per scan:\n");
+    printf("  interrupts    %10.1f\n", (double)g_handler.interrupts / stats.frames);
+    for (reg = 0; reg < SSPBENCH_NB_REGS; reg++)
+    {
+        if (g_handler.accesses[reg])
+        {
+            printf("  %-14s%10.1f\n", g_reg_names[reg], (double)g_handler.accesses[reg] / stats.frames);
+            total_accesses += g_handler.accesses[reg];
+        }
+    }
+    printf("  accesses      %10.1f\n", (double)total_accesses / stats.frames);
+    printf("  cycles        %10.1f (worst interrupt %llu, %.2f%% of the CPU)\n"
+        , (double)g_handler.cycles / stats.frames
+        , g_handler.worst_cycles
+        , 100.0 * g_handler.cycles / g_model.now);
+    printf("%lu checks failed, %lu model errors, %lu asserts\n", g_failures, g_errors, g_asserts);
+    return ((g_failures) || (g_errors) || (g_asserts)) ? 1 : 0;
+}
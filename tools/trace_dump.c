@@ -0,0 +1,218 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Reads the event trace from a console controller over USB (or from a file
+ * holding a raw USB_MIDI_REQ_TRACE response) and prints it.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I../src -o trace_dump trace_dump.c -lusb-1.0
+ *
+ * Usage:
+ *   trace_dump [-d vid:pid] [-f file] [-o file]
+ *
+ *   -d    USB vendor and product ID in hex (default 0000:0000)
+ *   -f    decode a saved response instead of reading the device
+ *   -o    also save the raw response */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libusb-1.0/libusb.h>
+
+/* Only the constants are used from the firmware headers. The records are
+ * decoded from bytes as long is not 32 bits everywhere. */
+#include "trace.h"
+#include "usb_midi.h"
+
+#define HEADER_SIZE     (16)
+#define RECORD_SIZE     (16)
+#define RESPONSE_SIZE   (HEADER_SIZE + TRACE_NB_RECORDS * RECORD_SIZE)
+
+#define TRACE_NAME_(name) #name,
+static const char *event_names[] =
+    {   "NONE"
+    ,   TRACE_EVENTS(TRACE_NAME_)
+    };
+
+static
+uint32_t
+get_u32
+    (const unsigned char *p
+    )
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static
+int
+read_device
+    (unsigned        vid
+    ,unsigned        pid
+    ,unsigned char  *buffer
+    )
+{
+    libusb_device_handle *dev;
+    int len = -1;
+    if (libusb_init(NULL) != 0)
+    {
+        fprintf(stderr, "libusb_init failed\n");
+        return -1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, vid, pid);
+    if (!dev)
+    {
+        fprintf(stderr, "device %04x:%04x not found\n", vid, pid);
+    }
+    else
+    {
+        len = libusb_control_transfer
+            (dev
+            ,LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE
+            ,USB_MIDI_REQ_TRACE
+            ,0
+            ,0
+            ,buffer
+            ,RESPONSE_SIZE
+            ,1000
+            );
+        if (len < 0)
+        {
+            fprintf(stderr, "request failed: %s\n", libusb_error_name(len));
+        }
+        libusb_close(dev);
+    }
+    libusb_exit(NULL);
+    return len;
+}
+
+static
+int
+decode
+    (const unsigned char   *buffer
+    ,int                    len
+    )
+{
+    uint32_t total, cclk, nb_records, i;
+    uint32_t first_cycles = 0;
+    if ((len < HEADER_SIZE) || (get_u32(buffer) != TRACE_MAGIC))
+    {
+        fprintf(stderr, "not a trace response\n");
+        return 1;
+    }
+    total       = get_u32(buffer + 4);
+    cclk        = get_u32(buffer + 8);
+    nb_records  = get_u32(buffer + 12);
+    if ((nb_records > TRACE_NB_RECORDS) || (HEADER_SIZE + nb_records * RECORD_SIZE > (uint32_t)len) || (cclk < 1000000))
+    {
+        fprintf(stderr, "truncated or corrupt response\n");
+        return 1;
+    }
+    printf("# %u events since reset, showing the last %u, CPU clock %u Hz\n", total, nb_records, cclk);
+    printf("# %12s %8s  %-18s %-10s %-10s\n", "time (us)", "seq", "event", "a", "b");
+    for (i = 0; i < nb_records; i++)
+    {
+        const unsigned char *r = buffer + HEADER_SIZE + i * RECORD_SIZE;
+        const uint32_t cycles = get_u32(r);
+        const uint32_t event  = get_u32(r + 4);
+        /* Times are relative to the oldest record (the counter wraps every
+         * few tens of seconds, which only matters between records that far
+         * apart). */
+        if (i == 0)
+        {
+            first_cycles = cycles;
+        }
+        printf
+            ("  %12.1f %8u  %-18s 0x%08x 0x%08x\n"
+            ,(double)(uint32_t)(cycles - first_cycles) * 1e6 / cclk
+            ,total - nb_records + i
+            ,(event < TRACE_NB_EVENTS) ? event_names[event] : "?"
+            ,get_u32(r + 8)
+            ,get_u32(r + 12)
+            );
+    }
+    return 0;
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    static unsigned char buffer[RESPONSE_SIZE];
+    const char *in_file  = NULL;
+    const char *out_file = NULL;
+    unsigned vid = 0, pid = 0;
+    int len;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-d")) && (i + 1 < argc) && (sscanf(argv[i + 1], "%x:%x", &vid, &pid) == 2))
+        {
+            i++;
+        }
+        else if ((!strcmp(argv[i], "-f")) && (i + 1 < argc))
+        {
+            in_file = argv[++i];
+        }
+        else if ((!strcmp(argv[i], "-o")) && (i + 1 < argc))
+        {
+            out_file = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-d vid:pid] [-f file] [-o file]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (in_file)
+    {
+        FILE *f = fopen(in_file, "rb");
+        if (!f)
+        {
+            perror(in_file);
+            return 1;
+        }
+        len = (int)fread(buffer, 1, sizeof(buffer), f);
+        fclose(f);
+    }
+    else
+    {
+        len = read_device(vid, pid, buffer);
+    }
+    if (len < 0)
+    {
+        return 1;
+    }
+
+    if (out_file)
+    {
+        FILE *f = fopen(out_file, "wb");
+        if ((!f) || (fwrite(buffer, 1, len, f) != (size_t)len))
+        {
+            perror(out_file);
+        }
+        if (f)
+        {
+            fclose(f);
+        }
+    }
+    return decode(buffer, len);
+}
@@ -0,0 +1,141 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Stand-in for the CMSIS device header when the USB driver is built for the
+ * host simulator (see usbsim.c). The USB device controller registers are
+ * C++ objects which pass every access to the register model in usbsim.c so
+ * the SIE command and data phases, the endpoint buffers and the interrupt
+ * status registers behave as they do on the part. Only the registers and
+ * core functions which the driver, usb_midi.c and midi_out.c use exist. */
+
+#ifndef LPC17XX_H_
+#define LPC17XX_H_
+
+#include <stdint.h>
+
+/* Every USB device controller register the model knows about. The order is
+ * the order of the report. */
+#define USBSIM_REGISTERS(REG)   \
+    REG(USBDevIntSt)            \
+    REG(USBDevIntEn)            \
+    REG(USBDevIntClr)           \
+    REG(USBDevIntSet)           \
+    REG(USBDevIntPri)           \
+    REG(USBEpIntSt)             \
+    REG(USBEpIntEn)             \
+    REG(USBEpIntClr)            \
+    REG(USBEpIntSet)            \
+    REG(USBEpIntPri)            \
+    REG(USBReEp)                \
+    REG(USBEpInd)               \
+    REG(USBMaxPSize)            \
+    REG(USBRxData)              \
+    REG(USBRxPLen)              \
+    REG(USBTxData)              \
+    REG(USBTxPLen)              \
+    REG(USBCtrl)                \
+    REG(USBCmdCode)             \
+    REG(USBCmdData)             \
+    REG(USBClkCtrl)             \
+    REG(USBClkSt)
+
+#define USBSIM_REG_ENUM_(name) USBSIM_REG_##name,
+enum usbsim_reg_e
+{
+    USBSIM_REGISTERS(USBSIM_REG_ENUM_)
+    USBSIM_NB_REGS
+};
+
+uint32_t    usbsim_reg_read(unsigned reg);
+void        usbsim_reg_write(unsigned reg, uint32_t value);
+
+template <unsigned REG>
+class usbsim_reg
+{
+public:
+    operator uint32_t() const
+    {
+        return usbsim_reg_read(REG);
+    }
+    usbsim_reg &operator=(uint32_t value)
+    {
+        usbsim_reg_write(REG, value);
+        return *this;
+    }
+    usbsim_reg &operator|=(uint32_t value)
+    {
+        usbsim_reg_write(REG, usbsim_reg_read(REG) | value);
+        return *this;
+    }
+    usbsim_reg &operator&=(uint32_t value)
+    {
+        usbsim_reg_write(REG, usbsim_reg_read(REG) & value);
+        return *this;
+    }
+};
+
+#define USBSIM_REG_MEMBER_(name) usbsim_reg<USBSIM_REG_##name> name;
+typedef struct
+{
+    USBSIM_REGISTERS(USBSIM_REG_MEMBER_)
+} LPC_USB_TypeDef;
+
+/* Plain memory: the model does not look at the pins or the power control */
+typedef struct
+{
+    volatile uint32_t PINSEL0;
+    volatile uint32_t PINSEL1;
+    volatile uint32_t PINSEL2;
+    volatile uint32_t PINSEL3;
+    volatile uint32_t PINSEL4;
+    volatile uint32_t PINMODE0;
+    volatile uint32_t PINMODE1;
+    volatile uint32_t PINMODE2;
+    volatile uint32_t PINMODE3;
+    volatile uint32_t PINMODE4;
+} LPC_PINCON_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t PCONP;
+} LPC_SC_TypeDef;
+
+extern LPC_USB_TypeDef      usbsim_usb;
+extern LPC_PINCON_TypeDef   usbsim_pincon;
+extern LPC_SC_TypeDef       usbsim_sc;
+
+#define LPC_USB             (&usbsim_usb)
+#define LPC_PINCON          (&usbsim_pincon)
+#define LPC_SC              (&usbsim_sc)
+
+typedef enum
+{
+    USB_IRQn = 24
+} IRQn_Type;
+
+void        NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void        NVIC_EnableIRQ(IRQn_Type irq);
+void        NVIC_DisableIRQ(IRQn_Type irq);
+
+/* The simulation is single threaded and the interrupt only runs between host
+ * transactions, so PRIMASK is only recorded. */
+uint32_t    __get_PRIMASK(void);
+void        __set_PRIMASK(uint32_t primask);
+void        __disable_irq(void);
+void        __enable_irq(void);
+
+#endif /* LPC17XX_H_ */
@@ -0,0 +1,1193 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Register model of the LPC176x USB device controller (UM10360 chapter 11)
+ * in slave mode, as far as the driver uses it:
+ *
+ * - USBCmdCode / USBCmdData: SIE command, write and read phases with the
+ *   CCEMPTY and CDFULL interrupt status bits.
+ * - USBCtrl, USBRxPLen, USBRxData, USBTxPLen, USBTxData: the endpoint
+ *   buffers. Bulk and isochronous endpoints are double buffered.
+ * - USBReEp, USBEpInd, USBMaxPSize: endpoint realization and EP_RLZD.
+ * - USBDevInt* and USBEpInt*: interrupt status, including the Select
+ *   Endpoint/Clear Interrupt command which writing USBEpIntClr issues.
+ *
+ * Anything the hardware would not do what the driver expects with (reading
+ * past the end of a packet, a data phase without a command, validating a
+ * full buffer...) is counted as an error. A driver which polls a status bit
+ * that never comes aborts the simulation. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "usbsim.h"
+
+/* Device interrupt bits (lpc176x_usb_pvt.h) */
+#define DI_FRAME                (0x001)
+#define DI_EP_FAST              (0x002)
+#define DI_EP_SLOW              (0x004)
+#define DI_DEV_STAT             (0x008)
+#define DI_CCEMPTY              (0x010)
+#define DI_CDFULL               (0x020)
+#define DI_EP_RLZD              (0x100)
+
+#define CTRL_RD_EN              (1 << 0)
+#define CTRL_WR_EN              (1 << 1)
+#define CTRL_LOG_ENDP(x)        (((x) >> 2) & 0xf)
+
+#define RX_PKT_VALID            (1 << 10)
+#define RX_PKT_RDY              (1 << 11)
+
+#define CMD_PHASE(x)            (((x) >> 8) & 0xff)
+#define CMD_PHASE_WR            (0x01)
+#define CMD_PHASE_RD            (0x02)
+#define CMD_PHASE_CMD           (0x05)
+#define CMD_CODE(x)             (((x) >> 16) & 0xff)
+
+#define SIE_SET_ADDRESS         (0xd0)
+#define SIE_CONFIGURE           (0xd8)
+#define SIE_SET_MODE            (0xf3)
+#define SIE_FRAME_NUMBER        (0xf5)
+#define SIE_DEVICE_STATUS       (0xfe)
+#define SIE_ERROR_CODE          (0xff)
+#define SIE_ERROR_STATUS        (0xfb)
+#define SIE_CLEAR_BUFFER        (0xf2)
+#define SIE_VALIDATE_BUFFER     (0xfa)
+#define SIE_SELECT_EP(x)        ((x) < 0x20)
+#define SIE_SELECT_EP_CLR(x)    (((x) >= 0x40) && ((x) < 0x60))
+
+#define DEV_STATUS_CON          (1 << 0)
+#define DEV_STATUS_CON_CH       (1 << 1)
+#define DEV_STATUS_SUS_CH       (1 << 3)
+#define DEV_STATUS_RST          (1 << 4)
+
+#define EPST_ST                 (1 << 0)
+#define EPST_DA                 (1 << 5)
+
+#define PKTST_FE                (1 << 0)
+#define PKTST_ST                (1 << 1)
+#define PKTST_STP               (1 << 2)
+#define PKTST_PO                (1 << 3)
+#define PKTST_EPN               (1 << 4)
+#define PKTST_B1_FULL           (1 << 5)
+#define PKTST_B2_FULL           (1 << 6)
+
+#define MODE_INAK_CI            (1 << 1)
+#define MODE_INAK_CO            (1 << 2)
+#define MODE_INAK_II            (1 << 3)
+#define MODE_INAK_IO            (1 << 4)
+#define MODE_INAK_BI            (1 << 5)
+#define MODE_INAK_BO            (1 << 6)
+
+#define MAX_PACKET              (1023)
+#define NB_PHY_EPS              (32)
+
+/* A driver which reads the same status register this many times in a row
+ * without anything else happening is waiting for something which will not
+ * come. */
+#define POLL_LIMIT              (100000)
+/* Interrupts in a row before the model gives up on an interrupt storm */
+#define IRQ_LIMIT               (1000)
+/* NAKs a control transfer stage is retried for */
+#define NAK_LIMIT               (16)
+
+enum ep_type_e { EP_CONTROL, EP_INTERRUPT, EP_BULK, EP_ISO };
+
+/* Endpoint types of the logical endpoints (UM10360 table 11.3) */
+static const unsigned char g_ep_type[16] =
+    {   EP_CONTROL
+    ,   EP_INTERRUPT,   EP_BULK,        EP_ISO
+    ,   EP_INTERRUPT,   EP_BULK,        EP_ISO
+    ,   EP_INTERRUPT,   EP_BULK,        EP_ISO
+    ,   EP_INTERRUPT,   EP_BULK,        EP_ISO
+    ,   EP_INTERRUPT,   EP_BULK,        EP_BULK
+    };
+
+struct endpoint_s
+{
+    int             realized;
+    unsigned        max_packet;
+    int             stalled;
+    int             disabled;
+    int             overwritten;    /* PO: a setup replaced unread data */
+    int             naked;          /* EPN */
+    unsigned        head;           /* Oldest full buffer */
+    unsigned        count;          /* Full buffers */
+    unsigned        length[2];
+    int             setup[2];
+    unsigned char   data[2][MAX_PACKET + 3];
+};
+
+static struct
+{
+    unsigned long       dev_int_st;
+    unsigned long       dev_int_en;
+    unsigned long       dev_int_pri;
+    unsigned long       ep_int_st;
+    unsigned long       ep_int_en;
+    unsigned long       ep_int_pri;
+    unsigned long       re_ep;
+    unsigned long       ep_ind;
+    unsigned long       clk_ctrl;
+    unsigned long       ctrl;
+    unsigned long       cmd_data;
+    /* SIE */
+    unsigned            command;        /* Last command phase, or -1 */
+    unsigned            reads;          /* Read phases since the command */
+    unsigned            selected;       /* Physical endpoint */
+    unsigned long       sie_done;       /* CCEMPTY/CDFULL still to be shown */
+    unsigned            sie_wait;       /* Polls before they are */
+    unsigned            address;
+    int                 address_enabled;
+    int                 pending_address;/* Applied after the status stage */
+    int                 configured;
+    unsigned            mode;
+    unsigned            status;         /* Device status */
+    unsigned            frame;
+    /* Packet being read or written through the FIFO registers */
+    unsigned            rx_ep;
+    unsigned            rx_pos;
+    unsigned            rx_length;
+    unsigned long       rx_plen;
+    unsigned            tx_ep;
+    unsigned            tx_pos;
+    unsigned            tx_length;
+    unsigned char       tx_data[MAX_PACKET + 3];
+    /* Polling and interrupts */
+    int                 irq_enabled;
+    unsigned            last_read;
+    unsigned            same_reads;
+    struct endpoint_s   ep[NB_PHY_EPS];
+} g_dev;
+
+static struct usbsim_counters_s g_counters;
+
+LPC_USB_TypeDef     usbsim_usb;
+LPC_PINCON_TypeDef  usbsim_pincon;
+LPC_SC_TypeDef      usbsim_sc;
+
+unsigned            usbsim_access_cycles    = 4;
+unsigned            usbsim_sie_polls        = 0;
+int                 usbsim_verbose          = 0;
+int                 usbsim_strict           = 0;
+
+#define USBSIM_REG_NAME_(name) #name,
+static const char *const g_reg_names[USBSIM_NB_REGS] =
+    {   USBSIM_REGISTERS(USBSIM_REG_NAME_)
+    };
+
+#define USBSIM_HS_NAME_(name) #name,
+static const char *const g_handshake_names[USBSIM_NB_HANDSHAKES] =
+    {   USBSIM_HANDSHAKES(USBSIM_HS_NAME_)
+    };
+
+const char *
+usbsim_reg_name
+    (unsigned reg
+    )
+{
+    return (reg < USBSIM_NB_REGS) ? g_reg_names[reg] : "?";
+}
+
+const char *
+usbsim_handshake_name
+    (int handshake
+    )
+{
+    return ((handshake >= 0) && (handshake < USBSIM_NB_HANDSHAKES)) ? g_handshake_names[handshake] : "?";
+}
+
+static
+void
+model_error
+    (const char *format
+    ,...
+    )
+{
+    g_counters.errors++;
+    if (usbsim_verbose || usbsim_strict)
+    {
+        va_list args;
+        va_start(args, format);
+        fprintf(stderr, "usbsim: ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+    }
+    if (usbsim_strict)
+    {
+        abort();
+    }
+}
+
+static
+void
+model_fatal
+    (const char *format
+    ,...
+    )
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "usbsim: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+/* Interrupts and the NVIC */
+
+void
+NVIC_SetPriority
+    (IRQn_Type irq
+    ,uint32_t  priority
+    )
+{
+    (void)irq;
+    (void)priority;
+}
+
+void
+NVIC_EnableIRQ
+    (IRQn_Type irq
+    )
+{
+    if (irq == USB_IRQn)
+    {
+        g_dev.irq_enabled = 1;
+    }
+}
+
+void
+NVIC_DisableIRQ
+    (IRQn_Type irq
+    )
+{
+    if (irq == USB_IRQn)
+    {
+        g_dev.irq_enabled = 0;
+    }
+}
+
+static uint32_t g_primask;
+
+uint32_t
+__get_PRIMASK
+    (void
+    )
+{
+    return g_primask;
+}
+
+void
+__set_PRIMASK
+    (uint32_t primask
+    )
+{
+    g_primask = primask;
+}
+
+void
+__disable_irq
+    (void
+    )
+{
+    g_primask = 1;
+}
+
+void
+__enable_irq
+    (void
+    )
+{
+    g_primask = 0;
+}
+
+static
+void
+run_interrupts
+    (void
+    )
+{
+    unsigned n = 0;
+    while   (   (g_dev.irq_enabled)
+            &&  (!g_primask)
+            &&  (g_dev.dev_int_st & g_dev.dev_int_en)
+            )
+    {
+        if (++n > IRQ_LIMIT)
+        {
+            model_fatal("interrupt storm: USBDevIntSt %03lx stays pending", g_dev.dev_int_st & g_dev.dev_int_en);
+        }
+        g_counters.interrupts++;
+        USB_IRQHandler();
+    }
+}
+
+static
+void
+raise_ep_interrupt
+    (unsigned phy
+    )
+{
+    const unsigned long bit = 1ul << phy;
+    /* Endpoints which are not enabled for slave mode interrupts are served
+     * by DMA, which the driver does not use. */
+    if (g_dev.ep_int_en & bit)
+    {
+        g_dev.ep_int_st  |= bit;
+        g_dev.dev_int_st |= (g_dev.ep_int_pri & bit) ? DI_EP_FAST : DI_EP_SLOW;
+    }
+}
+
+/* Endpoint buffers */
+
+static
+unsigned
+nb_buffers
+    (unsigned phy
+    )
+{
+    const unsigned type = g_ep_type[phy >> 1];
+    return ((type == EP_BULK) || (type == EP_ISO)) ? 2 : 1;
+}
+
+static
+void
+flush_endpoint
+    (unsigned phy
+    )
+{
+    struct endpoint_s *ep = &g_dev.ep[phy];
+    ep->head        = 0;
+    ep->count       = 0;
+    ep->overwritten = 0;
+    ep->naked       = 0;
+}
+
+/* Select Endpoint status byte (UM10360 11.10.3.4) */
+static
+unsigned
+endpoint_status
+    (unsigned phy
+    )
+{
+    const struct endpoint_s *ep = &g_dev.ep[phy];
+    unsigned status = 0;
+    unsigned i;
+    if (phy & 1)
+    {
+        if (ep->count == nb_buffers(phy))
+        {
+            status |= PKTST_FE;
+        }
+    }
+    else if (ep->count)
+    {
+        status |= PKTST_FE;
+        if (ep->setup[ep->head])
+        {
+            status |= PKTST_STP;
+        }
+    }
+    if (ep->stalled)
+    {
+        status |= PKTST_ST;
+    }
+    if (ep->overwritten)
+    {
+        status |= PKTST_PO;
+    }
+    if (ep->naked)
+    {
+        status |= PKTST_EPN;
+    }
+    for (i = 0; i < ep->count; i++)
+    {
+        status |= PKTST_B1_FULL << ((ep->head + i) & 1);
+    }
+    return status;
+}
+
+/* SIE commands */
+
+static
+void
+sie_complete
+    (unsigned long bits
+    )
+{
+    g_dev.sie_done  = bits;
+    g_dev.sie_wait  = usbsim_sie_polls;
+    if (!g_dev.sie_wait)
+    {
+        g_dev.dev_int_st |= bits;
+    }
+}
+
+static
+void
+sie_command
+    (unsigned code
+    )
+{
+    g_counters.sie_commands++;
+    g_dev.command   = code;
+    g_dev.reads     = 0;
+    if (SIE_SELECT_EP(code) || SIE_SELECT_EP_CLR(code))
+    {
+        g_dev.selected = code & 0x1f;
+    }
+    else if (code == SIE_VALIDATE_BUFFER)
+    {
+        const unsigned phy = g_dev.selected;
+        struct endpoint_s *ep = &g_dev.ep[phy];
+        if ((!(phy & 1)) && (phy != 0))
+        {
+            model_error("validate buffer of OUT endpoint %u", phy);
+        }
+        else if (!ep->realized)
+        {
+            model_error("validate buffer of unrealized endpoint %u", phy);
+        }
+        else if (phy != g_dev.tx_ep)
+        {
+            model_error("validate buffer of endpoint %u which was not written (%u was)", phy, g_dev.tx_ep);
+        }
+        else if (g_dev.tx_pos < ((g_dev.tx_length + 3) & ~3u))
+        {
+            model_error("validate buffer of endpoint %u after %u of %u bytes", phy, g_dev.tx_pos, g_dev.tx_length);
+        }
+        else if (ep->count == nb_buffers(phy))
+        {
+            model_error("validate buffer of endpoint %u which is full", phy);
+        }
+        else if (phy & 1)
+        {
+            const unsigned slot = (ep->head + ep->count) % nb_buffers(phy);
+            memcpy(ep->data[slot], g_dev.tx_data, g_dev.tx_length);
+            ep->length[slot]    = g_dev.tx_length;
+            ep->setup[slot]     = 0;
+            ep->count++;
+        }
+        g_dev.tx_ep = NB_PHY_EPS;
+    }
+    else if (code == SIE_CLEAR_BUFFER)
+    {
+        const unsigned phy = g_dev.selected;
+        struct endpoint_s *ep = &g_dev.ep[phy];
+        g_dev.cmd_data = ep->overwritten ? 1 : 0;
+        if (phy & 1)
+        {
+            model_error("clear buffer of IN endpoint %u", phy);
+        }
+        else if (!ep->count)
+        {
+            model_error("clear buffer of endpoint %u which is empty", phy);
+        }
+        else
+        {
+            ep->head = (ep->head + 1) % nb_buffers(phy);
+            ep->count--;
+        }
+    }
+    else if (   (code != SIE_SET_ADDRESS)
+            &&  (code != SIE_CONFIGURE)
+            &&  (code != SIE_SET_MODE)
+            &&  (code != SIE_FRAME_NUMBER)
+            &&  (code != SIE_DEVICE_STATUS)
+            &&  (code != SIE_ERROR_CODE)
+            &&  (code != SIE_ERROR_STATUS)
+            )
+    {
+        model_error("unknown SIE command %02x", code);
+        g_dev.command = (unsigned)-1;
+    }
+    sie_complete(DI_CCEMPTY);
+}
+
+static
+void
+sie_write
+    (unsigned data
+    )
+{
+    const unsigned code = g_dev.command;
+    if (code == SIE_SET_ADDRESS)
+    {
+        g_dev.pending_address = data;
+    }
+    else if (code == SIE_CONFIGURE)
+    {
+        g_dev.configured = data & 1;
+    }
+    else if (code == SIE_SET_MODE)
+    {
+        g_dev.mode = data;
+    }
+    else if (code == SIE_DEVICE_STATUS)
+    {
+        if ((data ^ g_dev.status) & DEV_STATUS_CON)
+        {
+            g_dev.status = (g_dev.status & ~DEV_STATUS_CON) | (data & DEV_STATUS_CON);
+        }
+    }
+    else if (SIE_SELECT_EP_CLR(code))
+    {
+        /* Set Endpoint Status */
+        struct endpoint_s *ep = &g_dev.ep[code & 0x1f];
+        if (ep->stalled && (!(data & EPST_ST)))
+        {
+            flush_endpoint(code & 0x1f);
+        }
+        ep->stalled     = (data & EPST_ST) != 0;
+        ep->disabled    = (data & EPST_DA) != 0;
+    }
+    else
+    {
+        model_error("write phase for SIE command %02x", code);
+    }
+    sie_complete(DI_CCEMPTY);
+}
+
+static
+void
+sie_read
+    (unsigned code
+    )
+{
+    unsigned long data = 0;
+    if (code != g_dev.command)
+    {
+        model_error("read phase for %02x after command %02x", code, g_dev.command);
+    }
+    else if (SIE_SELECT_EP(code))
+    {
+        data = endpoint_status(code);
+    }
+    else if (SIE_SELECT_EP_CLR(code))
+    {
+        data = endpoint_status(code & 0x1f);
+        g_dev.ep_int_st &= ~(1ul << (code & 0x1f));
+        g_dev.ep[code & 0x1f].naked         = 0;
+        g_dev.ep[code & 0x1f].overwritten   = 0;
+    }
+    else if (code == SIE_FRAME_NUMBER)
+    {
+        data = (g_dev.reads == 0) ? (g_dev.frame & 0xff) : (g_dev.frame >> 8);
+    }
+    else if (code == SIE_DEVICE_STATUS)
+    {
+        data = g_dev.status;
+        g_dev.status &= ~(DEV_STATUS_CON_CH | DEV_STATUS_SUS_CH | DEV_STATUS_RST);
+    }
+    else if (code == SIE_CLEAR_BUFFER)
+    {
+        data = g_dev.cmd_data;
+    }
+    else if ((code != SIE_ERROR_CODE) && (code != SIE_ERROR_STATUS))
+    {
+        model_error("read phase for SIE command %02x", code);
+    }
+    g_dev.reads++;
+    g_dev.cmd_data = data;
+    sie_complete(DI_CCEMPTY | DI_CDFULL);
+}
+
+/* Registers */
+
+static
+void
+start_read
+    (unsigned phy
+    )
+{
+    const struct endpoint_s *ep = &g_dev.ep[phy];
+    g_dev.rx_ep     = phy;
+    g_dev.rx_pos    = 0;
+    if (ep->count)
+    {
+        g_dev.rx_length = ep->length[ep->head];
+        g_dev.rx_plen   = g_dev.rx_length | RX_PKT_VALID | RX_PKT_RDY;
+    }
+    else
+    {
+        /* The hardware would never set PKT_RDY */
+        model_error("read from endpoint %u which is empty", phy);
+        g_dev.rx_length = 0;
+        g_dev.rx_plen   = RX_PKT_RDY;
+    }
+}
+
+uint32_t
+usbsim_reg_read
+    (unsigned reg
+    )
+{
+    uint32_t value = 0;
+    g_counters.reads[reg]++;
+    if ((reg == g_dev.last_read) && (++g_dev.same_reads > POLL_LIMIT))
+    {
+        model_fatal("driver polls %s forever", g_reg_names[reg]);
+    }
+    else if (reg != g_dev.last_read)
+    {
+        g_dev.last_read  = reg;
+        g_dev.same_reads = 0;
+    }
+    switch (reg)
+    {
+    case USBSIM_REG_USBDevIntSt:
+        if (g_dev.sie_wait && !(--g_dev.sie_wait))
+        {
+            g_dev.dev_int_st |= g_dev.sie_done;
+        }
+        value = g_dev.dev_int_st;
+        break;
+    case USBSIM_REG_USBDevIntEn:    value = g_dev.dev_int_en;       break;
+    case USBSIM_REG_USBDevIntPri:   value = g_dev.dev_int_pri;      break;
+    case USBSIM_REG_USBEpIntSt:     value = g_dev.ep_int_st;        break;
+    case USBSIM_REG_USBEpIntEn:     value = g_dev.ep_int_en;        break;
+    case USBSIM_REG_USBEpIntPri:    value = g_dev.ep_int_pri;       break;
+    case USBSIM_REG_USBReEp:        value = g_dev.re_ep;            break;
+    case USBSIM_REG_USBEpInd:       value = g_dev.ep_ind;           break;
+    case USBSIM_REG_USBMaxPSize:    value = g_dev.ep[g_dev.ep_ind].max_packet; break;
+    case USBSIM_REG_USBCtrl:        value = g_dev.ctrl;             break;
+    case USBSIM_REG_USBClkSt:       value = g_dev.clk_ctrl;         break;
+    case USBSIM_REG_USBCmdData:     value = g_dev.cmd_data;         break;
+    case USBSIM_REG_USBRxPLen:
+        if (!(g_dev.ctrl & CTRL_RD_EN))
+        {
+            model_error("USBRxPLen read without RD_EN");
+        }
+        value = g_dev.rx_plen;
+        break;
+    case USBSIM_REG_USBRxData:
+        if ((!(g_dev.ctrl & CTRL_RD_EN)) || (g_dev.rx_pos >= g_dev.rx_length))
+        {
+            model_error("USBRxData read past the end of a %u byte packet from endpoint %u", g_dev.rx_length, g_dev.rx_ep);
+        }
+        else
+        {
+            const struct endpoint_s *ep = &g_dev.ep[g_dev.rx_ep];
+            const unsigned char *p = &(ep->data[ep->head][g_dev.rx_pos]);
+            value = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            if (g_dev.rx_length - g_dev.rx_pos < 4)
+            {
+                value &= 0xfffffffful >> (8 * (4 - (g_dev.rx_length - g_dev.rx_pos)));
+            }
+            g_dev.rx_pos += 4;
+            if (g_dev.rx_pos >= g_dev.rx_length)
+            {
+                g_dev.ctrl &= ~CTRL_RD_EN;
+            }
+        }
+        break;
+    default:
+        model_error("read of write only register %s", g_reg_names[reg]);
+        break;
+    }
+    return value;
+}
+
+void
+usbsim_reg_write
+    (unsigned reg
+    ,uint32_t value
+    )
+{
+    unsigned i;
+    g_counters.writes[reg]++;
+    g_dev.last_read = USBSIM_NB_REGS;
+    switch (reg)
+    {
+    case USBSIM_REG_USBDevIntEn:    g_dev.dev_int_en  = value;      break;
+    case USBSIM_REG_USBDevIntClr:   g_dev.dev_int_st &= ~value;     break;
+    case USBSIM_REG_USBDevIntSet:   g_dev.dev_int_st |= value;      break;
+    case USBSIM_REG_USBDevIntPri:   g_dev.dev_int_pri = value;      break;
+    case USBSIM_REG_USBEpIntEn:     g_dev.ep_int_en   = value;      break;
+    case USBSIM_REG_USBEpIntPri:    g_dev.ep_int_pri  = value;      break;
+    case USBSIM_REG_USBEpIntSet:
+        for (i = 0; i < NB_PHY_EPS; i++)
+        {
+            if (value & (1ul << i))
+            {
+                raise_ep_interrupt(i);
+            }
+        }
+        break;
+    case USBSIM_REG_USBEpIntClr:
+        /* Clearing an endpoint interrupt runs Select Endpoint/Clear
+         * Interrupt and leaves its result in USBCmdData. */
+        for (i = 0; i < NB_PHY_EPS; i++)
+        {
+            if (value & (1ul << i))
+            {
+                g_dev.command = 0x40 | i;
+                sie_read(0x40 | i);
+            }
+        }
+        break;
+    case USBSIM_REG_USBReEp:
+        for (i = 0; i < NB_PHY_EPS; i++)
+        {
+            if ((g_dev.re_ep & ~value) & (1ul << i))
+            {
+                g_dev.ep[i].realized    = 0;
+                g_dev.ep[i].max_packet  = 0;
+                flush_endpoint(i);
+            }
+        }
+        g_dev.re_ep = value;
+        break;
+    case USBSIM_REG_USBEpInd:
+        g_dev.ep_ind = value & 0x1f;
+        break;
+    case USBSIM_REG_USBMaxPSize:
+        if (!(g_dev.re_ep & (1ul << g_dev.ep_ind)))
+        {
+            model_error("USBMaxPSize for endpoint %lu which is not in USBReEp", g_dev.ep_ind);
+        }
+        else if ((value > MAX_PACKET) || (value == 0))
+        {
+            model_error("USBMaxPSize %u for endpoint %lu", (unsigned)value, g_dev.ep_ind);
+        }
+        else
+        {
+            g_dev.ep[g_dev.ep_ind].realized     = 1;
+            g_dev.ep[g_dev.ep_ind].max_packet   = value;
+            flush_endpoint(g_dev.ep_ind);
+            g_dev.dev_int_st |= DI_EP_RLZD;
+        }
+        break;
+    case USBSIM_REG_USBCtrl:
+        g_dev.ctrl = value;
+        if (value & CTRL_RD_EN)
+        {
+            start_read(CTRL_LOG_ENDP(value) << 1);
+        }
+        if (value & CTRL_WR_EN)
+        {
+            g_dev.tx_ep     = (CTRL_LOG_ENDP(value) << 1) | 1;
+            g_dev.tx_pos    = 0;
+            g_dev.tx_length = 0;
+        }
+        break;
+    case USBSIM_REG_USBTxPLen:
+        if (!(g_dev.ctrl & CTRL_WR_EN))
+        {
+            model_error("USBTxPLen written without WR_EN");
+        }
+        else if (value > g_dev.ep[g_dev.tx_ep].max_packet)
+        {
+            model_error("USBTxPLen %u for endpoint %u with %u byte packets", (unsigned)value, g_dev.tx_ep, g_dev.ep[g_dev.tx_ep].max_packet);
+        }
+        else
+        {
+            g_dev.tx_length = value;
+        }
+        break;
+    case USBSIM_REG_USBTxData:
+        if ((!(g_dev.ctrl & CTRL_WR_EN)) || (g_dev.tx_pos >= g_dev.tx_length))
+        {
+            model_error("USBTxData written past the end of a %u byte packet to endpoint %u", g_dev.tx_length, g_dev.tx_ep);
+        }
+        else
+        {
+            unsigned char *p = &(g_dev.tx_data[g_dev.tx_pos]);
+            p[0] = value & 0xff;
+            p[1] = (value >> 8) & 0xff;
+            p[2] = (value >> 16) & 0xff;
+            p[3] = (value >> 24) & 0xff;
+            g_dev.tx_pos += 4;
+            if (g_dev.tx_pos >= g_dev.tx_length)
+            {
+                g_dev.ctrl &= ~CTRL_WR_EN;
+            }
+        }
+        break;
+    case USBSIM_REG_USBCmdCode:
+        g_dev.dev_int_st &= ~(g_dev.sie_done);
+        g_dev.sie_wait = 0;
+        switch (CMD_PHASE(value))
+        {
+        case CMD_PHASE_CMD: sie_command(CMD_CODE(value));   break;
+        case CMD_PHASE_WR:  sie_write(CMD_CODE(value));     break;
+        case CMD_PHASE_RD:  sie_read(CMD_CODE(value));      break;
+        default:
+            model_error("USBCmdCode %08x has no phase", (unsigned)value);
+            break;
+        }
+        break;
+    case USBSIM_REG_USBClkCtrl:
+        g_dev.clk_ctrl = value;
+        break;
+    default:
+        model_error("write to read only register %s", g_reg_names[reg]);
+        break;
+    }
+}
+
+/* Host side */
+
+void
+usbsim_power_on
+    (void
+    )
+{
+    memset(&g_dev, 0, sizeof(g_dev));
+    g_dev.command           = (unsigned)-1;
+    g_dev.tx_ep             = NB_PHY_EPS;
+    g_dev.last_read         = USBSIM_NB_REGS;
+    g_dev.dev_int_st        = DI_CCEMPTY;
+    g_dev.address_enabled   = 1;
+    g_dev.pending_address   = -1;
+    g_primask               = 0;
+    memset(&g_counters, 0, sizeof(g_counters));
+}
+
+int
+usbsim_connected
+    (void
+    )
+{
+    return (g_dev.status & DEV_STATUS_CON) != 0;
+}
+
+void
+usbsim_bus_reset
+    (void
+    )
+{
+    unsigned i;
+    for (i = 0; i < NB_PHY_EPS; i++)
+    {
+        flush_endpoint(i);
+        g_dev.ep[i].stalled = 0;
+    }
+    g_dev.address           = 0;
+    g_dev.address_enabled   = 1;
+    g_dev.pending_address   = -1;
+    g_dev.configured        = 0;
+    g_dev.ep_int_st         = 0;
+    g_dev.status           |= DEV_STATUS_RST;
+    g_dev.dev_int_st       |= DI_DEV_STAT;
+    run_interrupts();
+}
+
+void
+usbsim_frame
+    (void
+    )
+{
+    g_dev.frame         = (g_dev.frame + 1) & 0x7ff;
+    g_dev.dev_int_st   |= DI_FRAME;
+    run_interrupts();
+}
+
+/* Returns the physical endpoint which answers the token or -1 if nothing
+ * does (the host sees a timeout). */
+static
+int
+find_endpoint
+    (unsigned address
+    ,unsigned endpoint
+    ,int      in
+    )
+{
+    const unsigned phy = ((endpoint & 0xf) << 1) | (in ? 1 : 0);
+    if  (   (!(g_dev.status & DEV_STATUS_CON))
+        ||  (!g_dev.address_enabled)
+        ||  (address != g_dev.address)
+        ||  (!g_dev.ep[phy].realized)
+        ||  (g_dev.ep[phy].disabled)
+        ||  ((phy > 1) && (!g_dev.configured))
+        )
+    {
+        return -1;
+    }
+    return (int)phy;
+}
+
+int
+usbsim_setup
+    (unsigned               address
+    ,const unsigned char   *setup
+    )
+{
+    struct endpoint_s *ep;
+    if (find_endpoint(address, 0, 0) < 0)
+    {
+        return USBSIM_TIMEOUT;
+    }
+    /* A setup packet is always accepted, replaces anything unread and
+     * clears a protocol stall in both directions. */
+    ep = &g_dev.ep[0];
+    if (ep->count)
+    {
+        ep->overwritten = 1;
+    }
+    ep->head        = 0;
+    ep->count       = 1;
+    ep->length[0]   = 8;
+    ep->setup[0]    = 1;
+    memcpy(ep->data[0], setup, 8);
+    g_dev.ep[0].stalled = 0;
+    g_dev.ep[1].stalled = 0;
+    raise_ep_interrupt(0);
+    run_interrupts();
+    return USBSIM_ACK;
+}
+
+int
+usbsim_out
+    (unsigned               address
+    ,unsigned               endpoint
+    ,const unsigned char   *data
+    ,unsigned               length
+    )
+{
+    const int phy = find_endpoint(address, endpoint, 0);
+    struct endpoint_s *ep;
+    unsigned slot;
+    if ((phy < 0) || (length > g_dev.ep[phy].max_packet))
+    {
+        return USBSIM_TIMEOUT;
+    }
+    ep = &g_dev.ep[phy];
+    if (ep->stalled)
+    {
+        return USBSIM_STALL;
+    }
+    if (ep->count == nb_buffers(phy))
+    {
+        const unsigned type = g_ep_type[phy >> 1];
+        if  (   ((type == EP_BULK)      && (g_dev.mode & MODE_INAK_BO))
+            ||  ((type == EP_INTERRUPT) && (g_dev.mode & MODE_INAK_IO))
+            ||  ((type == EP_CONTROL)   && (g_dev.mode & MODE_INAK_CO))
+            )
+        {
+            ep->naked = 1;
+            raise_ep_interrupt(phy);
+            run_interrupts();
+        }
+        return USBSIM_NAK;
+    }
+    slot = (ep->head + ep->count) % nb_buffers(phy);
+    if (length)
+    {
+        memcpy(ep->data[slot], data, length);
+    }
+    ep->length[slot]    = length;
+    ep->setup[slot]     = 0;
+    ep->count++;
+    raise_ep_interrupt(phy);
+    run_interrupts();
+    return USBSIM_ACK;
+}
+
+int
+usbsim_in
+    (unsigned       address
+    ,unsigned       endpoint
+    ,unsigned char *data
+    ,unsigned       max_length
+    ,unsigned      *length
+    )
+{
+    const int phy = find_endpoint(address, endpoint, 1);
+    struct endpoint_s *ep;
+    *length = 0;
+    if (phy < 0)
+    {
+        return USBSIM_TIMEOUT;
+    }
+    ep = &g_dev.ep[phy];
+    if (ep->stalled)
+    {
+        return USBSIM_STALL;
+    }
+    if (!ep->count)
+    {
+        const unsigned type = g_ep_type[phy >> 1];
+        if  (   ((type == EP_BULK)      && (g_dev.mode & MODE_INAK_BI))
+            ||  ((type == EP_INTERRUPT) && (g_dev.mode & MODE_INAK_II))
+            ||  ((type == EP_CONTROL)   && (g_dev.mode & MODE_INAK_CI))
+            )
+        {
+            ep->naked = 1;
+            raise_ep_interrupt(phy);
+            run_interrupts();
+        }
+        return USBSIM_NAK;
+    }
+    *length = ep->length[ep->head];
+    if (*length > max_length)
+    {
+        /* Babble: the host takes no more than it asked for */
+        *length = max_length;
+    }
+    if (*length)
+    {
+        memcpy(data, ep->data[ep->head], *length);
+    }
+    ep->head = (ep->head + 1) % nb_buffers(phy);
+    ep->count--;
+    /* Set Address takes effect once the status stage has completed */
+    if ((phy == 1) && (g_dev.pending_address >= 0))
+    {
+        g_dev.address           = g_dev.pending_address & 0x7f;
+        g_dev.address_enabled   = (g_dev.pending_address & 0x80) != 0;
+        g_dev.pending_address   = -1;
+    }
+    raise_ep_interrupt(phy);
+    run_interrupts();
+    return USBSIM_ACK;
+}
+
+/* Retries a transaction which was NAKed. Each retry is a frame later so the
+ * device gets its frame interrupts. */
+static
+int
+in_retry
+    (unsigned       address
+    ,unsigned char *data
+    ,unsigned       max_length
+    ,unsigned      *length
+    )
+{
+    unsigned naks = 0;
+    int hs;
+    while (((hs = usbsim_in(address, 0, data, max_length, length)) == USBSIM_NAK) && (++naks < NAK_LIMIT))
+    {
+        usbsim_frame();
+    }
+    return hs;
+}
+
+static
+int
+out_retry
+    (unsigned               address
+    ,const unsigned char   *data
+    ,unsigned               length
+    )
+{
+    unsigned naks = 0;
+    int hs;
+    while (((hs = usbsim_out(address, 0, data, length)) == USBSIM_NAK) && (++naks < NAK_LIMIT))
+    {
+        usbsim_frame();
+    }
+    return hs;
+}
+
+int
+usbsim_control
+    (unsigned               address
+    ,const unsigned char   *setup
+    ,unsigned char         *data
+    ,unsigned              *length
+    )
+{
+    const unsigned wlength = setup[6] | ((unsigned)setup[7] << 8);
+    const unsigned max_packet = g_dev.ep[0].max_packet ? g_dev.ep[0].max_packet : 8;
+    unsigned done = 0;
+    unsigned char zlp[1];
+    unsigned zlp_length;
+    int hs = usbsim_setup(address, setup);
+    *length = 0;
+    if (hs != USBSIM_ACK)
+    {
+        return hs;
+    }
+    /* Without a data stage the status stage is IN whatever the direction
+     * of the request (USB2.0 8.5.3) */
+    if ((setup[0] & 0x80) && wlength)
+    {
+        /* IN data stage until a short packet or wLength bytes */
+        while (done < wlength)
+        {
+            unsigned got;
+            hs = in_retry(address, data + done, wlength - done, &got);
+            if (hs != USBSIM_ACK)
+            {
+                *length = done;
+                return hs;
+            }
+            done += got;
+            if (got < max_packet)
+            {
+                break;
+            }
+        }
+        *length = done;
+        return out_retry(address, 0, 0);
+    }
+    while (done < wlength)
+    {
+        const unsigned chunk = (wlength - done < max_packet) ? (wlength - done) : max_packet;
+        hs = out_retry(address, data + done, chunk);
+        if (hs != USBSIM_ACK)
+        {
+            *length = done;
+            return hs;
+        }
+        done += chunk;
+    }
+    *length = done;
+    hs = in_retry(address, zlp, sizeof(zlp), &zlp_length);
+    if ((hs == USBSIM_ACK) && zlp_length)
+    {
+        model_error("status stage returned %u bytes", zlp_length);
+    }
+    return hs;
+}
+
+void
+usbsim_get_counters
+    (struct usbsim_counters_s *counters
+    )
+{
+    *counters = g_counters;
+}
+
+unsigned long
+usbsim_accesses
+    (const struct usbsim_counters_s    *from
+    ,const struct usbsim_counters_s    *to
+    )
+{
+    unsigned long accesses = 0;
+    unsigned i;
+    for (i = 0; i < USBSIM_NB_REGS; i++)
+    {
+        accesses += (to->reads[i] - from->reads[i]) + (to->writes[i] - from->writes[i]);
+    }
+    return accesses;
+}
+
+unsigned long
+usbsim_cycles
+    (const struct usbsim_counters_s    *from
+    ,const struct usbsim_counters_s    *to
+    )
+{
+    return usbsim_accesses(from, to) * usbsim_access_cycles;
+}
@@ -0,0 +1,104 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Host side of the USB device controller model: what a host (and the bus)
+ * can do to the device, and the register access counters. The driver side is
+ * the register objects in LPC17xx.h. After every transaction the model runs
+ * USB_IRQHandler for as long as an enabled device interrupt is pending, as
+ * the NVIC would. */
+
+#ifndef USBSIM_H_
+#define USBSIM_H_
+
+#include "LPC17xx.h"
+
+/* Handshakes (or the lack of one) seen by the host */
+#define USBSIM_HANDSHAKES(HS)   \
+    HS(ACK)                     \
+    HS(NAK)                     \
+    HS(STALL)                   \
+    HS(TIMEOUT)
+
+#define USBSIM_HS_ENUM_(name) USBSIM_##name,
+enum usbsim_handshake_e
+{
+    USBSIM_HANDSHAKES(USBSIM_HS_ENUM_)
+    USBSIM_NB_HANDSHAKES
+};
+
+struct usbsim_counters_s
+{
+    unsigned long   reads[USBSIM_NB_REGS];
+    unsigned long   writes[USBSIM_NB_REGS];
+    unsigned long   sie_commands;   /* Command phases written to USBCmdCode */
+    unsigned long   interrupts;     /* USB_IRQHandler calls */
+    unsigned long   errors;         /* Accesses the hardware would not do
+                                     * what the driver expected with */
+};
+
+/* Cost of one register access in CPU cycles, and how many polls of
+ * USBDevIntSt a SIE command or data phase takes to complete. These are
+ * assumptions of the model, not measurements (defaults 4 and 0). */
+extern unsigned usbsim_access_cycles;
+extern unsigned usbsim_sie_polls;
+
+/* Non-zero to print every model error as it happens */
+extern int      usbsim_verbose;
+/* Non-zero to abort on the first model error (for fuzzing) */
+extern int      usbsim_strict;
+
+/* Put the controller in its power on state (nothing is connected). */
+void        usbsim_power_on(void);
+/* Returns non-zero once the driver has set the CON device status bit. */
+int         usbsim_connected(void);
+/* Drive a bus reset. */
+void        usbsim_bus_reset(void);
+/* Start of frame. */
+void        usbsim_frame(void);
+/* Single transactions to the endpoint (0 to 15) at the device address. */
+int         usbsim_setup(unsigned address, const unsigned char *setup);
+int         usbsim_out(unsigned address, unsigned endpoint, const unsigned char *data, unsigned length);
+int         usbsim_in(unsigned address, unsigned endpoint, unsigned char *data, unsigned max_length, unsigned *length);
+/* A complete control transfer: the setup stage, the data stage in either
+ * direction (wLength bytes of data are sent from or read into data) and the
+ * status stage. NAKed stages are retried up to a limit. Returns USBSIM_ACK
+ * if every stage completed, otherwise the handshake which ended it. *length
+ * is the number of data bytes transferred. */
+int         usbsim_control(unsigned address, const unsigned char *setup, unsigned char *data, unsigned *length);
+
+void        usbsim_get_counters(struct usbsim_counters_s *counters);
+/* Accesses and modelled cycles between two counter snapshots */
+unsigned long usbsim_accesses(const struct usbsim_counters_s *from, const struct usbsim_counters_s *to);
+unsigned long usbsim_cycles(const struct usbsim_counters_s *from, const struct usbsim_counters_s *to);
+
+const char *usbsim_reg_name(unsigned reg);
+const char *usbsim_handshake_name(int handshake);
+
+/* Firmware stand-ins (usbsim_stubs.c) for the modules usb_midi.c uses,
+ * other than midi_out.c which is the real one. Event packets the host sends
+ * are recorded as midi_router_post receives them. */
+#define USBSIM_MAX_PACKETS      (65536)
+extern unsigned long    usbsim_router_packets[USBSIM_MAX_PACKETS];
+extern unsigned         usbsim_nb_router_packets;
+extern unsigned long    usbsim_sysex_packets;
+extern unsigned long    usbsim_asserts;         /* ASSERT failures */
+extern int              usbsim_store_busy;      /* config_store_busy() */
+
+/* The interrupt handler of the driver */
+void        USB_IRQHandler(void);
+
+#endif /* USBSIM_H_ */
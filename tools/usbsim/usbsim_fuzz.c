@@ -0,0 +1,327 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Fuzzing harness for the control request dispatch and the configuration
+ * descriptor walk of the USB driver, running on the register model of the
+ * simulator (usbsim.c). An input is a configuration and a list of host
+ * actions:
+ *
+ *   byte 0       bit 0 set: the USB MIDI configuration of usb_midi.c, with
+ *                its vendor requests, and nothing else before the actions.
+ *                Otherwise bits 1-2 choose an EP0 packet size of 8 << n and
+ *                the configuration descriptor follows.
+ *   bytes 1-2    Length of the configuration descriptor (little endian) and
+ *                the descriptor. Its wTotalLength is set to that length and
+ *                short ones are padded to the 9 byte header: get_cfg_desc
+ *                promises a whole descriptor, so what matters is the walk of
+ *                whatever it contains.
+ *   actions      0x00 s0-s7       control transfer with the setup packet
+ *                0x01             bus reset
+ *                0x02             start of frame
+ *                0x03 ep n data   OUT transaction of n (up to 64) bytes
+ *                0x04 ep          IN transaction
+ *                (the action code is taken modulo 5)
+ *
+ * The host follows SET_ADDRESS and bus resets so later transfers reach the
+ * device. A driver which waits on a register for something that will not
+ * come, an interrupt storm, or any access the hardware would not do what the
+ * driver expected with aborts. Build with AddressSanitizer so reads outside
+ * the descriptors and setup packets abort too. Loops which never touch a
+ * register (a descriptor walk which does not advance) are left to the
+ * fuzzer's timeout, or the alarm of the standalone runner.
+ *
+ * The seed corpus in corpus/ holds enumerations of the USB MIDI
+ * configuration, the vendor requests, and the MIDI configuration descriptor
+ * with and without broken descriptor lengths. The midi_enum_synth_ seeds
+ * were written by hand after the order in which Linux, macOS and Windows
+ * are known to send their requests, they are not bus captures. Captures
+ * (usbmon or Wireshark) converted to the actions above can be added next
+ * to them.
+ *
+ * libFuzzer:
+ *   clang++ -g -O1 -fsanitize=fuzzer,address,undefined -DUSBSIM_LIBFUZZER \
+ *       -x c++ -I. -I../../src -o usbsim_fuzz usbsim_fuzz.c usbsim.c \
+ *       usbsim_stubs.c ../../src/lpc176x_usb.c ../../src/lpc176x_usb_sie.c \
+ *       ../../src/usb_midi.c ../../src/midi_out.c
+ *   ./usbsim_fuzz -timeout=1 corpus_work corpus
+ *
+ * AFL (the same sources with afl-clang-fast++ and no USBSIM_LIBFUZZER):
+ *   afl-fuzz -i corpus -o findings -- ./usbsim_fuzz @@
+ *
+ * Without a fuzzer (g++ and -fsanitize=address,undefined) the same binary
+ * runs the files it is given, or standard input, once each and prints the
+ * register accesses and modelled cycles each took. Run it over the corpus
+ * to check that a change to the parser still handles every seed and what
+ * it costs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "usbsim.h"
+#include "lpc176x_usb.h"
+#include "usb_midi.h"
+#include "midi_out.h"
+
+#define FLAG_MIDI_CONFIG        (0x01)
+#define FLAG_EP0_SIZE(flags)    (8u << (((flags) >> 1) & 3))
+
+#define CFG_HEADER_LEN          (9)
+#define MAX_ACTIONS             (256)
+#define MAX_OUT_LEN             (64)
+
+enum action_e
+{   ACTION_CONTROL
+,   ACTION_RESET
+,   ACTION_FRAME
+,   ACTION_OUT
+,   ACTION_IN
+,   NB_ACTIONS
+};
+
+static unsigned char        g_dev_desc[18] =
+    {   18
+    ,   0x01
+    ,   0x10, 0x01  /* usb 1.10 */
+    ,   0x00, 0x00, 0x00
+    ,   0x08        /* EP0 packet size, from the input */
+    ,   0x00, 0x00  /* vendor */
+    ,   0x00, 0x00  /* product */
+    ,   0x01, 0x00  /* release */
+    ,   0x00, 0x00  /* no strings */
+    ,   0x00
+    ,   0x01        /* 1 configuration */
+    };
+
+static const unsigned char  g_lang_desc[4] = { 4, 0x03, 0x09, 0x04 };
+
+static unsigned char       *g_cfg_desc;
+
+static
+const unsigned char *
+fuzz_get_cfg_desc
+    (unsigned index
+    )
+{
+    return (index == 0) ? g_cfg_desc : 0;
+}
+
+static
+const unsigned char *
+fuzz_get_string_desc
+    (unsigned string_id
+    ,unsigned lang_id
+    )
+{
+    return (string_id == 0) ? g_lang_desc : 0;
+}
+
+static
+const struct usb_configuration_s g_fuzz_config =
+{   g_dev_desc
+,   fuzz_get_cfg_desc
+,   fuzz_get_string_desc
+,   0
+,   0
+,   0
+};
+
+/* Runs one input. Returns the number of actions taken. */
+static
+unsigned
+run_input
+    (const uint8_t *data
+    ,size_t         size
+    )
+{
+    size_t      pos = 1;
+    unsigned    address = 0;
+    unsigned    nb_actions = 0;
+    if (size < 1)
+    {
+        return 0;
+    }
+    usbsim_power_on();
+    usbsim_nb_router_packets = 0;
+    midi_out_clear();
+    if (data[0] & FLAG_MIDI_CONFIG)
+    {
+        usb_midi_setup();
+    }
+    else
+    {
+        unsigned length;
+        unsigned alloc;
+        if (size < 3)
+        {
+            return 0;
+        }
+        length  = data[1] | ((unsigned)data[2] << 8);
+        pos     = 3;
+        if (length > size - pos)
+        {
+            length = size - pos;
+        }
+        /* Exactly as long as the descriptor says, so the sanitizer sees a
+         * read past the end of it */
+        alloc = (length < CFG_HEADER_LEN) ? CFG_HEADER_LEN : length;
+        g_cfg_desc = (unsigned char *)malloc(alloc);
+        memset(g_cfg_desc, 0, alloc);
+        memcpy(g_cfg_desc, data + pos, length);
+        g_cfg_desc[2] = alloc & 0xff;
+        g_cfg_desc[3] = alloc >> 8;
+        pos += length;
+        g_dev_desc[7] = FLAG_EP0_SIZE(data[0]);
+        usb_setup(&g_fuzz_config);
+    }
+    usbsim_bus_reset();
+    while ((pos < size) && (nb_actions < MAX_ACTIONS))
+    {
+        /* Room for the largest data stage a setup packet can ask for */
+        static unsigned char buffer[0x10000];
+        const unsigned action = data[pos++] % NB_ACTIONS;
+        unsigned length;
+        nb_actions++;
+        if (action == ACTION_CONTROL)
+        {
+            const unsigned char *setup = data + pos;
+            if (size - pos < 8)
+            {
+                break;
+            }
+            pos += 8;
+            if  (   (usbsim_control(address, setup, buffer, &length) == USBSIM_ACK)
+                &&  (setup[0] == 0x00)
+                &&  (setup[1] == 5)
+                )
+            {
+                address = setup[2] & 0x7f;
+            }
+        }
+        else if (action == ACTION_RESET)
+        {
+            usbsim_bus_reset();
+            address = 0;
+        }
+        else if (action == ACTION_FRAME)
+        {
+            usbsim_frame();
+        }
+        else if (action == ACTION_OUT)
+        {
+            unsigned ep;
+            if (size - pos < 2)
+            {
+                break;
+            }
+            ep      = data[pos++] & 0xf;
+            length  = data[pos++] % (MAX_OUT_LEN + 1);
+            if (length > size - pos)
+            {
+                length = size - pos;
+            }
+            (void)usbsim_out(address, ep, data + pos, length);
+            pos += length;
+        }
+        else
+        {
+            if (size - pos < 1)
+            {
+                break;
+            }
+            (void)usbsim_in(address, data[pos++] & 0xf, buffer, sizeof(buffer), &length);
+        }
+    }
+    free(g_cfg_desc);
+    g_cfg_desc = 0;
+    return nb_actions;
+}
+
+extern "C"
+int
+LLVMFuzzerTestOneInput
+    (const uint8_t *data
+    ,size_t         size
+    )
+{
+    usbsim_strict = 1;
+    (void)run_input(data, size);
+    return 0;
+}
+
+#if !defined(USBSIM_LIBFUZZER)
+
+/* No input takes anywhere near this long, one that does is stuck */
+#define RUN_SECONDS             (2)
+
+static
+void
+run_file
+    (const char    *name
+    ,FILE          *f
+    )
+{
+    static uint8_t              data[1 << 16];
+    struct usbsim_counters_s    from;
+    struct usbsim_counters_s    to;
+    unsigned                    nb_actions;
+    const size_t                size = fread(data, 1, sizeof(data), f);
+    usbsim_strict = 1;
+    alarm(RUN_SECONDS);
+    nb_actions = run_input(data, size);
+    alarm(0);
+    /* The counters start again with every input */
+    memset(&from, 0, sizeof(from));
+    usbsim_get_counters(&to);
+    printf
+        ("%-32s %5u actions %7lu accesses %8lu cycles %5lu irqs\n"
+        ,name
+        ,nb_actions
+        ,usbsim_accesses(&from, &to)
+        ,usbsim_cycles(&from, &to)
+        ,to.interrupts
+        );
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    int i;
+    if (argc < 2)
+    {
+        run_file("-", stdin);
+        return 0;
+    }
+    for (i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(argv[i], f);
+        fclose(f);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,484 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Host-side simulator of the USB MIDI device: the real USB driver
+ * (lpc176x_usb.c, lpc176x_usb_sie.c), usb_midi.c and midi_out.c running
+ * against a register model of the LPC176x USB device controller (usbsim.c).
+ * A scripted host resets the bus, enumerates the device (GET_DESCRIPTOR,
+ * SET_ADDRESS, SET_CONFIGURATION), makes vendor requests and moves bulk
+ * traffic both ways, checking every answer. For each transfer it reports the
+ * USB register accesses the firmware made, the SIE commands, the interrupts
+ * and the cycles those accesses cost in the model.
+ *
+ * The model only prices register accesses: the instructions between them
+ * are not counted, so the cycles are a lower bound which shows how much of
+ * a transfer is spent talking to the controller.
+ *
+ * The driver sources are C but the registers of the model are C++ objects
+ * (see LPC17xx.h), so everything is built as C++:
+ *
+ * Build:
+ *   g++ -O2 -Wall -x c++ -I. -I../../src -o usbsim usbsim_main.c usbsim.c \
+ *       usbsim_stubs.c ../../src/lpc176x_usb.c ../../src/lpc176x_usb_sie.c \
+ *       ../../src/usb_midi.c ../../src/midi_out.c
+ *
+ * Usage:
+ *   usbsim [-a cycles] [-p polls] [-n packets] [-v]
+ *
+ *   -a    CPU cycles per register access (default 4)
+ *   -p    polls of USBDevIntSt before a SIE phase completes (default 0)
+ *   -n    bulk packets in each direction for the throughput runs (1000)
+ *   -v    print model errors as they happen and the accesses per register
+ *
+ * The exit status is non-zero if a check failed, the model saw an access
+ * the hardware would not have done what the driver expected with, or an
+ * ASSERT in the firmware failed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "usbsim.h"
+#include "lpc176x_usb.h"
+#include "usb_midi.h"
+#include "midi_out.h"
+
+#define DEVICE_ADDRESS          (5)
+#define MIDI_EP                 (2)
+#define BULK_PACKET             (64)
+#define EVENTS_PER_PACKET       (BULK_PACKET / 4)
+
+static unsigned                 g_failures;
+static struct usbsim_counters_s g_mark;
+
+static
+void
+check
+    (int         ok
+    ,const char *format
+    ,...
+    )
+{
+    if (!ok)
+    {
+        va_list args;
+        va_start(args, format);
+        printf("FAIL: ");
+        vprintf(format, args);
+        printf("\n");
+        va_end(args);
+        g_failures++;
+    }
+}
+
+/* Transfers are reported as the counters moved between begin and end */
+static
+void
+transfer_begin
+    (void
+    )
+{
+    usbsim_get_counters(&g_mark);
+}
+
+static
+void
+transfer_end
+    (const char *name
+    ,int         handshake
+    ,unsigned    bytes
+    ,unsigned    count
+    )
+{
+    struct usbsim_counters_s now;
+    usbsim_get_counters(&now);
+    if (count > 1)
+    {
+        printf
+            ("%-36s %-7s %6u %9.1f %6.1f %5.1f %9.1f  (per packet, %u packets)\n"
+            ,name
+            ,usbsim_handshake_name(handshake)
+            ,bytes / count
+            ,(double)usbsim_accesses(&g_mark, &now) / count
+            ,(double)(now.sie_commands - g_mark.sie_commands) / count
+            ,(double)(now.interrupts - g_mark.interrupts) / count
+            ,(double)usbsim_cycles(&g_mark, &now) / count
+            ,count
+            );
+    }
+    else
+    {
+        printf
+            ("%-36s %-7s %6u %9lu %6lu %5lu %9lu\n"
+            ,name
+            ,(handshake < 0) ? "-" : usbsim_handshake_name(handshake)
+            ,bytes
+            ,usbsim_accesses(&g_mark, &now)
+            ,now.sie_commands - g_mark.sie_commands
+            ,now.interrupts - g_mark.interrupts
+            ,usbsim_cycles(&g_mark, &now)
+            );
+    }
+}
+
+static
+int
+control
+    (const char    *name
+    ,unsigned       address
+    ,unsigned       request_type
+    ,unsigned       request
+    ,unsigned       wvalue
+    ,unsigned       windex
+    ,unsigned       wlength
+    ,unsigned char *data
+    ,unsigned      *length
+    )
+{
+    unsigned char setup[8];
+    int hs;
+    setup[0] = request_type;
+    setup[1] = request;
+    setup[2] = wvalue & 0xff;
+    setup[3] = wvalue >> 8;
+    setup[4] = windex & 0xff;
+    setup[5] = windex >> 8;
+    setup[6] = wlength & 0xff;
+    setup[7] = wlength >> 8;
+    transfer_begin();
+    hs = usbsim_control(address, setup, data, length);
+    transfer_end(name, hs, *length, 1);
+    return hs;
+}
+
+static
+int
+get_descriptor
+    (const char    *name
+    ,unsigned       address
+    ,unsigned       type
+    ,unsigned       index
+    ,unsigned       lang_id
+    ,unsigned       wlength
+    ,unsigned char *data
+    ,unsigned      *length
+    )
+{
+    return control(name, address, 0x80, 6, (type << 8) | index, lang_id, wlength, data, length);
+}
+
+static
+void
+bus_reset
+    (void
+    )
+{
+    transfer_begin();
+    usbsim_bus_reset();
+    transfer_end("bus reset", -1, 0, 1);
+}
+
+static
+void
+enumerate
+    (void
+    )
+{
+    unsigned char   data[1024];
+    unsigned        length;
+    unsigned        total;
+    int             hs;
+
+    /* As Linux does it: the first 64 bytes of the device descriptor at the
+     * default address, a second reset, then the address. */
+    bus_reset();
+    hs = get_descriptor("GET_DESCRIPTOR device (64)", 0, 1, 0, 0, 64, data, &length);
+    check((hs == USBSIM_ACK) && (length == 18) && (data[0] == 18) && (data[1] == 1), "device descriptor (%s, %u bytes)", usbsim_handshake_name(hs), length);
+    bus_reset();
+    hs = control("SET_ADDRESS", 0, 0x00, 5, DEVICE_ADDRESS, 0, 0, data, &length);
+    check(hs == USBSIM_ACK, "SET_ADDRESS (%s)", usbsim_handshake_name(hs));
+    hs = get_descriptor("GET_DESCRIPTOR device (old address)", 0, 1, 0, 0, 18, data, &length);
+    check(hs == USBSIM_TIMEOUT, "device still answers at address 0 (%s)", usbsim_handshake_name(hs));
+    hs = get_descriptor("GET_DESCRIPTOR device (18)", DEVICE_ADDRESS, 1, 0, 0, 18, data, &length);
+    check((hs == USBSIM_ACK) && (length == 18), "device descriptor (%s, %u bytes)", usbsim_handshake_name(hs), length);
+
+    hs = get_descriptor("GET_DESCRIPTOR config (9)", DEVICE_ADDRESS, 2, 0, 0, 9, data, &length);
+    check((hs == USBSIM_ACK) && (length == 9) && (data[1] == 2), "configuration header (%s, %u bytes)", usbsim_handshake_name(hs), length);
+    total = data[2] | ((unsigned)data[3] << 8);
+    hs = get_descriptor("GET_DESCRIPTOR config (total)", DEVICE_ADDRESS, 2, 0, 0, total, data, &length);
+    check((hs == USBSIM_ACK) && (length == total), "configuration (%s, %u of %u bytes)", usbsim_handshake_name(hs), length, total);
+    hs = get_descriptor("GET_DESCRIPTOR config (1023)", DEVICE_ADDRESS, 2, 0, 0, 1023, data, &length);
+    check((hs == USBSIM_ACK) && (length == total), "configuration (%s, %u of %u bytes)", usbsim_handshake_name(hs), length, total);
+
+    /* There is no language table: the request stalls and the next one
+     * must still work. */
+    hs = get_descriptor("GET_DESCRIPTOR string 0", DEVICE_ADDRESS, 3, 0, 0, 255, data, &length);
+    check(hs == USBSIM_STALL, "language table (%s)", usbsim_handshake_name(hs));
+    hs = get_descriptor("GET_DESCRIPTOR string 1", DEVICE_ADDRESS, 3, 1, 0x409, 255, data, &length);
+    check((hs == USBSIM_ACK) && (length == data[0]) && (data[1] == 3), "manufacturer string (%s, %u bytes)", usbsim_handshake_name(hs), length);
+    hs = get_descriptor("GET_DESCRIPTOR string 2", DEVICE_ADDRESS, 3, 2, 0x409, 255, data, &length);
+    check((hs == USBSIM_ACK) && (length == data[0]) && (data[1] == 3), "product string (%s, %u bytes)", usbsim_handshake_name(hs), length);
+
+    transfer_begin();
+    hs = usbsim_out(DEVICE_ADDRESS, MIDI_EP, data, 4);
+    transfer_end("bulk OUT before SET_CONFIGURATION", hs, 0, 1);
+    check(hs == USBSIM_TIMEOUT, "bulk OUT answered before configuration (%s)", usbsim_handshake_name(hs));
+
+    hs = control("SET_CONFIGURATION 1", DEVICE_ADDRESS, 0x00, 9, 1, 0, 0, data, &length);
+    check(hs == USBSIM_ACK, "SET_CONFIGURATION (%s)", usbsim_handshake_name(hs));
+}
+
+static
+void
+put_word
+    (unsigned char *p
+    ,unsigned long  word
+    )
+{
+    p[0] = word & 0xff;
+    p[1] = (word >> 8) & 0xff;
+    p[2] = (word >> 16) & 0xff;
+    p[3] = (word >> 24) & 0xff;
+}
+
+static
+unsigned long
+get_word
+    (const unsigned char *p
+    )
+{
+    return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static
+void
+requests
+    (void
+    )
+{
+    unsigned char   data[1024];
+    unsigned long   magic;
+    unsigned        length;
+    int             hs;
+
+    /* The response is an array of unsigned long, which are 8 bytes long in
+     * a 64-bit host build */
+    hs = control("vendor HEALTH", DEVICE_ADDRESS, 0xc0, USB_MIDI_REQ_HEALTH, 0, 0, sizeof(data), data, &length);
+    magic = get_word(data);
+    check((hs == USBSIM_ACK) && (length == sizeof(unsigned long) * (2 + USB_MIDI_HEALTH_NB_FIELDS)) && (magic == USB_MIDI_HEALTH_MAGIC), "health (%s, %u bytes)", usbsim_handshake_name(hs), length);
+    hs = control("vendor SET_RESYNC", DEVICE_ADDRESS, 0x40, USB_MIDI_REQ_SET_RESYNC, 1, 0, 0, data, &length);
+    check(hs == USBSIM_ACK, "SET_RESYNC (%s)", usbsim_handshake_name(hs));
+    usbsim_store_busy = 1;
+    hs = control("vendor SET_RESYNC (store busy)", DEVICE_ADDRESS, 0x40, USB_MIDI_REQ_SET_RESYNC, 0, 0, 0, data, &length);
+    usbsim_store_busy = 0;
+    check(hs == USBSIM_STALL, "SET_RESYNC while the store is busy (%s)", usbsim_handshake_name(hs));
+
+    /* Not implemented: stalled, and cleared by the next setup */
+    hs = control("GET_STATUS (unsupported)", DEVICE_ADDRESS, 0x80, 0, 0, 0, 2, data, &length);
+    check(hs == USBSIM_STALL, "GET_STATUS (%s)", usbsim_handshake_name(hs));
+    hs = control("SET_OUTPUT with data (unsupported)", DEVICE_ADDRESS, 0x40, USB_MIDI_REQ_SET_OUTPUT, 0, 0, 4, data, &length);
+    check(hs == USBSIM_STALL, "request with a data stage (%s)", usbsim_handshake_name(hs));
+    hs = get_descriptor("GET_DESCRIPTOR device (after stall)", DEVICE_ADDRESS, 1, 0, 0, 18, data, &length);
+    check((hs == USBSIM_ACK) && (length == 18), "device descriptor after a stall (%s, %u bytes)", usbsim_handshake_name(hs), length);
+}
+
+static
+unsigned long
+test_event
+    (unsigned n
+    )
+{
+    return USB_MIDI_PACKET(USB_MIDI_CABLE_DIN, 0x90, n & 0x7f, 1 + (n >> 7) % 127);
+}
+
+/* Sends nb_packets full bulk packets of note-on events on the DIN cable and
+ * checks that every event reached the router in order. */
+static
+void
+bulk_out
+    (const char    *name
+    ,unsigned       nb_packets
+    )
+{
+    unsigned char   data[BULK_PACKET];
+    unsigned        first = usbsim_nb_router_packets;
+    unsigned        n = 0;
+    unsigned        i, j;
+    int             hs = USBSIM_ACK;
+    transfer_begin();
+    for (i = 0; (i < nb_packets) && (hs == USBSIM_ACK); i++)
+    {
+        for (j = 0; j < EVENTS_PER_PACKET; j++)
+        {
+            put_word(data + 4 * j, test_event(first + EVENTS_PER_PACKET * i + j));
+        }
+        hs = usbsim_out(DEVICE_ADDRESS, MIDI_EP, data, sizeof(data));
+    }
+    transfer_end(name, hs, BULK_PACKET * i, i);
+    check(hs == USBSIM_ACK, "%s (%s)", name, usbsim_handshake_name(hs));
+    for (i = first; i < usbsim_nb_router_packets; i++, n++)
+    {
+        check(usbsim_router_packets[i] == test_event(i), "event %u is %08lx", i, usbsim_router_packets[i]);
+    }
+    check(n == EVENTS_PER_PACKET * nb_packets, "%u of %u events reached the router", n, EVENTS_PER_PACKET * nb_packets);
+    /* Keep the next run within the recording */
+    usbsim_nb_router_packets = 0;
+}
+
+/* Queues nb_events events for the host and collects them with bulk IN
+ * transactions, one per frame (which is when the device sends). */
+static
+void
+bulk_in
+    (const char    *name
+    ,unsigned       nb_events
+    )
+{
+    unsigned char   data[BULK_PACKET];
+    unsigned        received = 0;
+    unsigned        posted = 0;
+    unsigned        nb_packets = 0;
+    unsigned        idle = 0;
+    int             hs = USBSIM_ACK;
+    transfer_begin();
+    while ((received < nb_events) && (idle < 4))
+    {
+        unsigned length;
+        unsigned i;
+        while ((posted < nb_events) && (posted - received < EVENTS_PER_PACKET) && midi_out_post(0, test_event(posted)))
+        {
+            posted++;
+        }
+        usbsim_frame();
+        hs = usbsim_in(DEVICE_ADDRESS, MIDI_EP, data, sizeof(data), &length);
+        if (hs != USBSIM_ACK)
+        {
+            idle++;
+            continue;
+        }
+        idle = 0;
+        nb_packets++;
+        for (i = 0; i < length; i += 4)
+        {
+            const unsigned long event = get_word(data + i);
+            check(event == test_event(received), "IN event %u is %08lx", received, event);
+            received++;
+        }
+    }
+    transfer_end(name, USBSIM_ACK, 4 * received, nb_packets);
+    check(received == nb_events, "%s: %u of %u events received (%s)", name, received, nb_events, usbsim_handshake_name(hs));
+    transfer_begin();
+    hs = usbsim_in(DEVICE_ADDRESS, MIDI_EP, data, sizeof(data), &posted);
+    transfer_end("bulk IN (nothing queued)", hs, posted, 1);
+    check(hs == USBSIM_NAK, "bulk IN with nothing queued (%s)", usbsim_handshake_name(hs));
+}
+
+static
+void
+deconfigure
+    (void
+    )
+{
+    unsigned char   data[64];
+    unsigned        length;
+    int             hs;
+    hs = control("SET_CONFIGURATION 0", DEVICE_ADDRESS, 0x00, 9, 0, 0, 0, data, &length);
+    check(hs == USBSIM_ACK, "SET_CONFIGURATION 0 (%s)", usbsim_handshake_name(hs));
+    memset(data, 0, sizeof(data));
+    hs = usbsim_out(DEVICE_ADDRESS, MIDI_EP, data, 4);
+    check(hs == USBSIM_TIMEOUT, "bulk OUT answered when not configured (%s)", usbsim_handshake_name(hs));
+    hs = control("SET_CONFIGURATION 1", DEVICE_ADDRESS, 0x00, 9, 1, 0, 0, data, &length);
+    check(hs == USBSIM_ACK, "SET_CONFIGURATION 1 (%s)", usbsim_handshake_name(hs));
+    bus_reset();
+    check(!usb_is_configured(), "still configured after a bus reset");
+    hs = usbsim_out(DEVICE_ADDRESS, MIDI_EP, data, 4);
+    check(hs == USBSIM_TIMEOUT, "bulk OUT answered after a bus reset (%s)", usbsim_handshake_name(hs));
+    hs = get_descriptor("GET_DESCRIPTOR device (after reset)", 0, 1, 0, 0, 18, data, &length);
+    check((hs == USBSIM_ACK) && (length == 18), "device descriptor after a bus reset (%s, %u bytes)", usbsim_handshake_name(hs), length);
+}
+
+int
+main
+    (int    argc
+    ,char  *argv[]
+    )
+{
+    struct usbsim_counters_s    counters;
+    unsigned                    nb_packets = 1000;
+    unsigned                    i;
+    int                         opt;
+
+    while ((opt = getopt(argc, argv, "a:p:n:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            usbsim_access_cycles = strtoul(optarg, 0, 0);
+            break;
+        case 'p':
+            usbsim_sie_polls = strtoul(optarg, 0, 0);
+            break;
+        case 'n':
+            nb_packets = strtoul(optarg, 0, 0);
+            break;
+        case 'v':
+            usbsim_verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: usbsim [-a cycles] [-p polls] [-n packets] [-v]\n");
+            return 2;
+        }
+    }
+    if ((!nb_packets) || (nb_packets > USBSIM_MAX_PACKETS / EVENTS_PER_PACKET))
+    {
+        fprintf(stderr, "usbsim: -n must be 1 to %u\n", USBSIM_MAX_PACKETS / EVENTS_PER_PACKET);
+        return 2;
+    }
+
+    printf("%-36s %-7s %6s %9s %6s %5s %9s\n", "transfer", "result", "bytes", "accesses", "sie", "irqs", "cycles");
+    usbsim_power_on();
+    transfer_begin();
+    usb_midi_setup();
+    transfer_end("usb_midi_setup", -1, 0, 1);
+    check(usbsim_connected(), "not connected after usb_midi_setup");
+
+    enumerate();
+    requests();
+    bulk_out("bulk OUT (1 packet)", 1);
+    bulk_out("bulk OUT", nb_packets);
+    bulk_in("bulk IN (20 events)", 20);
+    bulk_in("bulk IN", EVENTS_PER_PACKET * nb_packets);
+    deconfigure();
+
+    usbsim_get_counters(&counters);
+    if (usbsim_verbose)
+    {
+        printf("\n%-14s %10s %10s\n", "register", "reads", "writes");
+        for (i = 0; i < USBSIM_NB_REGS; i++)
+        {
+            printf("%-14s %10lu %10lu\n", usbsim_reg_name(i), counters.reads[i], counters.writes[i]);
+        }
+    }
+    printf
+        ("\n%u checks failed, %lu model errors, %lu asserts\n"
+        ,g_failures
+        ,counters.errors
+        ,usbsim_asserts
+        );
+    return (g_failures || counters.errors || usbsim_asserts) ? 1 : 0;
+}
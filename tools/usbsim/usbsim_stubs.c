@@ -0,0 +1,282 @@
+/* LPC176x based USB MIDI Organ Console Controller
+ * Copyright (C) 2012  Nick Appleton (http://www.appletonaudio.com/)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Stand-ins for the modules usb_midi.c calls, so the USB driver and the MIDI
+ * class code can run in the simulator without the console bus, the DIN port
+ * or the flash. They return fixed values and record what they are given. */
+
+#include <stdio.h>
+#include <string.h>
+#include "usbsim.h"
+#include "midi_sysex.h"
+#include "midi_router.h"
+#include "midi_din.h"
+#include "midi_resync.h"
+#include "stop_action.h"
+#include "conbus.h"
+#include "config_store.h"
+#include "boot_time.h"
+#include "lpc176x_clock.h"
+#include "trace.h"
+#include "usb_midi.h"
+
+unsigned long   usbsim_router_packets[USBSIM_MAX_PACKETS];
+unsigned        usbsim_nb_router_packets;
+unsigned long   usbsim_sysex_packets;
+unsigned long   usbsim_asserts;
+int             usbsim_store_busy;
+
+static unsigned long    g_boot_times[BOOT_NB_PHASES];
+static int              g_resync_enabled;
+
+void
+midi_sysex_rx
+    (unsigned long packet
+    )
+{
+    const unsigned cin = USB_MIDI_PACKET_CIN(packet);
+    if ((cin >= 0x4) && (cin <= 0x7))
+    {
+        usbsim_sysex_packets++;
+    }
+}
+
+void
+midi_sysex_get_stats
+    (struct midi_sysex_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+int
+midi_router_post
+    (unsigned       source
+    ,unsigned long  packet
+    )
+{
+    (void)source;
+    if (usbsim_nb_router_packets < USBSIM_MAX_PACKETS)
+    {
+        usbsim_router_packets[usbsim_nb_router_packets++] = packet;
+        return 1;
+    }
+    return 0;
+}
+
+void
+midi_router_frame
+    (void
+    )
+{
+}
+
+void
+midi_router_get_stats
+    (struct midi_router_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void
+midi_din_get_stats
+    (struct midi_din_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void
+midi_resync_frame
+    (int configured
+    )
+{
+    (void)configured;
+}
+
+void
+midi_resync_set_enabled
+    (int enabled
+    )
+{
+    g_resync_enabled = enabled;
+}
+
+void
+stop_action_get_stats
+    (struct stop_action_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+int
+config_store_busy
+    (void
+    )
+{
+    return usbsim_store_busy;
+}
+
+int
+config_store_write
+    (unsigned       tag
+    ,const void    *data
+    ,unsigned       length
+    )
+{
+    (void)tag;
+    (void)data;
+    (void)length;
+    return usbsim_store_busy ? -1 : 0;
+}
+
+void
+config_store_get_stats
+    (struct config_store_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void
+conbus_get_stats
+    (struct conbus_stats_s *stats
+    )
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+unsigned
+conbus_copy_inputs
+    (unsigned char *dst
+    ,unsigned       max_bytes
+    )
+{
+    const unsigned nb_bytes = (max_bytes < 8) ? max_bytes : 8;
+    memset(dst, 0, nb_bytes);
+    return nb_bytes;
+}
+
+unsigned long
+conbus_get_baud_rate
+    (void
+    )
+{
+    return 60000;
+}
+
+unsigned
+conbus_get_nb_inputs_div_8
+    (void
+    )
+{
+    return 64;
+}
+
+unsigned
+conbus_get_nb_outputs_div_8
+    (void
+    )
+{
+    return 8;
+}
+
+unsigned
+conbus_get_probe
+    (void
+    )
+{
+    return CONBUS_PROBE_OFF;
+}
+
+int
+conbus_get_dimming
+    (void
+    )
+{
+    return 0;
+}
+
+void
+conbus_set_output_level
+    (unsigned output
+    ,unsigned level
+    )
+{
+    (void)output;
+    (void)level;
+}
+
+unsigned long
+clock_get_cclk
+    (void
+    )
+{
+    return 120000000ul;
+}
+
+void
+clock_usb_setup
+    (void
+    )
+{
+}
+
+void
+boot_time_mark
+    (unsigned phase
+    )
+{
+    (void)phase;
+}
+
+const unsigned long *
+boot_time_get
+    (void
+    )
+{
+    return g_boot_times;
+}
+
+const void *
+trace_snapshot
+    (unsigned *length
+    )
+{
+    static const unsigned long header = TRACE_MAGIC;
+    *length = sizeof(header);
+    return &header;
+}
+
+void
+trace_write
+    (unsigned       event
+    ,unsigned long  a
+    ,unsigned long  b
+    )
+{
+    if (event == TRACE_EVENT_ASSERT)
+    {
+        usbsim_asserts++;
+        if (usbsim_verbose)
+        {
+            fprintf(stderr, "usbsim: ASSERT failed at %s:%lu\n", (const char *)b, a);
+        }
+    }
+}